@@ -108,8 +108,11 @@ static int m_name(struct module *module, int id){
 //////////////////////////////////////////////////////////////////////////////
 static int m_init(struct module *module){
     struct filter_data *data;
+    char *filter;
+    char *file;
 
-    module->data = (struct filter_data*) malloc(sizeof(struct filter_data));
+    // Zeroed, m_clean may run after any of the failures below
+    module->data = (struct filter_data*) calloc(1, sizeof(struct filter_data));
     data = module_data(module, struct filter_data);
     if (module->data == NULL) {
         rum_error(module->errctx, RUM_ENO_MEMORY);
@@ -117,8 +120,6 @@ static int m_init(struct module *module){
         return -1;
     }
 
-    memset(data,'\0', sizeof(struct filter_data));
-
     data->qgroup = queue_group_reg(module->errctx, 1, module->input_data);
     if (data->qgroup == NULL) {
         rum_error_push(module->errctx, RUM_EPROC_INIT);
@@ -131,22 +132,119 @@ static int m_init(struct module *module){
         return -1;
     }
 
-    data->data_sample = modparam_get(module, PARAM_FILTER);
-    if (data->data_sample == NULL) {
+    // Get the burst size from module parameters
+    if ((data->batch = atol(modparam_get(module, PARAM_FILTER_BATCH))) <= 0
+        || data->batch > MAX_FILTER_BATCH) {
+        rum_error(module->errctx, RUM_EPROC_PARAMS);
+        rum_error_push(module->errctx, RUM_EPROC_INIT);
+        return -1;
+    }
+
+    // Compile the patterns (parameter list and optional file)
+    data->matcher = matcher_new();
+    if (data->matcher == NULL) {
+        rum_error(module->errctx, RUM_ENO_MEMORY);
+        rum_error_push(module->errctx, RUM_EPROC_INIT);
+        return -1;
+    }
+
+    filter = modparam_get(module, PARAM_FILTER);
+    file = modparam_get(module, PARAM_FILTER_FILE);
+    if ((filter != NULL && matcher_parse(data->matcher, filter, ',') < 0)
+        || (file != NULL && file[0] != '\0'
+            && load_patterns(data->matcher, file) != 0)
+        || matcher_compile(data->matcher) != 0) {
+        rum_error(module->errctx, RUM_EPROC_PARAMS);
         rum_error_push(module->errctx, RUM_EPROC_INIT);
         return -1;
     }
 
     rlog(MC_MANAGEMENT, MANAGEMENT_MASTER, LOG_NOTICE,
-         "Pre-start init done: %s/%s",
-         module_class(module->id.mclass), module->id.name);
+         "Pre-start init done: %s/%s (%d patterns, %s)",
+         module_class(module->id.mclass), module->id.name,
+         data->matcher->count, matcher_engine_name(data->matcher->engine));
 
     return 0;
 }
 
 //////////////////////////////////////////////////////////////////////////////
-/// Module main function. Looks for data similar to \a Sample and masks them
-/// in the output queue.
+/// Add the patterns of a pattern file (one per line, see matcher_parse()).
+///
+/// \param matcher The pattern set.
+/// \param file Path to the file.
+/// \return Zero on success, nonzero otherwise.
+//////////////////////////////////////////////////////////////////////////////
+static int load_patterns(struct matcher *matcher, const char *file){
+    FILE *input;
+    char *text;
+    long size;
+    int added;
+
+    if ((input = fopen(file, "rb")) == NULL)
+        return -1;
+
+    if (fseek(input, 0, SEEK_END) != 0 || (size = ftell(input)) < 0
+        || fseek(input, 0, SEEK_SET) != 0
+        || (text = (char *) malloc(size + 1)) == NULL) {
+        fclose(input);
+        return -1;
+    }
+
+    size = fread(text, 1, size, input);
+    text[size] = '\0';
+    fclose(input);
+
+    added = matcher_parse(matcher, text, '\n');
+    free(text);
+
+    return added < 0 ? -1 : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Take up to \a max packets from a data queue, with a single lock round
+/// trip if the core provides queue_pop_data_batch().
+///
+/// \param queue The input queue.
+/// \param metas Where to store the packets, the oldest first.
+/// \param max Maximum number of packets.
+/// \return Number of packets taken, zero on empty queue.
+//////////////////////////////////////////////////////////////////////////////
+static int pop_batch(struct queue *queue, struct meta **metas, int max){
+    int count = 0;
+
+    if (max > 1 && queue_pop_data_batch != NULL)
+        return queue_pop_data_batch(queue, (void **) metas, max);
+
+    while (count < max && queue_pop_data(queue, (void **) &metas[count]) == 0)
+        count++;
+
+    return count;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Pass packets on to the next module, at once if the core provides
+/// processor_path_pass_batch().
+///
+/// \param master Module processor/master.
+/// \param metas The packets.
+/// \param count Number of packets.
+//////////////////////////////////////////////////////////////////////////////
+static void pass_batch(struct module *master, struct meta **metas, int count){
+    int i;
+
+    if (count > 1 && processor_path_pass_batch != NULL) {
+        processor_path_pass_batch(master, metas, count);
+        return;
+    }
+
+    for (i = 0; i < count; i++)
+        processor_path_pass(master, metas[i]);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Module main function. Takes bursts of packets from the input queue,
+/// looks for any of the patterns anywhere in the data, masks the matching
+/// data in the output queue and passes the burst on.
 ///
 /// \param module Pointer to module structure.
 //////////////////////////////////////////////////////////////////////////////
@@ -154,48 +252,70 @@ static void m_main(struct module *module){
 
     // Get data
     struct filter_data *data = module_data(module, struct filter_data);
+    struct meta **burst = data->burst;
     struct meta *meta;
     int stop = 0;
-    int check_result;
+    int pattern;
+    int count;
+    int valid;
+    int i;
+    long offset;
 
     // Log start
-    logm(&module->id, LOG_INFO, "Filter started with \"%s\" as data sample",
-         data->data_sample);
+    logm(&module->id, LOG_INFO, "Filter started with %d patterns (%s), "
+         "bursts of %d", data->matcher->count,
+         matcher_engine_name(data->matcher->engine), data->batch);
 
     while(!stop){
 
-        // Get item from queue
-        if (queue_pop_data(module->input_data, (void **) &meta))
+        // Get items from queue
+        if ((count = pop_batch(module->input_data, burst, data->batch)) == 0) {
             queue_group_wait(data->qgroup);
-        else {
+            continue;
+        }
+
+        // The metadata are scattered over the heap, load them in parallel
+        for (i = 0; i < count; i++)
+            __builtin_prefetch(burst[i]);
+
+        for (i = valid = 0; i < count; i++) {
+            meta = burst[i];
+
             // Got data?
-            if (meta != NULL && meta->data != NULL) {
-
-                // Check data/sample similarities
-                check_result = memcmp(data->data_sample, meta->data->buffer,
-                                      sizeof(data->data_sample));
-
-                // The same?
-                if(check_result == 0){
-                    // Mask it
-                    meta_mask_all(meta, 0);
-                    logm(&module->id, LOG_INFO,
-                         "Removing \"%s\" from output_queue",
-                         data->data_sample);
-                }
-
-                // Send along to the next module
-                processor_path_pass(data->master, meta);
-            }
-            else{
+            if (meta == NULL || meta->data == NULL) {
                 // Something went wrong
                 rum_error_push(module->errctx, RUM_EPROC_PROCESS);
                 logerrorm(module, LOG_ERROR);
+                continue;
+            }
+
+            // Start loading the next payload while this one is searched
+            if (i + 1 < count && burst[i + 1] != NULL
+                && burst[i + 1]->data != NULL)
+                __builtin_prefetch(burst[i + 1]->data->buffer);
+
+            // Look for the patterns in the whole payload
+            offset = matcher_find(data->matcher, meta->data->buffer,
+                                  meta->data->size, &pattern);
+
+            // Found?
+            if(offset >= 0){
+                // Mask it
+                meta_mask_all(meta, 0);
+                data->masked++;
+                logm(&module->id, LOG_DEBUG,
+                     "Removing data matching pattern %d (offset %ld) "
+                     "from output_queue", pattern, offset);
             }
+
+            burst[valid++] = meta;
         }
+
+        // Send along to the next module
+        pass_batch(data->master, burst, valid);
     }
 
-    logm(&module->id, LOG_INFO,"Filtering ended");
+    logm(&module->id, LOG_INFO,"Filtering ended (%lu masked)", data->masked);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -206,7 +326,9 @@ static void m_clean(struct module *module, int for_restart){
     struct filter_data *data = module_data(module, struct filter_data);
 
     if (data != NULL) {
+        matcher_free(data->matcher);
         free(data);
+        module->data = NULL;
     }
 
     if (!for_restart) {
@@ -35,6 +35,8 @@
 #include <rum2/module.h>
 #include <stdio.h>
 
+#include "filter_match.h"
+
 //////////////////////////////////////////////////////////////////////////////
 /// Default name of this module.
 ///
@@ -92,6 +94,33 @@ static int m_config(struct module *module, const char *name, int start);
 //////////////////////////////////////////////////////////////////////////////
 static void m_stop(struct module *module);
 
+//////////////////////////////////////////////////////////////////////////////
+/// \see filter.c
+//////////////////////////////////////////////////////////////////////////////
+static int load_patterns(struct matcher *matcher, const char *file);
+
+//////////////////////////////////////////////////////////////////////////////
+/// Burst functions of a core that has them (the in-process host does, see
+/// rtsp_host.c); they are not part of the core's headers. Weak references -
+/// with a core without them they resolve to NULL and the packets are popped
+/// and passed on one by one.
+//////////////////////////////////////////////////////////////////////////////
+extern int queue_pop_data_batch(struct queue *queue, void **items, int max);
+extern void processor_path_pass_batch(struct module *mod, struct meta **metas,
+                                      int count);
+#pragma weak queue_pop_data_batch
+#pragma weak processor_path_pass_batch
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see filter.c
+//////////////////////////////////////////////////////////////////////////////
+static int pop_batch(struct queue *queue, struct meta **metas, int max);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see filter.c
+//////////////////////////////////////////////////////////////////////////////
+static void pass_batch(struct module *master, struct meta **metas, int count);
+
 //////////////////////////////////////////////////////////////////////////////
 /// Module interface structure.
 //////////////////////////////////////////////////////////////////////////////
@@ -121,7 +150,41 @@ static struct module_interface iface = {
 ///
 /// Human-readable description of \a PARAM_FILTER parameter.
 //////////////////////////////////////////////////////////////////////////////
-#define PARAM_FILTER_DESC  "sample of unwanted data"
+#define PARAM_FILTER_DESC  "patterns of unwanted data anywhere in the payload (escapes \\\\ and \\xHH)"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Filter file parameter - name.
+///
+/// Human-readable name of a module parameter.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_FILTER_FILE   "Filter-File"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Filter file parameter - description.
+///
+/// Human-readable description of \a PARAM_FILTER_FILE parameter.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_FILTER_FILE_DESC  "file with more patterns (one per line)"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Default and largest number of packets taken from the input queue at once.
+//////////////////////////////////////////////////////////////////////////////
+#define FILTER_BATCH "32"
+#define MAX_FILTER_BATCH 64
+
+//////////////////////////////////////////////////////////////////////////////
+/// Filter batch parameter - name.
+///
+/// Human-readable name of a module parameter.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_FILTER_BATCH   "Filter-Batch"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Filter batch parameter - description.
+///
+/// Human-readable description of \a PARAM_FILTER_BATCH parameter.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_FILTER_BATCH_DESC  "max. packets taken from the input queue at once (defaults to " FILTER_BATCH ")"
 
 //////////////////////////////////////////////////////////////////////////////
 /// Module parameters.
@@ -129,7 +192,9 @@ static struct module_interface iface = {
 /// Names, descriptions and default values for module parameters.
 //////////////////////////////////////////////////////////////////////////////
 static struct module_param params[] = {
-    { NULL, PARAM_FILTER, PARAM_FILTER_DESC, "ping\0", NULL }
+    { NULL, PARAM_FILTER, PARAM_FILTER_DESC, "ping\0", NULL },
+    { NULL, PARAM_FILTER_FILE, PARAM_FILTER_FILE_DESC, "", NULL },
+    { NULL, PARAM_FILTER_BATCH, PARAM_FILTER_BATCH_DESC, FILTER_BATCH, NULL }
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -145,7 +210,10 @@ static struct module_param params[] = {
 struct filter_data {
     struct queue_group *qgroup; ///< Queue group for waiting on queue(s).
     struct module *master;      ///< Module processor/master.
-    char *data_sample;          ///< Sample data to be masked in output_queue(s).
+    struct matcher *matcher;    ///< Patterns to be masked in output_queue(s).
+    unsigned long masked;       ///< Packets masked so far.
+    int batch;                  ///< Packets taken from the queue at once.
+    struct meta *burst[MAX_FILTER_BATCH]; ///< Packets being filtered.
 };
 
 #endif
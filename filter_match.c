@@ -0,0 +1,539 @@
+/*
+ Filter processor module.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Multi-pattern payload matcher of the filter processor.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# define MATCH_X86 1
+# include <immintrin.h>
+#endif
+
+#include "filter_match.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Names of the engines (logs, benchmarks).
+//////////////////////////////////////////////////////////////////////////////
+static const char *const engine_names[] = { "scalar", "ssse3", "avx2" };
+
+//////////////////////////////////////////////////////////////////////////////
+/// Create an empty pattern set.
+///
+/// \return The matcher, NULL if out of memory.
+//////////////////////////////////////////////////////////////////////////////
+struct matcher *matcher_new(void){
+    struct matcher *matcher;
+    int i;
+
+    if((matcher = calloc(1, sizeof(struct matcher))) == NULL) return NULL;
+    for(i = 0; i < 256; i++) matcher->single[i] = -1;
+    return matcher;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Free the pattern set (NULL is ignored).
+//////////////////////////////////////////////////////////////////////////////
+void matcher_free(struct matcher *matcher){
+    int i;
+
+    if(matcher == NULL) return;
+
+    for(i = 0; i < matcher->count; i++)
+        free(matcher->patterns[i].bytes);
+    free(matcher->patterns);
+    free(matcher->pair_first);
+    free(matcher);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Add a pattern (copied) to the set; the set has to be compiled again.
+///
+/// \param matcher The pattern set.
+/// \param pattern Pattern bytes (any values).
+/// \param len Length of the pattern (1 - MATCH_PATTERN_MAX).
+/// \return Zero on success, -1 on an invalid length or out of memory.
+//////////////////////////////////////////////////////////////////////////////
+int matcher_add(struct matcher *matcher, const void *pattern, size_t len){
+    struct match_pattern *patterns;
+    unsigned char *bytes;
+
+    if(len == 0 || len > MATCH_PATTERN_MAX) return -1;
+
+    if(matcher->count == matcher->size){
+        patterns = realloc(matcher->patterns, (matcher->size * 2 + 16)
+                           * sizeof(struct match_pattern));
+        if(patterns == NULL) return -1;
+        matcher->patterns = patterns;
+        matcher->size = matcher->size * 2 + 16;
+    }
+
+    if((bytes = malloc(len)) == NULL) return -1;
+    memcpy(bytes, pattern, len);
+
+    matcher->patterns[matcher->count].bytes = bytes;
+    matcher->patterns[matcher->count].len = len;
+    matcher->patterns[matcher->count].id = matcher->count;
+    matcher->count++;
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Value of a hexadecimal digit, -1 if \a c is not one.
+//////////////////////////////////////////////////////////////////////////////
+static int hex_digit(char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Add the patterns of a text list - patterns are separated by \a separator
+/// (',' in the Filter parameter, '\\n' in a pattern file), empty ones are
+/// skipped. Escapes: "\\\\", "\\" + separator, "\\xHH" (any byte), "\\0",
+/// "\\t", "\\r", "\\n". In a file, lines starting with '#' are comments and
+/// a CR before the line end is ignored.
+///
+/// \param matcher The pattern set.
+/// \param text The list (null-terminated).
+/// \param separator Pattern separator.
+/// \return Number of patterns added, -1 on a bad escape or a pattern
+///         longer than MATCH_PATTERN_MAX.
+//////////////////////////////////////////////////////////////////////////////
+int matcher_parse(struct matcher *matcher, const char *text, char separator){
+    unsigned char pattern[MATCH_PATTERN_MAX];
+    size_t len = 0;
+    int added = 0;
+    int high;
+    int low;
+    char c;
+
+    for(;;){
+        // Comment lines of pattern files
+        if(separator == '\n' && len == 0 && *text == '#'){
+            text += strcspn(text, "\n");
+            continue;
+        }
+
+        c = *text++;
+        if(c == separator || c == '\0'){
+            if(separator == '\n' && len > 0 && pattern[len - 1] == '\r'
+               && text[-2] == '\r')
+                len--;
+            if(len > 0){
+                if(matcher_add(matcher, pattern, len) != 0) return -1;
+                added++;
+            }
+            len = 0;
+            if(c == '\0') return added;
+            continue;
+        }
+
+        if(len == sizeof(pattern)) return -1;
+
+        if(c != '\\'){
+            pattern[len++] = (unsigned char) c;
+            continue;
+        }
+
+        c = *text++;
+        if(c == '\\' || c == separator) pattern[len++] = (unsigned char) c;
+        else if(c == '0') pattern[len++] = '\0';
+        else if(c == 't') pattern[len++] = '\t';
+        else if(c == 'r') pattern[len++] = '\r';
+        else if(c == 'n') pattern[len++] = '\n';
+        else if(c == 'x' && (high = hex_digit(text[0])) >= 0
+                && (low = hex_digit(text[1])) >= 0){
+            pattern[len++] = (unsigned char) (high << 4 | low);
+            text += 2;
+        }
+        else return -1;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Order of patterns by their bytes (qsort) - the patterns of one byte pair
+/// are contiguous and patterns sharing a prefix end up in one bucket.
+//////////////////////////////////////////////////////////////////////////////
+static int compare_bytes(const void *a, const void *b){
+    const struct match_pattern *x = (const struct match_pattern *) a;
+    const struct match_pattern *y = (const struct match_pattern *) b;
+    size_t len = x->len < y->len ? x->len : y->len;
+    int cmp;
+
+    if((cmp = memcmp(x->bytes, y->bytes, len)) != 0) return cmp;
+    if(x->len != y->len) return x->len < y->len ? -1 : 1;
+    return x->id - y->id;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Byte pair of a pattern (one-byte patterns sort before the pairs they
+/// start).
+//////////////////////////////////////////////////////////////////////////////
+static inline unsigned pattern_pair(const struct match_pattern *pattern){
+    return pattern->bytes[0] << 8 | (pattern->len > 1 ? pattern->bytes[1] : 0);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Bit of the byte pair at \a bytes in the pair bitmap - the pair loaded
+/// as a native 16-bit word, one load per position in the scan.
+//////////////////////////////////////////////////////////////////////////////
+static inline unsigned pair_bit(const unsigned char *bytes){
+    uint16_t word;
+
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Index the patterns by their byte pairs, build the prefilter tables and
+/// choose the engine (the prefilter for small sets if the CPU has it).
+///
+/// \param matcher The pattern set.
+/// \return Zero on success, -1 if the set is empty or out of memory.
+//////////////////////////////////////////////////////////////////////////////
+int matcher_compile(struct matcher *matcher){
+    const struct match_pattern *pattern;
+    int bucket[MATCH_BUCKETS + 1];
+    unsigned char bytes[2];
+    unsigned pair;
+    size_t i;
+    int b;
+    int k;
+
+    if(matcher->count == 0) return -1;
+
+    free(matcher->pair_first);
+    matcher->pair_first = malloc((65536 + 1) * sizeof(int));
+    if(matcher->pair_first == NULL) return -1;
+
+    qsort(matcher->patterns, matcher->count, sizeof(struct match_pattern),
+          compare_bytes);
+
+    // Pair bitmap and index, one-byte patterns hit every pair they start
+    memset(matcher->pairs, 0, sizeof(matcher->pairs));
+    for(i = 0; i < 256; i++) matcher->single[i] = -1;
+    for(k = 0; k < matcher->count; k++){
+        pattern = &matcher->patterns[k];
+        if(pattern->len == 1){
+            b = pattern->bytes[0];
+            if(matcher->single[b] < 0 || pattern->id < matcher->single[b])
+                matcher->single[b] = pattern->id;
+            for(bytes[0] = b, pair = 0; pair < 256; pair++){
+                bytes[1] = (unsigned char) pair;
+                matcher->pairs[pair_bit(bytes) >> 3] |= 1 << (pair_bit(bytes) & 7);
+            }
+            continue;
+        }
+        pair = pair_bit(pattern->bytes);
+        matcher->pairs[pair >> 3] |= 1 << (pair & 7);
+    }
+    for(pair = 0, k = 0; pair <= 65536; pair++){
+        while(k < matcher->count && pattern_pair(&matcher->patterns[k]) < pair)
+            k++;
+        matcher->pair_first[pair] = k;
+    }
+
+    // Prefilter - contiguous, evenly sized buckets
+    for(b = 0; b <= MATCH_BUCKETS; b++)
+        bucket[b] = (int) ((long) matcher->count * b / MATCH_BUCKETS);
+
+    // The fingerprint must fit into the shortest pattern
+    matcher->fingerprint = MATCH_FINGERPRINT;
+    for(k = 0; k < matcher->count; k++){
+        if(matcher->patterns[k].len < matcher->fingerprint)
+            matcher->fingerprint = matcher->patterns[k].len;
+    }
+
+    memset(matcher->lo, 0, sizeof(matcher->lo));
+    memset(matcher->hi, 0, sizeof(matcher->hi));
+    for(b = 0; b < MATCH_BUCKETS; b++){
+        for(k = bucket[b]; k < bucket[b + 1]; k++){
+            pattern = &matcher->patterns[k];
+            for(i = 0; i < matcher->fingerprint; i++){
+                matcher->lo[i][pattern->bytes[i] & 0x0f] |= 1 << b;
+                matcher->hi[i][pattern->bytes[i] >> 4] |= 1 << b;
+            }
+        }
+    }
+
+    // Remaining fingerprint bytes match anything
+    for(i = matcher->fingerprint; i < MATCH_FINGERPRINT; i++){
+        memset(matcher->lo[i], 0xff, sizeof(matcher->lo[i]));
+        memset(matcher->hi[i], 0xff, sizeof(matcher->hi[i]));
+    }
+
+    if(matcher->count > MATCH_TEDDY_MAX
+       || (matcher_engine(matcher, MATCH_AVX2) != 0
+           && matcher_engine(matcher, MATCH_SSSE3) != 0))
+        matcher_engine(matcher, MATCH_SCALAR);
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Use \a engine for searching.
+///
+/// \return Zero on success, -1 if the CPU does not support it.
+//////////////////////////////////////////////////////////////////////////////
+int matcher_engine(struct matcher *matcher, enum match_engine engine){
+    switch(engine){
+        case MATCH_SCALAR:
+            break;
+#if MATCH_X86
+        case MATCH_SSSE3:
+            __builtin_cpu_init();
+            if(!__builtin_cpu_supports("ssse3")) return -1;
+            break;
+        case MATCH_AVX2:
+            __builtin_cpu_init();
+            if(!__builtin_cpu_supports("avx2")) return -1;
+            break;
+#endif
+        default:
+            return -1;
+    }
+
+    matcher->engine = engine;
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Name of \a engine.
+//////////////////////////////////////////////////////////////////////////////
+const char *matcher_engine_name(enum match_engine engine){
+    return engine_names[engine];
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Verify a candidate position - one-byte patterns, then the patterns of
+/// the byte pair at \a pos.
+///
+/// \return Nonzero if a pattern matches, its ID is stored to \a id.
+//////////////////////////////////////////////////////////////////////////////
+static inline int verify(const struct matcher *matcher,
+                         const unsigned char *buffer, size_t len, size_t pos,
+                         int *id){
+    const struct match_pattern *pattern;
+    const struct match_pattern *end;
+    unsigned pair;
+
+    if(matcher->single[buffer[pos]] >= 0){
+        if(id != NULL) *id = matcher->single[buffer[pos]];
+        return 1;
+    }
+    if(pos + 1 >= len) return 0;
+
+    pair = pair_bit(buffer + pos);
+    if(!(matcher->pairs[pair >> 3] & (1 << (pair & 7)))) return 0;
+
+    pair = buffer[pos] << 8 | buffer[pos + 1];
+    pattern = &matcher->patterns[matcher->pair_first[pair]];
+    end = &matcher->patterns[matcher->pair_first[pair + 1]];
+    for(; pattern < end; pattern++){
+        if(pattern->len > 1 && pattern->len <= len - pos
+           && memcmp(buffer + pos + 2, pattern->bytes + 2, pattern->len - 2) == 0){
+            if(id != NULL) *id = pattern->id;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Pair bitmap search from \a pos (whole buffers of large sets and without
+/// SIMD, the tail of the buffer after the prefilter).
+//////////////////////////////////////////////////////////////////////////////
+static long find_scalar(const struct matcher *matcher,
+                        const unsigned char *buffer, size_t len, size_t pos,
+                        int *id){
+    unsigned pair;
+
+    for(; pos + 1 < len; pos++){
+        pair = pair_bit(buffer + pos);
+        if((matcher->pairs[pair >> 3] & (1 << (pair & 7)))
+           && verify(matcher, buffer, len, pos, id))
+            return (long) pos;
+    }
+
+    // The last byte can only start a one-byte pattern
+    if(pos < len && verify(matcher, buffer, len, pos, id))
+        return (long) pos;
+
+    return -1;
+}
+
+#if MATCH_X86
+//////////////////////////////////////////////////////////////////////////////
+/// Buckets hit by the 16 positions of \a v (tables of one fingerprint byte).
+//////////////////////////////////////////////////////////////////////////////
+__attribute__((target("ssse3")))
+static inline __m128i hits_ssse3(__m128i v, __m128i lo, __m128i hi){
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+
+    return _mm_and_si128(
+        _mm_shuffle_epi8(lo, _mm_and_si128(v, nibble)),
+        _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), nibble)));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// SSSE3 prefilter - 16 positions per step, fingerprint byte i of the
+/// positions comes from the load at offset i; positions hitting a bucket
+/// are verified.
+//////////////////////////////////////////////////////////////////////////////
+__attribute__((target("ssse3")))
+static long find_ssse3(const struct matcher *matcher,
+                       const unsigned char *buffer, size_t len, int *id){
+    const __m128i lo0 = _mm_load_si128((const __m128i *) matcher->lo[0]);
+    const __m128i hi0 = _mm_load_si128((const __m128i *) matcher->hi[0]);
+    const __m128i lo1 = _mm_load_si128((const __m128i *) matcher->lo[1]);
+    const __m128i hi1 = _mm_load_si128((const __m128i *) matcher->hi[1]);
+    const __m128i lo2 = _mm_load_si128((const __m128i *) matcher->lo[2]);
+    const __m128i hi2 = _mm_load_si128((const __m128i *) matcher->hi[2]);
+    size_t fingerprint = matcher->fingerprint;
+    unsigned hits;
+    unsigned j;
+    size_t pos;
+    __m128i r;
+
+    for(pos = 0; pos + 16 + fingerprint - 1 <= len; pos += 16){
+        r = hits_ssse3(_mm_loadu_si128((const __m128i *) (buffer + pos)),
+                       lo0, hi0);
+        if(fingerprint > 1)
+            r = _mm_and_si128(r, hits_ssse3(
+                _mm_loadu_si128((const __m128i *) (buffer + pos + 1)), lo1, hi1));
+        if(fingerprint > 2)
+            r = _mm_and_si128(r, hits_ssse3(
+                _mm_loadu_si128((const __m128i *) (buffer + pos + 2)), lo2, hi2));
+
+        hits = ~_mm_movemask_epi8(_mm_cmpeq_epi8(r, _mm_setzero_si128()))
+               & 0xffff;
+        if(hits == 0) continue;
+
+        for(; hits != 0; hits &= hits - 1){
+            j = __builtin_ctz(hits);
+            if(verify(matcher, buffer, len, pos + j, id))
+                return (long) (pos + j);
+        }
+    }
+
+    return find_scalar(matcher, buffer, len, pos, id);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Buckets hit by the 32 positions of \a v (tables of one fingerprint byte).
+//////////////////////////////////////////////////////////////////////////////
+__attribute__((target("avx2")))
+static inline __m256i hits_avx2(__m256i v, __m256i lo, __m256i hi){
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+    return _mm256_and_si256(
+        _mm256_shuffle_epi8(lo, _mm256_and_si256(v, nibble)),
+        _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4),
+                                                 nibble)));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// AVX2 prefilter - 32 positions per step (vpshufb shuffles within 128-bit
+/// lanes, the tables are in both).
+//////////////////////////////////////////////////////////////////////////////
+__attribute__((target("avx2")))
+static long find_avx2(const struct matcher *matcher,
+                      const unsigned char *buffer, size_t len, int *id){
+    const __m256i lo0 = _mm256_broadcastsi128_si256(
+        _mm_load_si128((const __m128i *) matcher->lo[0]));
+    const __m256i hi0 = _mm256_broadcastsi128_si256(
+        _mm_load_si128((const __m128i *) matcher->hi[0]));
+    const __m256i lo1 = _mm256_broadcastsi128_si256(
+        _mm_load_si128((const __m128i *) matcher->lo[1]));
+    const __m256i hi1 = _mm256_broadcastsi128_si256(
+        _mm_load_si128((const __m128i *) matcher->hi[1]));
+    const __m256i lo2 = _mm256_broadcastsi128_si256(
+        _mm_load_si128((const __m128i *) matcher->lo[2]));
+    const __m256i hi2 = _mm256_broadcastsi128_si256(
+        _mm_load_si128((const __m128i *) matcher->hi[2]));
+    size_t fingerprint = matcher->fingerprint;
+    unsigned hits;
+    unsigned j;
+    size_t pos;
+    __m256i r;
+
+    for(pos = 0; pos + 32 + fingerprint - 1 <= len; pos += 32){
+        r = hits_avx2(_mm256_loadu_si256((const __m256i *) (buffer + pos)),
+                      lo0, hi0);
+        if(fingerprint > 1)
+            r = _mm256_and_si256(r, hits_avx2(
+                _mm256_loadu_si256((const __m256i *) (buffer + pos + 1)), lo1, hi1));
+        if(fingerprint > 2)
+            r = _mm256_and_si256(r, hits_avx2(
+                _mm256_loadu_si256((const __m256i *) (buffer + pos + 2)), lo2, hi2));
+
+        hits = ~(unsigned) _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(r, _mm256_setzero_si256()));
+        if(hits == 0) continue;
+
+        for(; hits != 0; hits &= hits - 1){
+            j = __builtin_ctz(hits);
+            if(verify(matcher, buffer, len, pos + j, id))
+                return (long) (pos + j);
+        }
+    }
+
+    return find_scalar(matcher, buffer, len, pos, id);
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////////
+/// Find the first (lowest offset) occurrence of any pattern in \a buffer.
+///
+/// \param matcher Compiled pattern set.
+/// \param buffer Payload.
+/// \param len Length of the payload.
+/// \param id Where to store the ID of the matching pattern (may be NULL).
+/// \return Offset of the match, -1 if no pattern occurs in the payload.
+//////////////////////////////////////////////////////////////////////////////
+long matcher_find(const struct matcher *matcher, const void *buffer,
+                  size_t len, int *id){
+    if(matcher->count == 0 || buffer == NULL) return -1;
+
+    switch(matcher->engine){
+#if MATCH_X86
+        case MATCH_AVX2:
+            return find_avx2(matcher, (const unsigned char *) buffer, len, id);
+        case MATCH_SSSE3:
+            return find_ssse3(matcher, (const unsigned char *) buffer, len, id);
+#endif
+        default:
+            return find_scalar(matcher, (const unsigned char *) buffer, len, 0,
+                               id);
+    }
+}
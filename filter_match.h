@@ -0,0 +1,164 @@
+/*
+ Filter processor module.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Multi-pattern payload matcher of the filter processor.
+///
+/// Every payload position is checked against a bitmap of the first two
+/// bytes of the patterns (one-byte patterns set all the pairs they start);
+/// only the patterns sharing the pair are compared at a hit. Small sets
+/// use a vectorized prefilter instead: the patterns are split into 8
+/// buckets and a fingerprint of their first (up to 3) bytes is kept as
+/// nibble -> bucket bitmask tables, applied to 16 (SSSE3) or 32 (AVX2)
+/// positions at once with byte shuffles ("Teddy"). With more patterns
+/// the buckets fill up and nearly every position hits, so the bitmap
+/// scan is used then.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef PROCESSOR_FILTER_MATCH_H
+#define PROCESSOR_FILTER_MATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////////////////////////
+/// Number of buckets (bits of the fingerprint masks).
+//////////////////////////////////////////////////////////////////////////////
+#define MATCH_BUCKETS 8
+
+//////////////////////////////////////////////////////////////////////////////
+/// Longest fingerprint (bytes of the pattern prefix).
+//////////////////////////////////////////////////////////////////////////////
+#define MATCH_FINGERPRINT 3
+
+//////////////////////////////////////////////////////////////////////////////
+/// Longest pattern.
+//////////////////////////////////////////////////////////////////////////////
+#define MATCH_PATTERN_MAX 1024
+
+//////////////////////////////////////////////////////////////////////////////
+/// Largest set searched with the shuffle prefilter by default (the
+/// buckets stay selective).
+//////////////////////////////////////////////////////////////////////////////
+#define MATCH_TEDDY_MAX 96
+
+//////////////////////////////////////////////////////////////////////////////
+/// Search implementations (matcher_compile() chooses by the size of the
+/// set and the CPU, tests and benchmarks force the others).
+//////////////////////////////////////////////////////////////////////////////
+enum match_engine {
+    MATCH_SCALAR,   ///< Pair bitmap byte by byte.
+    MATCH_SSSE3,    ///< Prefilter of 16 positions per step (pshufb).
+    MATCH_AVX2      ///< Prefilter of 32 positions per step (vpshufb).
+};
+
+//////////////////////////////////////////////////////////////////////////////
+/// One pattern of the set.
+//////////////////////////////////////////////////////////////////////////////
+struct match_pattern {
+    unsigned char *bytes;       ///< Pattern bytes.
+    size_t len;                 ///< Number of bytes (> 0).
+    int id;                     ///< Index in the order of matcher_add().
+};
+
+//////////////////////////////////////////////////////////////////////////////
+/// Pattern set compiled for searching.
+//////////////////////////////////////////////////////////////////////////////
+struct matcher {
+    struct match_pattern *patterns; ///< Patterns, sorted by their bytes.
+    int count;                      ///< Number of patterns.
+    int size;                       ///< Allocated items of \a patterns.
+
+    //////////////////////////////////////////////////////////////////
+    /// Patterns (by ID) of one byte, -1 for bytes without one.
+    //////////////////////////////////////////////////////////////////
+    int single[256];
+
+    //////////////////////////////////////////////////////////////////
+    /// First pattern (index into \a patterns) of each byte pair (two
+    /// bytes, big endian), the patterns of pair k are before
+    /// pair_first[k + 1]; NULL until compiled.
+    //////////////////////////////////////////////////////////////////
+    int *pair_first;
+
+    //////////////////////////////////////////////////////////////////
+    /// Byte pairs starting a pattern (the bit of a pair is the pair
+    /// read as a native 16-bit word).
+    //////////////////////////////////////////////////////////////////
+    uint8_t pairs[65536 / 8];
+
+    size_t fingerprint;             ///< Bytes of the fingerprint (1-3).
+    enum match_engine engine;       ///< Search implementation.
+
+    //////////////////////////////////////////////////////////////////
+    /// Bitmasks of the buckets whose pattern byte \a i has the low
+    /// (high) nibble n - lo[i][n], hi[i][n].
+    //////////////////////////////////////////////////////////////////
+    uint8_t lo[MATCH_FINGERPRINT][16] __attribute__((aligned(16)));
+    uint8_t hi[MATCH_FINGERPRINT][16] __attribute__((aligned(16)));
+};
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see filter_match.c
+//////////////////////////////////////////////////////////////////////////////
+extern struct matcher *matcher_new(void);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see filter_match.c
+//////////////////////////////////////////////////////////////////////////////
+extern void matcher_free(struct matcher *matcher);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see filter_match.c
+//////////////////////////////////////////////////////////////////////////////
+extern int matcher_add(struct matcher *matcher, const void *pattern,
+                       size_t len);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see filter_match.c
+//////////////////////////////////////////////////////////////////////////////
+extern int matcher_parse(struct matcher *matcher, const char *text,
+                         char separator);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see filter_match.c
+//////////////////////////////////////////////////////////////////////////////
+extern int matcher_compile(struct matcher *matcher);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see filter_match.c
+//////////////////////////////////////////////////////////////////////////////
+extern int matcher_engine(struct matcher *matcher, enum match_engine engine);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see filter_match.c
+//////////////////////////////////////////////////////////////////////////////
+extern const char *matcher_engine_name(enum match_engine engine);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see filter_match.c
+//////////////////////////////////////////////////////////////////////////////
+extern long matcher_find(const struct matcher *matcher, const void *buffer,
+                         size_t len, int *id);
+
+#endif
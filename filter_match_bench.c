@@ -0,0 +1,133 @@
+/*
+ Filter processor module.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Microbenchmark of the multi-pattern matcher - Gbit/s of payload scanned
+/// by one core with each engine, N random patterns (200 by default, 4-16
+/// bytes) against random packets of SIZE bytes (1316 by default) with no
+/// match, so every packet is scanned to its end. The engine chosen by
+/// matcher_compile() for the set is marked with '*'.
+///
+/// Usage: filter_match_bench [PATTERNS] [SIZE]
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "filter_match.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Defaults - number of patterns, packet size.
+//////////////////////////////////////////////////////////////////////////////
+#define BENCH_PATTERNS 200
+#define BENCH_SIZE 1316
+
+//////////////////////////////////////////////////////////////////////////////
+/// Packets cycled through (4 MB of 1316 B packets, beyond L2).
+//////////////////////////////////////////////////////////////////////////////
+#define BENCH_PACKETS 3200
+
+//////////////////////////////////////////////////////////////////////////////
+/// Seconds measured per engine.
+//////////////////////////////////////////////////////////////////////////////
+#define BENCH_SECONDS 1.0
+
+//////////////////////////////////////////////////////////////////////////////
+/// Seconds elapsed since \a start.
+//////////////////////////////////////////////////////////////////////////////
+static double elapsed(const struct timespec *start){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv){
+    struct matcher *matcher;                // pattern set under test
+    enum match_engine engine;
+    enum match_engine chosen;               // engine of matcher_compile()
+    struct timespec start;
+    unsigned char pattern[16];
+    unsigned char *packets;
+    unsigned long count = BENCH_PATTERNS;
+    unsigned long size = BENCH_SIZE;
+    unsigned long scanned;
+    unsigned long matches;
+    unsigned long i;
+    unsigned long k;
+    size_t len;
+    double seconds;
+
+    if((argc > 1 && (count = strtoul(argv[1], NULL, 10)) == 0)
+       || (argc > 2 && (size = strtoul(argv[2], NULL, 10)) == 0)){
+        fprintf(stderr, "Usage: %s [PATTERNS] [SIZE]\n", argv[0]);
+        return 1;
+    }
+
+    srand(1);
+    if((matcher = matcher_new()) == NULL
+       || (packets = malloc(BENCH_PACKETS * size)) == NULL){
+        perror("malloc");
+        return 1;
+    }
+
+    for(k = 0; k < count; k++){
+        len = 4 + rand() % 13;
+        for(i = 0; i < len; i++) pattern[i] = (unsigned char) rand();
+        matcher_add(matcher, pattern, len);
+    }
+    matcher_compile(matcher);
+    chosen = matcher->engine;
+
+    for(i = 0; i < BENCH_PACKETS * size; i++)
+        packets[i] = (unsigned char) rand();
+
+    printf("%lu patterns, %lu B packets, fingerprint %zu B\n", count, size,
+           matcher->fingerprint);
+
+    for(engine = MATCH_SCALAR; engine <= MATCH_AVX2; engine++){
+        if(matcher_engine(matcher, engine) != 0) continue;
+
+        scanned = matches = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        do{
+            for(i = 0; i < BENCH_PACKETS; i++){
+                if(matcher_find(matcher, packets + i * size, size, NULL) >= 0)
+                    matches++;
+            }
+            scanned += BENCH_PACKETS;
+        }while((seconds = elapsed(&start)) < BENCH_SECONDS);
+
+        printf("%-6s %8.2f Gbit/s %10.0f packets/s (%lu of %lu matched)%s\n",
+               matcher_engine_name(engine), scanned * size * 8 / seconds / 1e9,
+               scanned / seconds, matches, scanned,
+               engine == chosen ? " *" : "");
+    }
+
+    matcher_free(matcher);
+    free(packets);
+
+    return 0;
+}
@@ -0,0 +1,295 @@
+/*
+ Filter processor module.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Correctness tests of the multi-pattern matcher - pattern list parsing,
+/// every pattern length at every offset, and random pattern sets against a
+/// naive search, for all the engines the CPU supports.
+///
+/// Usage: filter_match_test [SEED]
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter_match.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Random pattern sets (and buffers per set) checked against naive search.
+//////////////////////////////////////////////////////////////////////////////
+#define TEST_SETS 200
+#define TEST_BUFFERS 50
+
+static unsigned long checks = 0;
+static unsigned long failures = 0;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Count a check, report it if it failed.
+//////////////////////////////////////////////////////////////////////////////
+#define CHECK(cond, ...)                                                \
+    do {                                                                \
+        checks++;                                                       \
+        if(!(cond)){                                                    \
+            failures++;                                                 \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);                 \
+            printf(__VA_ARGS__);                                        \
+            printf("\n");                                               \
+        }                                                               \
+    } while(0)
+
+//////////////////////////////////////////////////////////////////////////////
+/// Lowest offset of any pattern of \a matcher in \a buffer (reference).
+//////////////////////////////////////////////////////////////////////////////
+static long naive_find(const struct matcher *matcher,
+                       const unsigned char *buffer, size_t len){
+    size_t pos;
+    int k;
+
+    for(pos = 0; pos < len; pos++){
+        for(k = 0; k < matcher->count; k++){
+            if(matcher->patterns[k].len <= len - pos
+               && memcmp(buffer + pos, matcher->patterns[k].bytes,
+                         matcher->patterns[k].len) == 0)
+                return (long) pos;
+        }
+    }
+    return -1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Pattern of \a matcher with \a id.
+//////////////////////////////////////////////////////////////////////////////
+static const struct match_pattern *pattern_by_id(const struct matcher *matcher,
+                                                 int id){
+    int k;
+
+    for(k = 0; k < matcher->count; k++){
+        if(matcher->patterns[k].id == id) return &matcher->patterns[k];
+    }
+    return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Search \a buffer with every engine, compare with the naive search; the
+/// buffer is copied to an exactly sized block (reads past the end show up
+/// under valgrind/ASan).
+//////////////////////////////////////////////////////////////////////////////
+static void check_all(struct matcher *matcher, const unsigned char *buffer,
+                      size_t len, const char *what){
+    const struct match_pattern *pattern;
+    enum match_engine engine;
+    enum match_engine best = matcher->engine;
+    unsigned char *copy = malloc(len > 0 ? len : 1);
+    long expected;
+    long found;
+    int id;
+
+    memcpy(copy, buffer, len);
+    expected = naive_find(matcher, copy, len);
+
+    for(engine = MATCH_SCALAR; engine <= MATCH_AVX2; engine++){
+        if(matcher_engine(matcher, engine) != 0) continue;
+
+        id = -1;
+        found = matcher_find(matcher, copy, len, &id);
+        CHECK(found == expected, "%s, %s: found %ld, expected %ld", what,
+              matcher_engine_name(engine), found, expected);
+        if(found >= 0){
+            pattern = pattern_by_id(matcher, id);
+            CHECK(pattern != NULL && pattern->len <= len - found
+                  && memcmp(copy + found, pattern->bytes, pattern->len) == 0,
+                  "%s, %s: pattern %d does not match at %ld", what,
+                  matcher_engine_name(engine), id, found);
+        }
+    }
+
+    matcher_engine(matcher, best);
+    free(copy);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Parsing of the Filter parameter and pattern files.
+//////////////////////////////////////////////////////////////////////////////
+static void test_parse(void){
+    struct matcher *matcher;
+
+    matcher = matcher_new();
+    CHECK(matcher_parse(matcher, "ping", ',') == 1, "single pattern");
+    CHECK(matcher->patterns[0].len == 4
+          && memcmp(matcher->patterns[0].bytes, "ping", 4) == 0, "ping");
+    matcher_free(matcher);
+
+    matcher = matcher_new();
+    CHECK(matcher_parse(matcher, "a\\,b,,c\\\\,\\x00\\xfF\\n", ',') == 3,
+          "escapes");
+    CHECK(matcher->count == 3 && matcher->patterns[0].len == 3
+          && memcmp(matcher->patterns[0].bytes, "a,b", 3) == 0, "escaped comma");
+    CHECK(matcher->count == 3 && matcher->patterns[1].len == 2
+          && memcmp(matcher->patterns[1].bytes, "c\\", 2) == 0,
+          "escaped backslash");
+    CHECK(matcher->count == 3 && matcher->patterns[2].len == 3
+          && memcmp(matcher->patterns[2].bytes, "\0\xff\n", 3) == 0,
+          "hex escapes");
+    matcher_free(matcher);
+
+    matcher = matcher_new();
+    CHECK(matcher_parse(matcher, "ab\\q", ',') == -1, "unknown escape");
+    CHECK(matcher_parse(matcher, "\\x4", ',') == -1, "short hex escape");
+    CHECK(matcher_parse(matcher, ",,", ',') == 0, "empty list");
+    CHECK(matcher_compile(matcher) == -1, "empty set does not compile");
+    matcher_free(matcher);
+
+    matcher = matcher_new();
+    CHECK(matcher_parse(matcher, "# comment\r\none,two\r\n\r\n\\x23three\n",
+                        '\n') == 2, "pattern file");
+    CHECK(matcher->count == 2 && matcher->patterns[0].len == 7
+          && memcmp(matcher->patterns[0].bytes, "one,two", 7) == 0,
+          "file line with CRLF");
+    CHECK(matcher->count == 2 && matcher->patterns[1].len == 6
+          && memcmp(matcher->patterns[1].bytes, "#three", 6) == 0,
+          "escaped comment character");
+    matcher_free(matcher);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// One pattern of every length 1-40 at every offset of buffers of every
+/// length up to 100 (block boundaries, tails, fingerprint lengths).
+//////////////////////////////////////////////////////////////////////////////
+static void test_offsets(void){
+    unsigned char buffer[100];
+    unsigned char pattern[40];
+    struct matcher *matcher;
+    char what[64];
+    size_t plen;
+    size_t len;
+    size_t pos;
+
+    for(plen = 1; plen <= sizeof(pattern); plen++){
+        for(pos = 0; pos < plen; pos++) pattern[pos] = (unsigned char) ('A' + pos);
+
+        matcher = matcher_new();
+        matcher_add(matcher, pattern, plen);
+        CHECK(matcher_compile(matcher) == 0, "compile length %zu", plen);
+
+        for(len = 0; len <= sizeof(buffer); len++){
+            memset(buffer, 'a', len);
+            snprintf(what, sizeof(what), "length %zu, empty %zu", plen, len);
+            check_all(matcher, buffer, len, what);
+
+            for(pos = 0; pos + plen <= len; pos++){
+                memset(buffer, 'a', len);
+                memcpy(buffer + pos, pattern, plen);
+                snprintf(what, sizeof(what), "length %zu at %zu of %zu",
+                         plen, pos, len);
+                check_all(matcher, buffer, len, what);
+            }
+
+            // Cut off at the end of the buffer
+            if(len > 0 && plen > 1 && len >= plen - 1){
+                memset(buffer, 'a', len);
+                memcpy(buffer + len - (plen - 1), pattern, plen - 1);
+                snprintf(what, sizeof(what), "length %zu cut at %zu",
+                         plen, len);
+                check_all(matcher, buffer, len, what);
+            }
+        }
+        matcher_free(matcher);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Random sets of up to 500 patterns (lengths 1-16) over small and full
+/// alphabets against random buffers with planted patterns.
+//////////////////////////////////////////////////////////////////////////////
+static void test_random(void){
+    unsigned char buffer[3000];
+    unsigned char pattern[16];
+    struct matcher *matcher;
+    const struct match_pattern *planted;
+    char what[64];
+    unsigned alphabet;
+    size_t minlen;
+    size_t len;
+    size_t i;
+    int count;
+    int set;
+    int n;
+    int k;
+
+    for(set = 0; set < TEST_SETS; set++){
+        alphabet = set % 3 == 0 ? 4 : set % 3 == 1 ? 26 : 256;
+        minlen = set % 4 == 0 ? 1 : 3;
+        count = 1 + rand() % (set % 2 == 0 ? 10 : 500);
+
+        matcher = matcher_new();
+        for(k = 0; k < count; k++){
+            len = minlen + rand() % (sizeof(pattern) - minlen + 1);
+            for(i = 0; i < len; i++)
+                pattern[i] = (unsigned char) ('a' * (alphabet < 256) + rand() % alphabet);
+            matcher_add(matcher, pattern, len);
+        }
+        CHECK(matcher_compile(matcher) == 0, "compile set %d", set);
+
+        for(n = 0; n < TEST_BUFFERS; n++){
+            len = rand() % sizeof(buffer);
+            for(i = 0; i < len; i++)
+                buffer[i] = (unsigned char) ('a' * (alphabet < 256) + rand() % alphabet);
+
+            // Plant a pattern in half of the buffers
+            planted = &matcher->patterns[rand() % matcher->count];
+            if(n % 2 == 0 && planted->len <= len)
+                memcpy(buffer + rand() % (len - planted->len + 1),
+                       planted->bytes, planted->len);
+
+            snprintf(what, sizeof(what), "set %d (%d patterns), buffer %d",
+                     set, count, n);
+            check_all(matcher, buffer, len, what);
+        }
+        matcher_free(matcher);
+    }
+}
+
+int main(int argc, char **argv){
+    struct matcher *probe = matcher_new();
+    enum match_engine engine;
+    unsigned seed = argc > 1 ? (unsigned) strtoul(argv[1], NULL, 10) : 1;
+
+    srand(seed);
+
+    printf("engines:");
+    for(engine = MATCH_SCALAR; engine <= MATCH_AVX2; engine++){
+        if(matcher_engine(probe, engine) == 0)
+            printf(" %s", matcher_engine_name(engine));
+    }
+    printf(" (seed %u)\n", seed);
+    matcher_free(probe);
+
+    test_parse();
+    test_offsets();
+    test_random();
+
+    printf("%lu checks, %lu failures\n", checks, failures);
+
+    return failures != 0;
+}
@@ -0,0 +1,296 @@
+/*
+ Ring data queue.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Ring data queue (QT_RING) - a bounded queue of power-of-two slots with
+/// lock-free push from one or more producers and a single consumer, an
+/// alternative to the linked list of QT_DATA with its two mutexes and the
+/// length semaphore.
+///
+/// Every slot carries a sequence number: a producer owns position p once it
+/// has advanced the tail past p and finds seq == p in slot p & mask, stores
+/// the item and publishes it with seq = p + 1; the consumer takes the item
+/// when it finds seq == head + 1 and hands the slot over to the next round
+/// with seq = head + size. With one producer the tail is a plain store,
+/// with more of them it is claimed by compare-and-swap. A full ring drops
+/// the new item (as QT_DATA drops when over its length).
+///
+/// Waiting uses an eventfd: the consumer parks (sets \a parked and checks
+/// the ring again), producers look at \a parked after every push and only
+/// the first one finding it set writes to the eventfd, so a busy consumer
+/// costs the producers no system call.
+///
+/// The reflector core does not know this queue type (see queue_ring.h),
+/// only the in-process host dispatches to these functions.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <rum2/utils.h>
+#include <rum2/error.h>
+#include <rum2/queue.h>
+
+#include "queue_ring.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// The ring of a QT_RING queue.
+//////////////////////////////////////////////////////////////////////////////
+#define ring_of(queue) ((struct queue_ring *) (queue))
+
+//////////////////////////////////////////////////////////////////////////////
+/// Create a new ring data queue.
+///
+/// \param queue Where to store the pointer to the queue (NULL on error).
+/// \param size Number of slots, a power of two (at least 2).
+/// \param multi Nonzero if more than one thread will push to the queue.
+/// \param callback Called for each item dropped or flushed from the queue.
+/// \return Zero on success, nonzero otherwise.
+//////////////////////////////////////////////////////////////////////////////
+int queue_ring_new(EC, struct queue **queue, unsigned long size, int multi,
+                   queue_flush_cb callback){
+    struct queue_ring *ring;
+    unsigned long i;
+
+    *queue = NULL;
+
+    if(size < 2 || (size & (size - 1)) != 0){
+        rum_error(errctx, RUM_EQUEUE_INIT);
+        return -1;
+    }
+
+    if(posix_memalign((void **) &ring, QUEUE_CACHE_LINE, sizeof(*ring)) != 0){
+        rum_error(errctx, RUM_ENO_MEMORY);
+        return -1;
+    }
+    memset(ring, 0, sizeof(*ring));
+
+    if(posix_memalign((void **) &ring->slots, QUEUE_CACHE_LINE,
+                      size * sizeof(*ring->slots)) != 0){
+        free(ring);
+        rum_error(errctx, RUM_ENO_MEMORY);
+        return -1;
+    }
+
+    if((ring->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0){
+        free(ring->slots);
+        free(ring);
+        rum_error(errctx, RUM_EQUEUE_INIT);
+        return -1;
+    }
+
+    for(i = 0; i < size; i++){
+        ring->slots[i].seq = i;
+        ring->slots[i].data = NULL;
+    }
+    ring->mask = size - 1;
+    ring->multi = multi;
+    ring->common.type = QT_RING;
+    ring->common.flush_cb = callback;
+
+    *queue = &ring->common;
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Flush a ring queue and free it. Queue groups the queue belongs to are
+/// left to the caller.
+///
+/// \param queue Where the pointer to the queue is stored, set to NULL.
+//////////////////////////////////////////////////////////////////////////////
+void queue_ring_free(struct queue **queue){
+    struct queue_ring *ring;
+    void *item;
+
+    if(*queue == NULL) return;
+    ring = ring_of(*queue);
+
+    while(queue_pop_ring(&ring->common, &item) == 0){
+        if(ring->common.flush_cb != NULL) ring->common.flush_cb(item);
+    }
+
+    close(ring->wake);
+    free(ring->slots);
+    free(ring);
+    *queue = NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Append a new item to a ring queue; the item is dropped (and flushed)
+/// when the ring is full.
+///
+/// \param queue The ring.
+/// \param item Item to be appended.
+/// \return Zero (a dropped item is consumed as well).
+//////////////////////////////////////////////////////////////////////////////
+int queue_push_ring(EC, struct queue *queue, void *item){
+    struct queue_ring *ring = ring_of(queue);
+    struct queue_slot *slot;
+    unsigned long pos;
+    uint64_t one = 1;
+    long diff;
+
+    UNUSED(errctx);
+
+    pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    for(;;){
+        slot = &ring->slots[pos & ring->mask];
+        diff = (long) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+
+        if(diff == 0){
+            // Free slot - claim its position
+            if(!ring->multi){
+                __atomic_store_n(&ring->tail, pos + 1, __ATOMIC_RELAXED);
+                break;
+            }
+            if(__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, 1,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if(diff < 0){
+            // Not taken from the previous round yet - full
+            __atomic_fetch_add(&queue->total, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&queue->dropped, 1, __ATOMIC_RELAXED);
+            if(queue->flush_cb != NULL) queue->flush_cb(item);
+            return 0;
+        }
+        else
+            pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    }
+
+    slot->data = item;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    if(ring->multi)
+        __atomic_fetch_add(&queue->total, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_store_n(&queue->total, queue->total + 1, __ATOMIC_RELAXED);
+
+    // Pairs with the fence in queue_ring_park() - either the consumer sees
+    // the item or we see it parked
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&ring->parked, __ATOMIC_RELAXED)
+       && __atomic_exchange_n(&ring->parked, 0, __ATOMIC_ACQ_REL)){
+        if(write(ring->wake, &one, sizeof(one)) < 0){
+            // The eventfd counter is nonzero already, the consumer wakes
+        }
+    }
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Remove the oldest item from a ring queue.
+///
+/// \param queue The ring.
+/// \param item Where to store the removed item.
+/// \return Zero on success, nonzero on empty queue.
+//////////////////////////////////////////////////////////////////////////////
+int queue_pop_ring(struct queue *queue, void **item){
+    return queue_pop_ring_batch(queue, item, 1) == 1 ? 0 : -1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Remove up to \a max oldest items from a ring queue at once.
+///
+/// \param queue The ring.
+/// \param items Where to store the removed items, the oldest first.
+/// \param max Maximum number of items.
+/// \return Number of items removed, zero on empty queue.
+//////////////////////////////////////////////////////////////////////////////
+int queue_pop_ring_batch(struct queue *queue, void **items, int max){
+    struct queue_ring *ring = ring_of(queue);
+    struct queue_slot *slot;
+    unsigned long head = ring->head;
+    int count;
+
+    for(count = 0; count < max; count++, head++){
+        slot = &ring->slots[head & ring->mask];
+        if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != head + 1) break;
+
+        items[count] = slot->data;
+        __atomic_store_n(&slot->seq, head + ring->mask + 1, __ATOMIC_RELEASE);
+    }
+
+    // Atomic only for occupancy estimates (tail - head) by other threads
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELAXED);
+    return count;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Park the consumer of a ring queue before waiting for its eventfd.
+/// Producers that push after this call write to the eventfd. When the queue
+/// is not empty (an item may have been pushed before the consumer parked)
+/// the consumer is not parked.
+///
+/// \param queue The ring.
+/// \return Zero when parked, nonzero if the queue is not empty.
+//////////////////////////////////////////////////////////////////////////////
+int queue_ring_park(struct queue *queue){
+    struct queue_ring *ring = ring_of(queue);
+    struct queue_slot *slot = &ring->slots[ring->head & ring->mask];
+
+    __atomic_store_n(&ring->parked, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == ring->head + 1){
+        __atomic_store_n(&ring->parked, 0, __ATOMIC_RELAXED);
+        return -1;
+    }
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Unpark the consumer of a ring queue after waiting, clears the eventfd.
+///
+/// \param queue The ring.
+//////////////////////////////////////////////////////////////////////////////
+void queue_ring_unpark(struct queue *queue){
+    struct queue_ring *ring = ring_of(queue);
+    uint64_t count;
+
+    __atomic_store_n(&ring->parked, 0, __ATOMIC_RELAXED);
+    if(read(ring->wake, &count, sizeof(count)) < 0){
+        // Not signalled (woken by something else)
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Wake the consumer of a ring queue regardless of items (e.g. to stop it).
+///
+/// \param queue The ring.
+//////////////////////////////////////////////////////////////////////////////
+void queue_ring_wake(struct queue *queue){
+    uint64_t one = 1;
+
+    if(write(ring_of(queue)->wake, &one, sizeof(one)) < 0){
+        // The eventfd counter is nonzero already
+    }
+}
@@ -0,0 +1,140 @@
+/*
+ Ring data queue.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Ring data queue (QT_RING) - a power-of-two array of slots with lock-free
+/// push from one (SPSC) or more (MPSC) threads and a single consumer.
+///
+/// This is not a queue type of the reflector core: the core's queue
+/// functions (queue_push_data(), queue_pop_data(), queue_group_wait(), ...)
+/// know nothing of it. Only the in-process host (rtsp_host.c) dispatches its
+/// data queues and queue groups to the functions below, so a ring must not
+/// be handed to a real reflector until the core adopts it.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef QUEUE_RING_H
+#define QUEUE_RING_H
+
+#include <rum2/error.h>
+#include <rum2/queue.h>
+
+//////////////////////////////////////////////////////////////////////////////
+/// Type of a ring queue in queue::type, next after the core's types.
+//////////////////////////////////////////////////////////////////////////////
+#define QT_RING ((enum queue_type) (QT_MESSAGE + 1))
+
+//////////////////////////////////////////////////////////////////////////////
+/// Size of a cache line; the parts of a ring written by different threads
+/// are kept this far apart.
+//////////////////////////////////////////////////////////////////////////////
+#define QUEUE_CACHE_LINE 64
+
+//////////////////////////////////////////////////////////////////////////////
+/// Slot of a ring queue.
+//////////////////////////////////////////////////////////////////////////////
+struct queue_slot {
+    //////////////////////////////////////////////////////////////////
+    /// Sequence number - the position of the next push into the slot
+    /// while it is free, the position plus one once the item is stored.
+    //////////////////////////////////////////////////////////////////
+    unsigned long seq;
+    void *data;                 ///< Pointer to the user supplied data.
+};
+
+//////////////////////////////////////////////////////////////////////////////
+/// Ring data queue. Producers claim positions by advancing \a tail (with
+/// compare-and-swap when more of them push), store the item and publish it
+/// through the sequence number of the slot; the consumer takes items in
+/// order from \a head. Neither side takes a lock or touches the semaphore
+/// of the common part.
+///
+/// A consumer that runs out of items parks on the queue (queue_ring_park())
+/// and waits until the eventfd \a wake is readable; producers write to it
+/// only when they find the consumer parked.
+//////////////////////////////////////////////////////////////////////////////
+struct queue_ring {
+    struct queue common;        ///< Common fields of queue structure.
+
+    //////////////////////////////////////////////////////////////////
+    /// Number of slots minus one (the number of slots is a power of
+    /// two).
+    //////////////////////////////////////////////////////////////////
+    unsigned long mask __attribute__((aligned(QUEUE_CACHE_LINE)));
+    int multi;                  ///< Nonzero when more threads push.
+    int wake;                   ///< Eventfd of a parked consumer.
+    struct queue_slot *slots;   ///< Array of mask + 1 slots.
+    int parked;                 ///< Nonzero while the consumer is parked.
+
+    //////////////////////////////////////////////////////////////////
+    /// Position of the next push (written by producers).
+    //////////////////////////////////////////////////////////////////
+    unsigned long tail __attribute__((aligned(QUEUE_CACHE_LINE)));
+
+    //////////////////////////////////////////////////////////////////
+    /// Position of the next pop (written by the consumer).
+    //////////////////////////////////////////////////////////////////
+    unsigned long head __attribute__((aligned(QUEUE_CACHE_LINE)));
+};
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see queue_ring.c
+//////////////////////////////////////////////////////////////////////////////
+extern int queue_ring_new(EC, struct queue **queue, unsigned long size,
+                          int multi, queue_flush_cb callback);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see queue_ring.c
+//////////////////////////////////////////////////////////////////////////////
+extern void queue_ring_free(struct queue **queue);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see queue_ring.c
+//////////////////////////////////////////////////////////////////////////////
+extern int queue_push_ring(EC, struct queue *queue, void *item);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see queue_ring.c
+//////////////////////////////////////////////////////////////////////////////
+extern int queue_pop_ring(struct queue *queue, void **item);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see queue_ring.c
+//////////////////////////////////////////////////////////////////////////////
+extern int queue_pop_ring_batch(struct queue *queue, void **items, int max);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see queue_ring.c
+//////////////////////////////////////////////////////////////////////////////
+extern int queue_ring_park(struct queue *queue);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see queue_ring.c
+//////////////////////////////////////////////////////////////////////////////
+extern void queue_ring_unpark(struct queue *queue);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see queue_ring.c
+//////////////////////////////////////////////////////////////////////////////
+extern void queue_ring_wake(struct queue *queue);
+
+#endif
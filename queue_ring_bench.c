@@ -0,0 +1,250 @@
+/*
+ Ring data queue.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Microbenchmark of a queue hop - items per second through a QT_DATA
+/// style queue (circle of queue_item, push and pop mutex, length semaphore)
+/// and through the ring (SPSC for one producer, MPSC otherwise; the consumer
+/// pops one item at a time or bursts of 32). The first case pushes and pops
+/// in one thread (the cost of the operations themselves), the others run
+/// 1, 2 and 4 producer threads against the consumer (cache line transfers
+/// and contention, meaningful with a core per thread). Producers wait while
+/// the queue is full, so nothing is dropped and the consumer never parks.
+///
+/// Usage: queue_ring_bench [SIZE]
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <rum2/utils.h>
+#include <rum2/error.h>
+#include <rum2/queue.h>
+
+#include "queue_ring.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Default number of slots (items of the list queue).
+//////////////////////////////////////////////////////////////////////////////
+#define BENCH_SIZE 1024
+
+//////////////////////////////////////////////////////////////////////////////
+/// Seconds measured per case, largest number of producers.
+//////////////////////////////////////////////////////////////////////////////
+#define BENCH_SECONDS 1.0
+#define BENCH_PRODUCERS 4
+
+//////////////////////////////////////////////////////////////////////////////
+/// Queue implementations measured.
+//////////////////////////////////////////////////////////////////////////////
+enum bench_kind {
+    BENCH_LIST,         ///< QT_DATA style list, one item per pop.
+    BENCH_RING,         ///< Ring, one item per pop.
+    BENCH_RING_BURST    ///< Ring, bursts of 32.
+};
+
+//////////////////////////////////////////////////////////////////////////////
+/// One measured case.
+//////////////////////////////////////////////////////////////////////////////
+struct bench {
+    enum bench_kind kind;           ///< Implementation.
+    struct queue *queue;            ///< The queue.
+    volatile int stop;              ///< Producers end.
+};
+
+//////////////////////////////////////////////////////////////////////////////
+/// Error contexts of the core are not linked in.
+//////////////////////////////////////////////////////////////////////////////
+void rum_error(struct rum_error_ctx *errctx, enum rum_error err){
+    UNUSED(errctx);
+    UNUSED(err);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Seconds elapsed since \a start.
+//////////////////////////////////////////////////////////////////////////////
+static double elapsed(const struct timespec *start){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Data queue the way QT_DATA is built - \a size items linked to a circle,
+/// head and tail guarded by their own mutexes, the semaphore holds the
+/// length.
+//////////////////////////////////////////////////////////////////////////////
+static struct queue *list_new(int size){
+    struct queue_data *queue = calloc(1, sizeof(*queue));
+    int i;
+
+    queue->items = calloc(size, sizeof(*queue->items));
+    for(i = 0; i < size; i++)
+        queue->items[i].next = &queue->items[(i + 1) % size];
+    queue->max = size;
+    queue->common.type = QT_DATA;
+    queue->common.head = queue->common.tail = queue->items;
+    sem_init(&queue->common.length, 0, 0);
+    pthread_mutex_init(&queue->common.push_mutex, NULL);
+    pthread_mutex_init(&queue->common.pop_mutex, NULL);
+    return &queue->common;
+}
+
+static void list_free(struct queue *queue){
+    sem_destroy(&queue->length);
+    free(((struct queue_data *) queue)->items);
+    free(queue);
+}
+
+static int list_full(struct queue *queue){
+    int length;
+
+    sem_getvalue(&queue->length, &length);
+    return length >= ((struct queue_data *) queue)->max - 1;
+}
+
+static void list_push(struct queue *queue, void *item){
+    pthread_mutex_lock(&queue->push_mutex);
+    queue->tail->data = item;
+    queue->tail = queue->tail->next;
+    queue->total++;
+    pthread_mutex_unlock(&queue->push_mutex);
+    sem_post(&queue->length);
+}
+
+static int list_pop(struct queue *queue, void **item){
+    if(sem_trywait(&queue->length) != 0) return -1;
+    pthread_mutex_lock(&queue->pop_mutex);
+    *item = queue->head->data;
+    queue->head = queue->head->next;
+    pthread_mutex_unlock(&queue->pop_mutex);
+    return 0;
+}
+
+static int ring_full(struct queue *queue){
+    struct queue_ring *ring = (struct queue_ring *) queue;
+
+    return __atomic_load_n(&ring->tail, __ATOMIC_RELAXED)
+           - __atomic_load_n(&ring->head, __ATOMIC_RELAXED) > ring->mask;
+}
+
+static void *producer(void *arg){
+    struct bench *bench = (struct bench *) arg;
+    int list = bench->kind == BENCH_LIST;
+
+    while(!bench->stop){
+        if(list ? list_full(bench->queue) : ring_full(bench->queue)){
+            sched_yield();
+            continue;
+        }
+        if(list) list_push(bench->queue, bench);
+        else queue_push_ring(NULL, bench->queue, bench);
+    }
+    return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Items per second through \a kind queue of \a size slots from
+/// \a producers threads, pushed by the consumer itself if zero.
+//////////////////////////////////////////////////////////////////////////////
+static double run(enum bench_kind kind, int producers, int size){
+    pthread_t threads[BENCH_PRODUCERS];
+    struct timespec start;
+    struct bench bench;
+    unsigned long popped = 0;
+    double seconds;
+    void *items[32];
+    int count;
+    int i;
+
+    memset(&bench, 0, sizeof(bench));
+    bench.kind = kind;
+    if(kind == BENCH_LIST) bench.queue = list_new(size);
+    else if(queue_ring_new(NULL, &bench.queue, size, producers > 1, NULL) != 0)
+        return 0;
+
+    for(i = 0; i < producers; i++)
+        pthread_create(&threads[i], NULL, producer, &bench);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do{
+        for(i = 0; i < 1024; i++){
+            for(count = 0; producers == 0 && count < 32; count++){
+                if(kind == BENCH_LIST) list_push(bench.queue, &bench);
+                else queue_push_ring(NULL, bench.queue, &bench);
+            }
+            do{
+                if(kind == BENCH_LIST) count = list_pop(bench.queue, items) == 0;
+                else if(kind == BENCH_RING)
+                    count = queue_pop_ring(bench.queue, items) == 0;
+                else count = queue_pop_ring_batch(bench.queue, items, 32);
+                popped += count;
+            }while(producers == 0 && count > 0);
+        }
+    }while((seconds = elapsed(&start)) < BENCH_SECONDS);
+
+    bench.stop = 1;
+    for(i = 0; i < producers; i++) pthread_join(threads[i], NULL);
+
+    if(kind == BENCH_LIST) list_free(bench.queue);
+    else queue_ring_free(&bench.queue);
+
+    return popped / seconds;
+}
+
+int main(int argc, char **argv){
+    static const char *names[] = { "list", "ring", "ring/32" };
+    enum bench_kind kind;
+    double rate;
+    int size = BENCH_SIZE;
+    int producers;
+
+    if(argc > 1 && (size = atoi(argv[1])) < 2){
+        fprintf(stderr, "Usage: %s [SIZE]\n", argv[0]);
+        return 1;
+    }
+
+    printf("queue of %d items, producers wait while full\n", size);
+    for(producers = 0; producers <= BENCH_PRODUCERS;
+        producers = producers ? producers * 2 : 1){
+        for(kind = BENCH_LIST; kind <= BENCH_RING_BURST; kind++){
+            rate = run(kind, producers, size);
+            if(producers == 0) printf("in-thread     ");
+            else printf("%d producer(s) ", producers);
+            printf("%-8s %8.2f M items/s %8.1f ns/item\n", names[kind],
+                   rate / 1e6, rate > 0 ? 1e9 / rate : 0.0);
+        }
+    }
+
+    return 0;
+}
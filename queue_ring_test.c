@@ -0,0 +1,295 @@
+/*
+ Ring data queue.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Correctness tests of the ring data queue - sizes, order, wraparound,
+/// drops and accounting on a full ring, and one consumer against one or
+/// more producer threads, both spinning and parked on the eventfd (a
+/// wakeup lost by the parking protocol shows up as a poll timeout with
+/// items in the ring).
+///
+/// Usage: queue_ring_test
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <rum2/utils.h>
+#include <rum2/error.h>
+#include <rum2/queue.h>
+
+#include "queue_ring.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Largest number of producer threads.
+//////////////////////////////////////////////////////////////////////////////
+#define TEST_PRODUCERS 8
+
+//////////////////////////////////////////////////////////////////////////////
+/// Producer of an item (high bits) and its sequence number (low bits).
+//////////////////////////////////////////////////////////////////////////////
+#define ITEM(producer, seq) \
+    ((void *) (((uintptr_t) (producer) << 40) | ((uintptr_t) (seq) + 1)))
+#define ITEM_PRODUCER(item) ((unsigned) ((uintptr_t) (item) >> 40))
+#define ITEM_SEQ(item) (((uintptr_t) (item) & ((1UL << 40) - 1)) - 1)
+
+static unsigned long checks = 0;
+static unsigned long failures = 0;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Count a check, report it if it failed.
+//////////////////////////////////////////////////////////////////////////////
+#define CHECK(cond, ...)                                                \
+    do {                                                                \
+        checks++;                                                       \
+        if(!(cond)){                                                    \
+            failures++;                                                 \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);                 \
+            printf(__VA_ARGS__);                                        \
+            printf("\n");                                               \
+        }                                                               \
+    } while(0)
+
+//////////////////////////////////////////////////////////////////////////////
+/// Items dropped or flushed (flush callback).
+//////////////////////////////////////////////////////////////////////////////
+static unsigned long flushed = 0;
+
+//////////////////////////////////////////////////////////////////////////////
+/// One run of producers against the consumer.
+//////////////////////////////////////////////////////////////////////////////
+struct run {
+    struct queue *queue;            ///< Ring under test.
+    unsigned long items;            ///< Items pushed by every producer.
+    int pause;                      ///< Producers pause now and then.
+    int backoff;                    ///< Producers wait while the ring is full.
+    unsigned producers;             ///< Producers started (their IDs).
+    volatile int done;              ///< All the producers finished.
+};
+
+//////////////////////////////////////////////////////////////////////////////
+/// Error contexts of the core are not linked in.
+//////////////////////////////////////////////////////////////////////////////
+void rum_error(struct rum_error_ctx *errctx, enum rum_error err){
+    UNUSED(errctx);
+    UNUSED(err);
+}
+
+static void flush(void *item){
+    UNUSED(item);
+    __atomic_fetch_add(&flushed, 1, __ATOMIC_RELAXED);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Creation, order, wraparound and a full ring in one thread.
+//////////////////////////////////////////////////////////////////////////////
+static void test_single(void){
+    static const unsigned long bad[] = { 0, 1, 3, 6, 100 };
+    struct queue *queue;
+    void *items[8];
+    void *item;
+    unsigned long i;
+    int ok;
+
+    for(i = 0; i < sizeof(bad) / sizeof(bad[0]); i++){
+        CHECK(queue_ring_new(NULL, &queue, bad[i], 0, flush) != 0
+              && queue == NULL, "size %lu accepted", bad[i]);
+    }
+
+    CHECK(queue_ring_new(NULL, &queue, 4, 0, flush) == 0, "size 4");
+    CHECK(queue->type == QT_RING, "type");
+    CHECK(queue_pop_ring(queue, &item) != 0, "pop from empty ring");
+    CHECK(queue_ring_park(queue) == 0, "park on empty ring");
+    queue_ring_unpark(queue);
+
+    // Full ring drops the new items
+    flushed = 0;
+    for(i = 0; i < 6; i++) queue_push_ring(NULL, queue, ITEM(0, i));
+    CHECK(queue->total == 6 && queue->dropped == 2 && flushed == 2,
+          "full ring: total %lu, dropped %lu, flushed %lu", queue->total,
+          queue->dropped, flushed);
+    CHECK(queue_ring_park(queue) != 0, "park on full ring");
+    CHECK(queue_pop_ring_batch(queue, items, 8) == 4
+          && ITEM_SEQ(items[0]) == 0 && ITEM_SEQ(items[3]) == 3,
+          "batch from full ring");
+
+    // Many rounds, pops of one and of bursts
+    for(i = 0, ok = 1; i < 100000; i++){
+        queue_push_ring(NULL, queue, ITEM(0, i));
+        if(i % 3 == 2){
+            ok &= queue_pop_ring_batch(queue, items, 8) == 3
+                  && ITEM_SEQ(items[0]) == i - 2 && ITEM_SEQ(items[2]) == i;
+        }
+    }
+    CHECK(ok, "wraparound");
+    CHECK(queue_pop_ring(queue, &item) == 0 && ITEM_SEQ(item) == 99999,
+          "last item");
+
+    // Flushed when freed
+    flushed = 0;
+    queue_push_ring(NULL, queue, ITEM(0, 0));
+    queue_push_ring(NULL, queue, ITEM(0, 1));
+    queue_ring_free(&queue);
+    CHECK(queue == NULL && flushed == 2, "free flushes %lu", flushed);
+}
+
+static void *producer(void *arg){
+    struct run *run = (struct run *) arg;
+    struct queue_ring *ring = (struct queue_ring *) run->queue;
+    unsigned id = __atomic_fetch_add(&run->producers, 1, __ATOMIC_RELAXED);
+    unsigned long i;
+
+    for(i = 0; i < run->items; i++){
+        while(run->backoff
+              && __atomic_load_n(&ring->tail, __ATOMIC_RELAXED)
+                 - __atomic_load_n(&ring->head, __ATOMIC_RELAXED) > ring->mask)
+            sched_yield();
+        queue_push_ring(NULL, run->queue, ITEM(id, i));
+        if(run->pause && i % 512 == 0) usleep(100);
+    }
+    return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// \a producers threads push \a items items each into a ring of \a size
+/// slots; the consumer spins, or parks on the eventfd if \a park is set.
+/// Unless \a drop is set the producers wait while the ring is full (items
+/// can still be dropped when more of them race for the last slot). Every
+/// item must come out at most once and in order per producer, the drops
+/// must account for the rest.
+//////////////////////////////////////////////////////////////////////////////
+static void test_threads(int producers, unsigned long size,
+                         unsigned long items, int park, int drop){
+    pthread_t threads[TEST_PRODUCERS];
+    unsigned long next[TEST_PRODUCERS];
+    struct queue_ring *ring;
+    struct run run;
+    struct pollfd pfd;
+    void *burst[32];
+    unsigned long popped = 0;
+    unsigned long disorder = 0;
+    unsigned long lost = 0;
+    unsigned long parks = 0;
+    int count;
+    int done;
+    int i;
+
+    memset(next, 0, sizeof(next));
+    memset(&run, 0, sizeof(run));
+    run.items = items;
+    run.pause = park;
+    run.backoff = !drop;
+    flushed = 0;
+
+    CHECK(queue_ring_new(NULL, &run.queue, size, producers > 1, flush) == 0,
+          "new ring");
+    ring = (struct queue_ring *) run.queue;
+
+    for(i = 0; i < producers; i++)
+        pthread_create(&threads[i], NULL, producer, &run);
+
+    for(;;){
+        done = __atomic_load_n(&run.done, __ATOMIC_ACQUIRE);
+        if((count = queue_pop_ring_batch(run.queue, burst, 32)) > 0){
+            for(i = 0; i < count; i++){
+                unsigned p = ITEM_PRODUCER(burst[i]);
+
+                if(p >= TEST_PRODUCERS || ITEM_SEQ(burst[i]) < next[p])
+                    disorder++;
+                else
+                    next[p] = ITEM_SEQ(burst[i]) + 1;
+            }
+            popped += count;
+            continue;
+        }
+        if(done) break;
+
+        // Tell the producers apart from the end of the test
+        if(popped + __atomic_load_n(&flushed, __ATOMIC_RELAXED)
+           == producers * items){
+            for(i = 0; i < producers; i++) pthread_join(threads[i], NULL);
+            __atomic_store_n(&run.done, 1, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        if(!park){
+            sched_yield();
+            continue;
+        }
+
+        if(queue_ring_park(run.queue) == 0){
+            parks++;
+            pfd.fd = ring->wake;
+            pfd.events = POLLIN;
+            if(poll(&pfd, 1, 1000) == 0
+               && __atomic_load_n(&ring->slots[ring->head & ring->mask].seq,
+                                  __ATOMIC_ACQUIRE) == ring->head + 1)
+                lost++;
+            queue_ring_unpark(run.queue);
+        }
+    }
+
+    CHECK(disorder == 0, "%d producers, ring of %lu: %lu items out of order",
+          producers, size, disorder);
+    CHECK(lost == 0, "%d producers, ring of %lu: %lu lost wakeups",
+          producers, size, lost);
+    CHECK(popped + flushed == producers * items
+          && run.queue->total == producers * items
+          && run.queue->dropped == flushed,
+          "%d producers, ring of %lu: %lu popped + %lu dropped of %lu "
+          "(total %lu, dropped %lu)", producers, size, popped, flushed,
+          producers * items, run.queue->total, run.queue->dropped);
+
+    printf("%d producer(s), ring of %4lu, %s%s: %lu popped, %lu dropped, "
+           "%lu parks\n", producers, size, park ? "parked" : "spinning",
+           drop ? ", no backoff" : "", popped, flushed, parks);
+
+    queue_ring_free(&run.queue);
+}
+
+int main(void){
+    test_single();
+
+    test_threads(1, 1024, 2000000, 0, 0);
+    test_threads(1, 2, 200000, 0, 0);
+    test_threads(1, 64, 100000, 1, 0);
+    test_threads(1, 64, 1000000, 0, 1);
+    test_threads(4, 1024, 1000000, 0, 0);
+    test_threads(4, 16, 200000, 0, 0);
+    test_threads(4, 16, 1000000, 0, 1);
+    test_threads(8, 256, 50000, 1, 0);
+
+    printf("%lu checks, %lu failures\n", checks, failures);
+
+    return failures != 0;
+}
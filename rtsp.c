@@ -31,6 +31,9 @@
     #include "config.h"
 #endif
 
+// accept4()
+#define _GNU_SOURCE
+
 #ifdef USE_IP6
     #error RTSP module cannot be used with IPv6!
 #endif
@@ -65,6 +68,7 @@
 
 #include "rtsp.h"
 #include "rtsp_eris_headers.h"
+#include "rtsp_sessid.h"
 
 
 
@@ -140,17 +144,27 @@ static int m_name(struct module *module, int id){
 /// \see module_interface::init() (RUM2 documentation)
 //////////////////////////////////////////////////////////////////////////////
 static int m_init(struct module *module){
-    int list_s;                 // listening socket
     int port;                   // port number
+    int workers;                // number of worker loops
+    int backlog;                // listen backlog
+    int accept_batch;           // max. accepts per wakeup
+    int stats_interval;         // seconds between statistics logs
+    int rap_window;             // batch window of CLIENTS updates (ms)
+    int rap_batch;              // max. addresses in one batch
+    int timeout_tick;           // granularity of client timeouts (ms)
+    int lease;                  // lease of detached sessions (s)
+    int frame_queue;            // frames queued per interleaved client
+    RTSP_Frame_Policy frame_policy; // frames for a full queue
+    int i;
     ADDR_TYPE servaddr;         // socket address structure
     RTSP_Server *srv;           // server structure
     char *address;              // addres in c_str
     char *listener_id;          // listener ID in c_str
     char *unix_socket;          // unix socket in c_str
-    int reuseaddr_on = 1;       // setsockopt flag
-    int flags;                  // fcntl flags
-    int sockfd, servlen;
-    struct sockaddr_un unixsocket_addr;
+    char *catalog_file;         // stream catalog file in c_str
+    char *policy;               // frame policy in c_str
+    RTSP_Catalog *catalog = NULL; // stream catalog
+    GError *error = NULL;       // catalog load error
 
     // Get the port number from module parameters
     if((port = atol(modparam_get(module, PARAM_PORT))) <= 0 || port > 65535){
@@ -158,6 +172,63 @@ static int m_init(struct module *module){
             return -1;
     }
 
+    // Get the number of worker loops from module parameters
+    if((workers = atol(modparam_get(module, PARAM_WORKERS))) <= 0
+        || workers > MAX_WORKERS){
+            rum_error(module->errctx, RUM_EMSGIFACE_PARAMS);
+            return -1;
+    }
+
+    // Get the listen backlog and accept batch size from module parameters
+    if((backlog = atol(modparam_get(module, PARAM_BACKLOG))) <= 0
+        || (accept_batch = atol(modparam_get(module, PARAM_ACCEPT_BATCH))) <= 0){
+            rum_error(module->errctx, RUM_EMSGIFACE_PARAMS);
+            return -1;
+    }
+
+    // Get statistics interval from module parameters
+    if((stats_interval = atol(modparam_get(module, PARAM_STATS_INTERVAL))) < 0){
+            rum_error(module->errctx, RUM_EMSGIFACE_PARAMS);
+            return -1;
+    }
+
+    // Get batching of CLIENTS updates from module parameters
+    if((rap_window = atol(modparam_get(module, PARAM_RAP_WINDOW))) < 0
+        || (rap_batch = atol(modparam_get(module, PARAM_RAP_BATCH))) <= 0){
+            rum_error(module->errctx, RUM_EMSGIFACE_PARAMS);
+            return -1;
+    }
+
+    // Get granularity of client timeouts from module parameters
+    if((timeout_tick = atol(modparam_get(module, PARAM_TIMEOUT_TICK))) <= 0){
+            rum_error(module->errctx, RUM_EMSGIFACE_PARAMS);
+            return -1;
+    }
+
+    // Get the lease of detached sessions from module parameters
+    if((lease = atol(modparam_get(module, PARAM_SESSION_LEASE))) < 0){
+            rum_error(module->errctx, RUM_EMSGIFACE_PARAMS);
+            return -1;
+    }
+
+    // Get the queue of interleaved clients from module parameters
+    if((frame_queue = atol(modparam_get(module, PARAM_FRAME_QUEUE))) <= 0
+        || (policy = modparam_get(module, PARAM_FRAME_POLICY)) == NULL){
+            rum_error(module->errctx, RUM_EMSGIFACE_PARAMS);
+            return -1;
+    }
+
+    if(strcmp(policy, "drop-oldest") == 0)
+        frame_policy = FRAMES_DROP_OLDEST;
+    else if(strcmp(policy, "drop-newest") == 0)
+        frame_policy = FRAMES_DROP_NEWEST;
+    else if(strcmp(policy, "close") == 0)
+        frame_policy = FRAMES_CLOSE;
+    else{
+        rum_error(module->errctx, RUM_EMSGIFACE_PARAMS);
+        return -1;
+    }
+
     // Get the IP address from module parameters
     if ((address = modparam_get(module, PARAM_BIND_ADDR)) == NULL) {
             rum_error(module->errctx, RUM_EMSGIFACE_PARAMS);
@@ -176,33 +247,138 @@ static int m_init(struct module *module){
             return -1;
     }
 
+    // Reset all bytes in socket address structure and fill in IP + port
+    memset(&servaddr, 0, sizeof(servaddr));
+    servaddr.SIN_AF = AF_INET46;
+    if (inet_pton(AF_INET46, address, &servaddr.SIN_ADDR) <= 0) {
+        rum_error(module->errctx, RUM_EMSGIFACE_PARAMS);
+        return -1;
+    }
+    servaddr.SIN_PORT = htons(port);
+
+    // Load the stream catalog (optional)
+    if ((catalog_file = modparam_get(module, PARAM_CATALOG)) != NULL
+        && catalog_file[0] != '\0') {
+        catalog = catalog_load(catalog_file, listener_id, tmpl_describe_ok,
+                               &error);
+        if (catalog == NULL) {
+            logerror(module->id.mclass, module->id.name, LOG_ERROR,
+                     module->errctx, "Unable to load stream catalog %s: %s",
+                     catalog_file, error != NULL ? error->message : "?");
+            g_clear_error(&error);
+            rum_error(module->errctx, RUM_EMSGIFACE_PARAMS);
+            return -1;
+        }
+    }
+
+    // Allocate memory for private data structure
+    module->data = (RTSP_Server*)g_malloc0(sizeof(RTSP_Server));
+    if(module->data == NULL) {
+	rum_error(module->errctx, RUM_EMSGIFACE_INIT);
+        return -1;
+    }
+
+    // Assign vars to members in srv
+    srv = module_data(module, RTSP_Server);
+    srv->servaddr = g_malloc0(sizeof(servaddr));
+    memcpy(srv->servaddr,&servaddr,sizeof(servaddr));
+    srv->server_state = RTSP_SERVER_INIT;
+    srv->listener_id = g_intern_string(listener_id);
+    srv->worker_count = workers;
+    srv->backlog = backlog;
+    srv->accept_batch = accept_batch;
+    srv->stats_interval = stats_interval;
+    srv->rap_window = rap_window / 1000.;
+    srv->rap_batch = rap_batch;
+    srv->timeout_tick = timeout_tick / 1000.;
+    srv->lease = lease;
+    srv->catalog_file = (catalog != NULL) ? catalog_file : NULL;
+    srv->catalog = catalog;
+    srv->catalog_gen = 1;               // workers pick the catalog up
+    pthread_mutex_init(&srv->catalog_lock, NULL);
+    srv->frame_queue = frame_queue;
+    srv->frame_policy = frame_policy;
+    srv->groups = g_hash_table_new_full(group_hash, group_equal, g_free, NULL);
+    pthread_mutex_init(&srv->groups_lock, NULL);
+    g_queue_init(&srv->updates);
+    pthread_mutex_init(&srv->updates_lock, NULL);
+    srv->workers = g_malloc0(workers * sizeof(RTSP_Worker));
+
+    // Preformat static parts of the responses
+    response_init(srv);
+
+    // Mark all sockets as unused, m_clean relies on it
+    for(i = 0; i < workers; i++){
+        srv->workers[i].list_s = -1;
+        srv->workers[i].rap.fd = -1;
+    }
+
+    // Prepare worker loops (listening sockets, client lists, RAP socket)
+    for(i = 0; i < workers; i++){
+        srv->workers[i].id = i;
+        if(worker_init(module, &srv->workers[i], &servaddr, unix_socket) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Prepare one worker - open its own listening socket (SO_REUSEPORT, so all
+/// workers can bind the same address), connect to the UNIX socket for RAP
+/// messages (the first worker) and create the worker's loop.
+///
+/// \param module Module structure (errors).
+/// \param worker The worker to be initialized (\a id is already set).
+/// \param servaddr Local address to listen on.
+/// \param unix_socket Path to the UNIX socket (target for RAP msgs).
+/// \return Zero on success, nonzero otherwise.
+//////////////////////////////////////////////////////////////////////////////
+static int worker_init(struct module *module, RTSP_Worker *worker,
+                       ADDR_TYPE *servaddr, const char *unix_socket){
+    int list_s;                 // listening socket
+    int reuse_on = 1;           // setsockopt flag
+    int flags;                  // fcntl flags
+    int sockfd, servlen;
+    struct sockaddr_un unixsocket_addr;
+
+    worker->module = module;
+    worker->srv = module_data(module, RTSP_Server);
+    g_queue_init(&worker->interleaved);
+    pthread_mutex_init(&worker->feed_lock, NULL);
+    g_queue_init(&worker->replies);
+    pthread_mutex_init(&worker->replies_lock, NULL);
+    worker->rap.out = g_string_new(NULL);
+    g_queue_init(&worker->rap.pending);
+    worker->rap.batch = g_hash_table_new_full(batch_hash, batch_equal,
+                                              NULL, g_free);
+
     // Create a socket
     if ((list_s = socket(AF_INET46, SOCK_STREAM, 0)) < 0 ) {
 	rum_error(module->errctx, RUM_EMSGIFACE_INIT);
         return -1;
     }
+    worker->list_s = list_s;
 
     setsockopt(list_s, SOL_SOCKET, SO_REUSEADDR,
-               &reuseaddr_on, sizeof(reuseaddr_on));
+               &reuse_on, sizeof(reuse_on));
 
-    // Reset all bytes in socket address structure and fill in IP + port
-    memset(&servaddr, 0, sizeof(servaddr));
-    servaddr.SIN_AF = AF_INET46;
-    if (inet_pton(AF_INET46, address, &servaddr.SIN_ADDR) <= 0) {
-        rum_error(module->errctx, RUM_EMSGIFACE_PARAMS);
+    // Every worker binds the same address, the kernel balances accepts
+    if (setsockopt(list_s, SOL_SOCKET, SO_REUSEPORT,
+                   &reuse_on, sizeof(reuse_on)) != 0
+        && worker->srv->worker_count > 1) {
+	rum_error(module->errctx, RUM_EMSGIFACE_INIT);
         return -1;
     }
-    servaddr.SIN_PORT = htons(port);
-
 
     // Bind socket addresss to the listening socket
-    if ( bind(list_s, (struct sockaddr *) &servaddr, sizeof(servaddr)) != 0 ) {
+    if ( bind(list_s, (struct sockaddr *) servaddr, sizeof(*servaddr)) != 0 ) {
 	rum_error(module->errctx, RUM_EMSGIFACE_INIT);
         return -1;
     }
 
     // Start listening
-    if ( listen(list_s, LISTENQ) != 0 ) {
+    if ( listen(list_s, worker->srv->backlog) != 0 ) {
 	rum_error(module->errctx, RUM_EMSGIFACE_INIT);
         return -1;
     }
@@ -214,44 +390,119 @@ static int m_init(struct module *module){
     flags |= O_NONBLOCK;
     if (fcntl(list_s, F_SETFL, flags) < 0) return -1;
 
-    // Allocate memory for private data structure
-    module->data = (RTSP_Server*)g_malloc0(sizeof(RTSP_Server));
-    if(module->data == NULL) {
+    // The first worker talks to the reflector for all of them (CLIENTS
+    // updates of an address must not overtake each other)
+    if (worker->id == 0) {
+        bzero((char *)&unixsocket_addr,sizeof(unixsocket_addr));
+        unixsocket_addr.sun_family = AF_UNIX;
+        strncpy(unixsocket_addr.sun_path, unix_socket,
+                sizeof(unixsocket_addr.sun_path) - 1);
+        servlen = strlen(unixsocket_addr.sun_path) + sizeof(unixsocket_addr.sun_family);
+
+        if ((sockfd = socket(AF_UNIX, SOCK_STREAM,0)) < 0){
+           rum_error(module->errctx, RUM_EMSGIFACE_INIT);
+           return -1;
+        }
+        worker->rap.fd = sockfd;
+
+        if (connect(sockfd, (struct sockaddr *) &unixsocket_addr, servlen) < 0){
+           rum_error(module->errctx, RUM_EMSGIFACE_INIT);
+           return -1;
+        }
+
+        // RAP replies are read by the loop, requests never block it
+        if ((flags = fcntl(sockfd, F_GETFL)) < 0
+            || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0){
+           rum_error(module->errctx, RUM_EMSGIFACE_INIT);
+           return -1;
+        }
+    }
+
+    // Session IDs are generated from a random key
+    if (sessid_init(&worker->sessid) != 0) {
+       rum_error(module->errctx, RUM_EMSGIFACE_INIT);
+       return -1;
+    }
+
+    session_shard_init(&worker->sessions);
+    pool_init(&worker->clients, sizeof(RTSP_Client), CLIENT_SLAB);
+    pool_init(&worker->lease_pool, sizeof(RTSP_Lease), LEASE_SLAB);
+
+    // Prepare worker loop, m_stop wakes it up through ev_stop
+    worker->loop = ev_loop_new(EVFLAG_AUTO);
+    if (worker->loop == NULL) {
 	rum_error(module->errctx, RUM_EMSGIFACE_INIT);
         return -1;
     }
 
-    //
-    bzero((char *)&unixsocket_addr,sizeof(unixsocket_addr));
-    unixsocket_addr.sun_family = AF_UNIX;
-    strcpy(unixsocket_addr.sun_path, unix_socket);
-    servlen = strlen(unixsocket_addr.sun_path) + sizeof(unixsocket_addr.sun_family);
+    ev_async_init(&worker->ev_stop, worker_stop);
+    worker->ev_stop.data = worker;
+    ev_async_start(worker->loop, &worker->ev_stop);
+
+    // Packets for interleaved clients are handed over by m_push_data
+    ev_async_init(&worker->ev_feed, feed_flush);
+    worker->ev_feed.data = worker;
+    ev_async_start(worker->loop, &worker->ev_feed);
+
+    // Replies to the adds the first worker sent for this one
+    ev_async_init(&worker->ev_replies, replies_wake);
+    worker->ev_replies.data = worker;
+    ev_async_start(worker->loop, &worker->ev_replies);
+
+    // RAP channel (the WRITE watcher runs only while requests are pending),
+    // the other workers hand their updates over through ev_updates
+    if(worker->id == 0){
+        ev_io_init(&worker->rap.ev_read, rap_read, worker->rap.fd, EV_READ);
+        worker->rap.ev_read.data = worker;
+        ev_io_start(worker->loop, &worker->rap.ev_read);
+        ev_io_init(&worker->rap.ev_write, rap_write, worker->rap.fd, EV_WRITE);
+        worker->rap.ev_write.data = worker;
+        ev_init(&worker->rap.ev_batch, rap_flush);
+        worker->rap.ev_batch.data = worker;
+
+        ev_async_init(&worker->srv->ev_updates, updates_wake);
+        worker->srv->ev_updates.data = worker;
+        ev_async_start(worker->loop, &worker->srv->ev_updates);
+    }
 
-    //
-    if ((sockfd = socket(AF_UNIX, SOCK_STREAM,0)) < 0){
-       rum_error(module->errctx, RUM_EMSGIFACE_INIT);
-       return -1;
+    // Assign worker pointer to data in ev_accept (accessible later)
+    ev_io_init(&worker->ev_accept, accept_connection, list_s, EV_READ);
+    worker->ev_accept.data = worker;
+
+    // Closed clients are freed after the callbacks of a loop iteration
+    ev_check_init(&worker->ev_reclaim, reclaim);
+    worker->ev_reclaim.data = worker;
+
+    // The first worker reloads the stream catalog when it changes
+    if(worker->id == 0 && worker->srv->catalog_file != NULL){
+        ev_stat_init(&worker->srv->ev_catalog, catalog_reload,
+                     worker->srv->catalog_file, 0.);
+        worker->srv->ev_catalog.data = worker;
     }
-    if (connect(sockfd, (struct sockaddr *) &unixsocket_addr, servlen) < 0){
-       rum_error(module->errctx, RUM_EMSGIFACE_INIT);
-       return -1;
+
+    // The first worker registers the multicast groups with the reflector
+    if(worker->id == 0){
+        ev_async_init(&worker->srv->ev_groups, groups_wake);
+        worker->srv->ev_groups.data = worker;
+        ev_async_start(worker->loop, &worker->srv->ev_groups);
     }
 
-    // Assign vars to members in srv
-    srv = module_data(module, RTSP_Server);
-    srv->servaddr = g_malloc0(sizeof(servaddr));
-    memcpy(srv->servaddr,&servaddr,sizeof(servaddr));
-    srv->list_s = list_s;
-    srv->client_list = g_hash_table_new_full(g_str_hash, g_str_equal,
-                                             g_free, g_free);
-    srv->server_state = RTSP_SERVER_INIT;
-    srv->srv_mutex = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
-    srv->unixsocket_fd = sockfd;
-    srv->listener_id = listener_id;
+    // Client timeouts and session leases, one wheel tick every timeout_tick
+    // seconds
+    wheel_init(&worker->idle, worker->srv->timeout_tick, TIMEOUT,
+               ev_now(worker->loop));
+    wheel_init(&worker->leases, worker->srv->timeout_tick,
+               worker->srv->lease > 0 ? worker->srv->lease : TIMEOUT,
+               ev_now(worker->loop));
+    ev_periodic_init(&worker->ev_idle, idle_tick, 0.,
+                     worker->srv->timeout_tick, 0);
+    worker->ev_idle.data = worker;
+
+    // Statistics are logged only on demand
+    ev_periodic_init(&worker->ev_stats, worker_stats, 0.,
+                     worker->srv->stats_interval, 0);
+    worker->ev_stats.data = worker;
 
-    // Prepare main loop
-    srv->loop = ev_default_loop (0);
-    
     return 0;
 }
 
@@ -260,9 +511,9 @@ static int m_init(struct module *module){
 /// \see module_interface::main() (RUM2 documentation)
 //////////////////////////////////////////////////////////////////////////////
 static void m_main(struct module *module){
-    int list_s;                     // listener socket
     char srv_straddr[ADDRSTR_LEN];  // address as a c_str
     RTSP_Server *srv;               // server structure
+    int i;
 
     // Get data from module
     srv = module_data(module, RTSP_Server);
@@ -271,26 +522,172 @@ static void m_main(struct module *module){
         return;
     }
 
-    // Assign module pointer to data in ev_accept (accessible later)
-    srv->ev_accept.data = module;
-
-    // Get listener socket and set state READY
-    list_s = srv->list_s;
+    // Set state READY
     srv->server_state = RTSP_SERVER_READY;
 
     // Get c_str for server address
     inet_ntop(AF_INET46, &(srv->servaddr->SIN_ADDR),
               srv_straddr,sizeof(srv_straddr));
 
-    logm(&module->id, LOG_INFO,"RTSP server started, listening on %s:%d",
-            srv_straddr, ntohs(srv->servaddr->SIN_PORT));
+    logm(&module->id, LOG_INFO,"RTSP server started, listening on %s:%d "
+         "(%d worker loops)", srv_straddr, ntohs(srv->servaddr->SIN_PORT),
+         srv->worker_count);
+
+    // Start additional workers in their own threads
+    for(i = 1; i < srv->worker_count; i++){
+        if(pthread_create(&srv->workers[i].thread, NULL, worker_main,
+                          &srv->workers[i]) != 0){
+            logerror(module->id.mclass, module->id.name, LOG_ERROR,
+                     module->errctx, "Unable to start worker thread");
+            continue;
+        }
+        srv->workers[i].running = TRUE;
+    }
+
+    // The first worker runs in the module thread
+    worker_main(&srv->workers[0]);
+
+    srv->server_state = RTSP_SERVER_HALT;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Worker thread function - start listening and run the worker loop.
+///
+/// \param arg The worker structure (RTSP_Worker *).
+/// \return Always NULL.
+//////////////////////////////////////////////////////////////////////////////
+static void *worker_main(void *arg){
+    RTSP_Worker *worker = (RTSP_Worker *) arg;
 
     // Start listening for READ events on list_s socket
-    ev_io_init(&srv->ev_accept,accept_connection,list_s,EV_READ);
-    ev_io_start(srv->loop,&srv->ev_accept);
+    ev_io_start(worker->loop, &worker->ev_accept);
+    ev_periodic_start(worker->loop, &worker->ev_idle);
 
-    // Start the main loop
-    ev_loop (srv->loop, 0);
+    if(worker->id == 0 && worker->srv->catalog_file != NULL)
+        ev_stat_start(worker->loop, &worker->srv->ev_catalog);
+
+    if(worker->srv->stats_interval > 0)
+        ev_periodic_start(worker->loop, &worker->ev_stats);
+
+    // Start the worker loop
+    ev_loop(worker->loop, 0);
+
+    return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Stop the worker loop (in the worker thread) after m_stop sent ev_stop.
+///
+/// \param loop The worker loop.
+/// \param w The async watcher (worker data).
+/// \param revents Flags for this event.
+//////////////////////////////////////////////////////////////////////////////
+static void worker_stop(struct ev_loop *loop, struct ev_async *w, int revents){
+    RTSP_Worker *worker = (RTSP_Worker *) w->data;
+
+    UNUSED(revents);
+
+    ev_io_stop(loop, &worker->ev_accept);
+    ev_async_stop(loop, &worker->ev_feed);
+    ev_async_stop(loop, &worker->ev_replies);
+    ev_io_stop(loop, &worker->rap.ev_read);
+    ev_io_stop(loop, &worker->rap.ev_write);
+    ev_timer_stop(loop, &worker->rap.ev_batch);
+    ev_periodic_stop(loop, &worker->ev_idle);
+    ev_check_stop(loop, &worker->ev_reclaim);
+    if(worker->id == 0 && worker->srv->catalog_file != NULL)
+        ev_stat_stop(loop, &worker->srv->ev_catalog);
+    if(worker->id == 0){
+        ev_async_stop(loop, &worker->srv->ev_groups);
+        ev_async_stop(loop, &worker->srv->ev_updates);
+    }
+    ev_periodic_stop(loop, &worker->ev_stats);
+    ev_unloop(loop, EVUNLOOP_ALL);
+
+    worker_stats(loop, &worker->ev_stats, 0);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Log worker statistics (every \a PARAM_STATS_INTERVAL seconds and when
+/// the worker is stopped).
+///
+/// \param loop The worker loop.
+/// \param w The periodic watcher (worker data).
+/// \param revents Flags for this event.
+//////////////////////////////////////////////////////////////////////////////
+static void worker_stats(struct ev_loop *loop, struct ev_periodic *w,
+                         int revents){
+    RTSP_Worker *worker = (RTSP_Worker *) w->data;
+    RTSP_Worker_Stats *stats = &worker->stats;
+    RTSP_Session_Count total;               // sessions of all the workers
+    guint groups;                           // multicast groups
+    int i;
+
+    UNUSED(loop);
+    UNUSED(revents);
+
+    logm(&worker->module->id, LOG_INFO, "Worker %d: %lu connections accepted "
+         "in %lu wakeups (%.2f per wakeup, max. %lu), %u sessions", worker->id,
+         stats->accepted, stats->accept_wakeups,
+         stats->accept_wakeups
+            ? (double) stats->accepted / stats->accept_wakeups : 0.,
+         stats->accept_max, worker->sessions.count);
+
+    logm(&worker->module->id, LOG_INFO, "Worker %d: %lu CLIENTS updates sent "
+         "as %lu messages in %lu batches (%lu saved by coalescing)", worker->id,
+         stats->rap_updates, stats->rap_sent, stats->rap_flushes,
+         stats->rap_updates - stats->rap_sent);
+
+    logm(&worker->module->id, LOG_INFO, "Worker %d: %u clients, %lu "
+         "allocations (%.1f%% from the free list), %lu kB in the pool",
+         worker->id, worker->clients.in_use, worker->clients.allocs,
+         worker->clients.allocs
+            ? 100. * worker->clients.hits / worker->clients.allocs : 0.,
+         (unsigned long) (pool_resident(&worker->clients) / 1024));
+
+    logm(&worker->module->id, LOG_INFO, "Worker %d: %d interleaved clients, "
+         "%lu frames sent, %lu dropped (slow readers), %lu packets dropped "
+         "(feed full)", worker->id, worker->interleaved_count,
+         stats->frames_sent, stats->frames_dropped, stats->feed_dropped);
+
+    logm(&worker->module->id, LOG_INFO, "Worker %d: %lu sessions outlived "
+         "their connections, %lu adopted by a new one, %lu expired",
+         worker->id, stats->leased, stats->adopted, stats->expired);
+
+    // The first worker reports the whole table (read without any lock)
+    if(worker->id == 0){
+        memset(&total, 0, sizeof(total));
+        for(i = 0; i < worker->srv->worker_count; i++)
+            session_foreach(&worker->srv->workers[i].sessions, count_session,
+                            &total);
+
+        pthread_mutex_lock(&worker->srv->groups_lock);
+        groups = g_hash_table_size(worker->srv->groups);
+        pthread_mutex_unlock(&worker->srv->groups_lock);
+
+        logm(&worker->module->id, LOG_INFO, "Server: %u sessions, %u playing "
+             "(%u multicast viewers in %u groups)", total.sessions,
+             total.playing, total.viewers, groups);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Count a session in the statistics (\a session_foreach callback).
+///
+/// \param id Session ID.
+/// \param info Session data.
+/// \param data Session counts (RTSP_Session_Count).
+//////////////////////////////////////////////////////////////////////////////
+static void count_session(uint64_t id, const RTSP_Session_Info *info,
+                          gpointer data){
+    RTSP_Session_Count *total = (RTSP_Session_Count *) data;
+
+    UNUSED(id);
+
+    total->sessions++;
+    if(info->playing) total->playing++;
+    if(info->playing && info->transport.delivery == TRANSPORT_MULTICAST)
+        total->viewers++;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -299,13 +696,75 @@ static void m_main(struct module *module){
 //////////////////////////////////////////////////////////////////////////////
 static void m_clean(struct module *module, int for_restart){
     RTSP_Server *srv = module_data(module, RTSP_Server);
+    RTSP_Worker *worker;
+    RAP_Request *request;
+    RAP_Update *update;
+    RAP_Forward *forward;
+    GHashTableIter iter;
+    gpointer value;
+    GList *link;
+    int i;
 
     // Free memory allocated for private data structure
     if(srv != NULL){
-        g_hash_table_destroy(srv->client_list);
-        pthread_mutex_destroy(&srv->srv_mutex);
+        for(i = 0; srv->workers != NULL && i < srv->worker_count; i++){
+            worker = &srv->workers[i];
+
+            if(worker->sessions.table != NULL)
+                session_shard_clean(&worker->sessions);
+            if(worker->idle.slots != NULL) wheel_clean(&worker->idle);
+            if(worker->leases.slots != NULL) wheel_clean(&worker->leases);
+            pool_clean(&worker->lease_pool);
+
+            // Packets held by the interleaved clients (before the clients go)
+            for(link = worker->interleaved.head; link != NULL; link = link->next)
+                frames_clean(&((RTSP_Client *) link->data)->frames);
+            pool_clean(&worker->clients);
+            if(worker->loop != NULL) ev_loop_destroy(worker->loop);
+            if(worker->list_s >= 0) close(worker->list_s);
+            if(worker->rap.fd >= 0) close(worker->rap.fd);
+            if(worker->rap.out != NULL) g_string_free(worker->rap.out, TRUE);
+            while((request = g_queue_pop_head(&worker->rap.pending)) != NULL){
+                waiters_free(&request->waiters);
+                g_free(request);
+            }
+            if(worker->rap.batch != NULL){
+                g_hash_table_iter_init(&iter, worker->rap.batch);
+                while(g_hash_table_iter_next(&iter, NULL, &value))
+                    waiters_free(&((RAP_Batch_Entry *) value)->waiters);
+                g_hash_table_destroy(worker->rap.batch);
+            }
+            while(worker->feed_head != worker->feed_tail)
+                data_free(worker->feed[worker->feed_head++ & (FEED_SIZE - 1)]);
+            pthread_mutex_destroy(&worker->feed_lock);
+            while((forward = g_queue_pop_head(&worker->replies)) != NULL){
+                waiters_free(&forward->waiters);
+                g_free(forward);
+            }
+            pthread_mutex_destroy(&worker->replies_lock);
+        }
+        while((update = g_queue_pop_head(&srv->updates)) != NULL){
+            if(update->forward != NULL){
+                waiters_free(&update->forward->waiters);
+                g_free(update->forward);
+            }
+            g_free(update);
+        }
+        pthread_mutex_destroy(&srv->updates_lock);
+        for(i = 0; srv->workers != NULL && i < srv->worker_count; i++){
+            if(srv->workers[i].catalog != NULL)
+                catalog_unref(srv->workers[i].catalog);
+        }
+        if(srv->catalog != NULL) catalog_unref(srv->catalog);
+        pthread_mutex_destroy(&srv->catalog_lock);
+        if(srv->groups != NULL) g_hash_table_destroy(srv->groups);
+        pthread_mutex_destroy(&srv->groups_lock);
+        for(i = 0; i < RESPONSE_TYPES; i++)
+            template_clean(&srv->responses[i]);
+        g_free(srv->workers);
         g_free(srv->servaddr);
         g_free(srv);
+        module->data = NULL;
     }
 
     // Clean module parameters if it's not a restart
@@ -325,9 +784,22 @@ static void m_clean(struct module *module, int for_restart){
 //////////////////////////////////////////////////////////////////////////////
 static void m_stop(struct module *module){
     RTSP_Server *srv = module_data(module, RTSP_Server);
+    int i;
+
+    if(srv == NULL) return;
 
-    ev_io_stop(srv->loop, &srv->ev_accept);
-    ev_unloop (srv->loop, EVUNLOOP_ALL);
+    // Loops are owned by their threads, just wake them up
+    for(i = 0; i < srv->worker_count; i++)
+        if(srv->workers[i].loop != NULL)
+            ev_async_send(srv->workers[i].loop, &srv->workers[i].ev_stop);
+
+    // Wait for additional workers (the first one ends m_main)
+    for(i = 1; i < srv->worker_count; i++){
+        if(srv->workers[i].running){
+            pthread_join(srv->workers[i].thread, NULL);
+            srv->workers[i].running = FALSE;
+        }
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -346,68 +818,146 @@ static int m_config(struct module *module, const char *name, int start){
 }
 
 //////////////////////////////////////////////////////////////////////////////
-/// Accept connection from a client after READ event has been triggered in
-/// the main watcher (in m_main()). Prepare structures, start new READ watcher
-/// and timeout timer.
+/// Take a packet from the reflector's data path (called from the reflector's
+/// thread). Every worker with interleaved clients gets a reference to the
+/// packet in its feed and is woken up; a worker which cannot keep up loses
+/// the packet, the caller is never blocked by the loops.
+/// \see module_interface::push_data() (RUM2 documentation)
+//////////////////////////////////////////////////////////////////////////////
+static void m_push_data(struct module *module, void *data){
+    RTSP_Server *srv = module_data(module, RTSP_Server);
+    struct meta *meta = (struct meta *) data;
+    RTSP_Worker *worker;
+    int i;
+
+    if(meta == NULL) return;
+
+    for(i = 0; srv != NULL && meta->data != NULL && i < srv->worker_count; i++){
+        worker = &srv->workers[i];
+        if(g_atomic_int_get(&worker->interleaved_count) == 0) continue;
+
+        pthread_mutex_lock(&worker->feed_lock);
+        if(worker->feed_tail - worker->feed_head < FEED_SIZE){
+            data_ref(meta->data);
+            worker->feed[worker->feed_tail++ & (FEED_SIZE - 1)] = meta->data;
+        }
+        else{
+            worker->stats.feed_dropped++;
+        }
+        pthread_mutex_unlock(&worker->feed_lock);
+
+        ev_async_send(worker->loop, &worker->ev_feed);
+    }
+
+    meta_free(meta);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Accept connections from clients after READ event has been triggered in
+/// the worker's accept watcher. The listen queue is drained until it is
+/// empty or \a accept_batch connections have been accepted (the watcher
+/// fires again in the next loop iteration if there are more).
 ///
-/// \param loop The main loop (we need to set timeout and new watcher for READ).
+/// \param loop The worker loop.
 /// \param w The watcher structure calling accept_connection (with data).
 /// \param revents Flag for current event.
 //////////////////////////////////////////////////////////////////////////////
 static void accept_connection(struct ev_loop *loop, struct ev_io *w, int revents){
-    RTSP_Client *client;                // client structure
-    char clnt_straddr[ADDRSTR_LEN];     // client address as a c_str
     ADDR_TYPE clientaddr;               // client address (structure)
-    int addrsize;                       // size of the address
+    socklen_t addrsize;                 // size of the address
     int sd;                             // accepted socket descriptor
     int list_s = w->fd;                 // listener socket descriptor
+    int accepted = 0;                   // connections accepted now
     struct module *module;              // module structure
-    timeout_data *to_data;              // timeout data structure
+    RTSP_Worker *worker;                // worker structure
+
+    UNUSED(loop);
+    UNUSED(revents);
+
+    // Get worker data from the watcher
+    worker = (RTSP_Worker *) w->data;
+    module = worker->module;
+
+    while(accepted < worker->srv->accept_batch){
+        // Accept connection (NONBLOCK)
+        addrsize = sizeof(clientaddr);
+        sd = accept4(list_s, (struct sockaddr *)&clientaddr, &addrsize,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        if(sd < 0){
+            // Aborted before we got to it, try the next one
+            if(errno == EINTR || errno == ECONNABORTED) continue;
+
+            // Out of descriptors, the rest stays in the listen queue
+            if(errno == EMFILE || errno == ENFILE)
+                logerror(module->id.mclass, module->id.name, LOG_ERROR,
+                         module->errctx, "Unable to accept connection - "
+                         "too many open files");
+
+            // EAGAIN - listen queue is empty
+            break;
+        }
+
+        setup_client(worker, sd, &clientaddr);
+        accepted++;
+    }
 
-    // Get module data from the watcher
-    module = (struct module *) w->data;
+    // Batching statistics
+    worker->stats.accept_wakeups++;
+    worker->stats.accepted += accepted;
+    if(accepted > worker->stats.accept_max)
+        worker->stats.accept_max = accepted;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Prepare structures for an accepted connection, start new READ watcher
+/// and timeout timer.
+///
+/// \param worker The worker accepting the connection.
+/// \param sd Accepted socket descriptor (NONBLOCK).
+/// \param clientaddr Remote address of the client.
+//////////////////////////////////////////////////////////////////////////////
+static void setup_client(RTSP_Worker *worker, int sd, ADDR_TYPE *clientaddr){
+    RTSP_Client *client;                // client structure
+    char clnt_straddr[ADDRSTR_LEN];     // client address as a c_str
+    struct module *module;              // module structure
+    struct ev_loop *loop;               // worker loop
 
-    // Accept connection (NONBLOCK)
-    addrsize = sizeof(clientaddr);
-    sd = accept(list_s,(struct sockaddr *)&clientaddr, &addrsize);
+    module = worker->module;
+    loop = worker->loop;
 
     // Allocate memory for client data
-    client = (RTSP_Client *) g_malloc0(sizeof(RTSP_Client));
+    client = (RTSP_Client *) pool_alloc(&worker->clients);
     if(client == NULL){
         logerror(module->id.mclass, module->id.name, LOG_ERROR,
              module->errctx, "Memory allocation failure - struct client");
+        close(sd);
         return;
     }
 
-    inet_ntop(AF_INET46, &(clientaddr.SIN_ADDR),
+    inet_ntop(AF_INET46, &(clientaddr->SIN_ADDR),
               clnt_straddr, sizeof(clnt_straddr));
 
     logm(&module->id, LOG_INFO,"Connection with %s:%d established",
-        clnt_straddr, ntohs(clientaddr.SIN_PORT));
+        clnt_straddr, ntohs(clientaddr->SIN_PORT));
 
-    // Assign vars to members
-    client->clientaddr = g_malloc0(sizeof(clientaddr));
-    memcpy(client->clientaddr,&clientaddr,sizeof(clientaddr));
+    // Assign vars to members (the block is recycled, clear it first)
+    memset(client, 0, sizeof(RTSP_Client));
+    client->addr = *clientaddr;
+    client->clientaddr = &client->addr;
     client->socket = sd;
-    client->ev_read.data = module;
-    client->stop = FALSE;
+    client->worker = worker;
+    client->ev_read.data = worker;
+    client->state = CLIENT_READING;
     client->msg_cseq = 0;
-    client->req = NULL;
-    client->response = NULL;
-    client->sessionID = NULL;
-
-    // Initialize timeout timer
-    ev_init(&client->timer, timeout);
-    client->timer.repeat = TIMEOUT;
+    client->sessionID[0] = '\0';
+    client->transport = transport_default;
+    client->dest = *clientaddr;
+    client->dest.SIN_PORT = htons(TRANSPORT_DEFAULT_PORT);
 
-    // Allocate memory for timeout data
-    to_data = g_malloc0(sizeof(timeout_data));
-    to_data->client = client;
-    to_data->module = module;
-    client->timer.data = to_data;
-
-    // Start timer
-    ev_timer_again(loop, &client->timer);
+    // Start timeout timer
+    client->idle.data = client;
+    wheel_arm(&worker->idle, &client->idle, ev_now(loop), TIMEOUT);
 
     // Start READ watcher on the accepted connection
     ev_io_init(&client->ev_read,process,client->socket,EV_READ);
@@ -415,107 +965,657 @@ static void accept_connection(struct ev_loop *loop, struct ev_io *w, int revents
 }
 
 //////////////////////////////////////////////////////////////////////////////
-/// Clean-up memory after timeout occurs, remove client from \a client_list
-/// and terminate the connection.
+/// Advance the worker's timing wheel, clients idle for \a TIMEOUT seconds
+/// are passed to \a timeout.
 ///
-/// \param loop The main loop (\a module_data and logs).
-/// \param timer The timer structure triggering timeout (client data).
+/// \param loop The worker loop.
+/// \param w The periodic watcher (worker data).
 /// \param revents Flags for this event.
 //////////////////////////////////////////////////////////////////////////////
-static void timeout(struct ev_loop *loop, ev_timer *timer, int revents){
-
-    if(timer == NULL) return;
+static void idle_tick(struct ev_loop *loop, struct ev_periodic *w,
+                      int revents){
+    RTSP_Worker *worker = (RTSP_Worker *) w->data;
 
-    // Get data
-    timeout_data *to_data = (timeout_data *) timer->data;
-
-    if(to_data == NULL) return;
+    UNUSED(revents);
 
-    RTSP_Client *client = to_data->client;
-    struct module *module = to_data->module;
-    RTSP_Server *srv = module_data(module, RTSP_Server);
-    char clnt_straddr[ADDRSTR_LEN];
-    gboolean hashtableret = FALSE;
+    wheel_advance(&worker->idle, ev_now(loop), timeout, worker);
+    wheel_advance(&worker->leases, ev_now(loop), lease_expired, worker);
+}
 
-    // Stop timer
-    ev_timer_stop(loop, timer);
+//////////////////////////////////////////////////////////////////////////////
+/// Terminate the connection of a client idle for \a TIMEOUT seconds.
+///
+/// \param entry The expired wheel entry (client data).
+/// \param data The worker (\a module_data and logs).
+//////////////////////////////////////////////////////////////////////////////
+static void timeout(RTSP_Wheel_Entry *entry, gpointer data){
+    client_close((RTSP_Worker *) data, (RTSP_Client *) entry->data, "timeout");
+}
 
-    // Clean-up after timeout
-    if(client != NULL && module != NULL && srv != NULL){
-        inet_ntop(AF_INET46, &(client->clientaddr->SIN_ADDR), clnt_straddr,
-                  sizeof(clnt_straddr));
+//////////////////////////////////////////////////////////////////////////////
+/// Shard of the session table holding a session (the session ID contains
+/// the worker which created it).
+///
+/// \param worker Any worker.
+/// \param id Session ID (created by one of the workers).
+/// \return The shard.
+//////////////////////////////////////////////////////////////////////////////
+static RTSP_Session_Shard *session_shard(RTSP_Worker *worker, uint64_t id){
+    return &worker->srv->workers[id & (MAX_WORKERS - 1)].sessions;
+}
 
-        // Remove client from client list
-        if(client->sessionID != NULL){
-            pthread_mutex_lock(&srv->srv_mutex);
-            hashtableret = g_hash_table_remove(srv->client_list,client->sessionID);
-            pthread_mutex_unlock(&srv->srv_mutex);
+//////////////////////////////////////////////////////////////////////////////
+/// Keep the session of a closing connection for \a RTSP_Server::lease
+/// seconds. The client stays in the reflector (and in its multicast group),
+/// so a client reconnecting within the lease causes no CLIENTS update.
+///
+/// \param worker The worker owning the connection.
+/// \param client The client structure (with a session).
+/// \return TRUE if the session is leased, FALSE if it ends now.
+//////////////////////////////////////////////////////////////////////////////
+static gboolean lease_session(RTSP_Worker *worker, RTSP_Client *client){
+    RTSP_Server *srv = worker->srv;
+    RTSP_Lease *lease;
+
+    if(srv->lease <= 0
+       || (lease = pool_alloc(&worker->lease_pool)) == NULL)
+        return FALSE;
+
+    // Lease numbers are unique among the workers
+    memset(lease, 0, sizeof(*lease));
+    lease->session = client->session;
+    lease->lease = (++worker->lease_seq * MAX_WORKERS) | (guint) worker->id;
+
+    if(!session_detach(session_shard(worker, client->session),
+                       client->session, lease->lease)){
+        pool_free(&worker->lease_pool, lease);
+        return FALSE;
+    }
 
-            // Send RAP to remove this client
-            RAP_Msg_data *rap_msg_data = (RAP_Msg_data *) g_malloc0(sizeof(RAP_Msg_data));
+    // The lease holds the group instead of the client
+    lease->group = client->group;
+    client->group = NULL;
 
-            rap_msg_data->ip = (char *) g_malloc0(sizeof(clnt_straddr));
-            strcpy(rap_msg_data->ip, clnt_straddr);
-            rap_msg_data->type = RAP_CLIENTS_REMOVE;
+    lease->entry.data = lease;
+    wheel_arm(&worker->leases, &lease->entry, ev_now(worker->loop), srv->lease);
+    worker->stats.leased++;
 
-            send_rap_msg(module, rap_msg_data);
+    return TRUE;
+}
 
-            g_free(client->sessionID);
-        }
+//////////////////////////////////////////////////////////////////////////////
+/// End a detached session whose lease has run out (nobody adopted it) -
+/// remove it from the session table and the reflector.
+///
+/// \param entry The expired wheel entry (lease data).
+/// \param data The worker.
+//////////////////////////////////////////////////////////////////////////////
+static void lease_expired(RTSP_Wheel_Entry *entry, gpointer data){
+    RTSP_Worker *worker = (RTSP_Worker *) data;
+    RTSP_Lease *lease = (RTSP_Lease *) entry->data;
+    RTSP_Session_Info info;                 // the expired session
+
+    if(session_expire(session_shard(worker, lease->session), lease->session,
+                      lease->lease, &info)){
+        if(info.transport.delivery == TRANSPORT_UNICAST)
+            queue_rap_msg(worker, RAP_CLIENTS_REMOVE, info.listener_id,
+                          &info.dest, NULL);
+        worker->stats.expired++;
+    }
 
-        // Removed?
-        if(hashtableret)
-            logm(&module->id, LOG_INFO, "Connection to %s:%d terminated - "
-             "timeout (client removed from the client list)",
-             clnt_straddr, ntohs(client->clientaddr->SIN_PORT));
-        else
-            logm(&module->id, LOG_INFO, "Connection to %s:%d terminated - "
-             "timeout (client was not in the client list)",
-             clnt_straddr, ntohs(client->clientaddr->SIN_PORT));
+    if(lease->group != NULL) group_release(worker, lease->group);
 
-        // Stop READ/WRITE watchers
-        ev_io_stop(loop, &client->ev_read);
-        ev_io_stop(loop, &client->ev_write);
+    pool_free(&worker->lease_pool, lease);
+}
 
-        // Terminate connection
-        close(client->socket);
+//////////////////////////////////////////////////////////////////////////////
+/// Take over a detached session named by a request of a new connection.
+/// The stream goes on where it was; a unicast client which came back from
+/// another address is moved in the reflector. Unknown sessions and sessions
+/// held by another connection are left alone (the request gets 454).
+///
+/// \param worker The worker owning the connection.
+/// \param client The client structure (without a session).
+/// \param session_hdr Session ID of the request.
+//////////////////////////////////////////////////////////////////////////////
+static void adopt_session(RTSP_Worker *worker, RTSP_Client *client,
+                          const char *session_hdr){
+    RTSP_Server *srv = worker->srv;
+    RTSP_Session_Info info;                 // the adopted session
+    gboolean listed;                        // the reflector has the client
+    uint64_t id;
+
+    if(srv->lease <= 0 || sessid_parse(session_hdr, &id) != 0
+       || (id & (MAX_WORKERS - 1)) >= (uint64_t) srv->worker_count
+       || !session_adopt(session_shard(worker, id), id, &info))
+        return;
 
-        // Clean-up client data
-        g_free(client->clientaddr);
-        if(client->req != NULL) g_free(client->req);
-        g_free(client);
+    client->session = id;
+    sessid_format(id, client->sessionID);
+    client->listener_id = info.listener_id;
+    client->transport = info.transport;
+    client->dest = info.dest;
+    client->paused = info.paused;
+    listed = info.playing || info.paused;
+
+    switch(client->transport.delivery){
+        case TRANSPORT_INTERLEAVED:
+            if(info.playing) interleave_start(worker, client);
+            break;
+        case TRANSPORT_MULTICAST:
+            if(listed) group_join(worker, client);
+            break;
+        default:
+            client->dest.SIN_ADDR = client->clientaddr->SIN_ADDR;
+            if(listed && ip_cmp(&info.dest.SIN_ADDR, &client->dest.SIN_ADDR) != 0){
+                queue_rap_msg(worker, RAP_CLIENTS_REMOVE, info.listener_id,
+                              &info.dest, NULL);
+                queue_rap_msg(worker, RAP_CLIENTS_ADD, client->listener_id,
+                              &client->dest, NULL);
+                if(info.paused)
+                    queue_rap_msg(worker, RAP_CLIENTS_PAUSE, client->listener_id,
+                                  &client->dest, NULL);
+            }
     }
 
-    // Clean-up timer data
-    g_free(to_data);
+    client->playing = info.playing;
+    if(client->playing) wheel_cancel(&worker->idle, &client->idle);
+    client_playing(worker, client, client->playing);
+    worker->stats.adopted++;
+
+    logm(&worker->module->id, LOG_INFO, "Session %s adopted by a new "
+         "connection", client->sessionID);
 }
 
 //////////////////////////////////////////////////////////////////////////////
-/// Message processing function launched from \a accept_connection after READ
-/// event occured.
+/// Terminate the connection - stop all the watchers, close the socket,
+/// remove the client from the session table and the reflector. This is the
+/// only way out of every state; the client is freed by \a reclaim once the
+/// callbacks of the current loop iteration are done, so the caller (and any
+/// other callback of this iteration) may still look at it. Closing a closed
+/// client does nothing.
 ///
-/// \param loop Event loop structure (main loop).
-/// \param w The watcher structure calling process (after a READ event).
-/// \param revents Event flags for current event.
+/// \param worker The worker owning the connection.
+/// \param client The client structure.
+/// \param reason Why the connection ends (logs), NULL if it ends normally.
 //////////////////////////////////////////////////////////////////////////////
-static void process(struct ev_loop *loop, struct ev_io *w, int revents){
+static void client_close(RTSP_Worker *worker, RTSP_Client *client,
+                         const char *reason){
+    struct module *module = worker->module;
+    struct ev_loop *loop = worker->loop;
+    char clnt_straddr[ADDRSTR_LEN];
+    gboolean hashtableret = FALSE;
 
-    // Something is very wrong!
-    if(w == NULL) return;
-    
-    char msg[MAX_MSG];                          // input message buffer
-    int headers_length,request_line_length;     // for parser retvals
-    char *session_hdr = NULL;                   // client session ID (from msg)
-    gboolean hashtableret;                      // hashtable remove retval
-    char clnt_straddr[ADDRSTR_LEN];             // client address as c_str
-    int req_err = FALSE;                        // processing error
-    struct module *module;                      // module structure
-    RTSP_Server *srv;                           // server structure
-    RTSP_Client *client;                        // client structure
+    if(client->state == CLIENT_CLOSED) return;
 
-    // Get data from watcher
-    module = (struct module *)w->data;
-    srv = module_data(module, RTSP_Server);
+    // Stop READ/WRITE watchers and timer
+    ev_io_stop(loop, &client->ev_read);
+    ev_io_stop(loop, &client->ev_write);
+    wheel_cancel(&worker->idle, &client->idle);
+
+    // Terminate connection
+    close(client->socket);
+
+    // Remove client from client list - unless the session outlives the
+    // connection (the reflector keeps the client until the lease expires)
+    if(client->sessionID[0] != '\0' && !lease_session(worker, client)){
+        hashtableret = session_remove(session_shard(worker, client->session),
+                                      client->session);
+
+        // Send RAP to remove this client (only unicast ones which played
+        // are there)
+        if(client->transport.delivery == TRANSPORT_UNICAST
+           && (client->playing || client->paused))
+            queue_rap_msg(worker, RAP_CLIENTS_REMOVE, client->listener_id,
+                          &client->dest, NULL);
+    }
+    group_leave(worker, client);
+
+    // Responses and frames will never be sent
+    release_output(&client->out);
+    interleave_stop(worker, client);
+    frames_clean(&client->frames);
+
+    // Do not wait for the reflector any more
+    if(client->rap != NULL){
+        client->rap->clients = g_slist_remove(client->rap->clients, client);
+        client->rap = NULL;
+    }
+
+    inet_ntop(AF_INET46, &(client->clientaddr->SIN_ADDR), clnt_straddr,
+              sizeof(clnt_straddr));
+
+    logm(&module->id, LOG_INFO, "Connection to %s:%d terminated%s%s%s",
+         clnt_straddr, ntohs(client->clientaddr->SIN_PORT),
+         reason != NULL ? " - " : "", reason != NULL ? reason : "",
+         hashtableret ? " (client removed from the client list)" : "");
+
+    // Free the structure after this loop iteration
+    client->state = CLIENT_CLOSED;
+    client->closed = worker->closed;
+    worker->closed = client;
+    if(!ev_is_active(&worker->ev_reclaim))
+        ev_check_start(loop, &worker->ev_reclaim);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Free the clients closed in the previous loop iteration (their watchers
+/// are stopped, so no event can refer to them any more).
+///
+/// \param loop The worker loop.
+/// \param w The check watcher (worker data).
+/// \param revents Flags for this event.
+//////////////////////////////////////////////////////////////////////////////
+static void reclaim(struct ev_loop *loop, struct ev_check *w, int revents){
+    RTSP_Worker *worker = (RTSP_Worker *) w->data;
+    RTSP_Client *client;
+
+    UNUSED(revents);
+
+    while((client = worker->closed) != NULL){
+        worker->closed = client->closed;
+        pool_free(&worker->clients, client);
+    }
+
+    ev_check_stop(loop, w);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Start interleaved delivery to a client (PLAY) - packets of its listener
+/// are queued in its frame ring from now on.
+///
+/// \param worker The worker owning the connection.
+/// \param client The client structure.
+//////////////////////////////////////////////////////////////////////////////
+static void interleave_start(RTSP_Worker *worker, RTSP_Client *client){
+    if(client->link.data != NULL) return;
+
+    if(client->frames.frames == NULL)
+        frames_init(&client->frames, worker->srv->frame_queue,
+                    client->transport.channel);
+
+    client->link.data = client;
+    g_queue_push_tail_link(&worker->interleaved, &client->link);
+    g_atomic_int_inc(&worker->interleaved_count);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Stop interleaved delivery to a client. Queued frames are dropped, except
+/// a frame sent partially (the connection would be out of sync).
+///
+/// \param worker The worker owning the connection.
+/// \param client The client structure.
+//////////////////////////////////////////////////////////////////////////////
+static void interleave_stop(RTSP_Worker *worker, RTSP_Client *client){
+    if(client->link.data == NULL) return;
+
+    g_queue_unlink(&worker->interleaved, &client->link);
+    client->link.data = NULL;
+    g_atomic_int_add(&worker->interleaved_count, -1);
+
+    frames_drop(&client->frames);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Mark the session of a client as playing (or paused) in the session table.
+///
+/// \param worker The worker owning the connection.
+/// \param client The client structure.
+/// \param playing The stream is being sent to the client.
+//////////////////////////////////////////////////////////////////////////////
+static void client_playing(RTSP_Worker *worker, RTSP_Client *client,
+                           gboolean playing){
+    RTSP_Session_Info info;                 // session table entry
+
+    memset(&info, 0, sizeof(info));
+    info.addr = *client->clientaddr;
+    info.listener_id = client->listener_id;
+    info.transport = client->transport;
+    info.dest = client->dest;
+    info.playing = playing;
+    info.paused = client->paused;
+    session_set(session_shard(worker, client->session), client->session, &info);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Start (or resume) the stream of a client (PLAY of its session). Only a
+/// new unicast client waits for the reflector, the others are answered at
+/// once; a paused unicast client is just unmasked in the reflector.
+///
+/// \param worker The worker owning the connection.
+/// \param client The client structure.
+/// \param session_hdr Session ID of the request.
+//////////////////////////////////////////////////////////////////////////////
+static void play_client(RTSP_Worker *worker, RTSP_Client *client,
+                        char *session_hdr){
+    if(client->playing){
+        set_response(client, PLAY_OK, session_hdr);
+        return;
+    }
+
+    switch(client->transport.delivery){
+        case TRANSPORT_INTERLEAVED:
+            // Frames go over this connection, the reflector does not need
+            // to know the client
+            interleave_start(worker, client);
+            break;
+        case TRANSPORT_MULTICAST:
+            // The group is registered by the first worker, the viewer need
+            // not wait for it (a paused viewer has not left it)
+            group_join(worker, client);
+            break;
+        default:
+            if(client->paused){
+                if(queue_rap_msg(worker, RAP_CLIENTS_RESUME, client->listener_id,
+                                 &client->dest, NULL) != 0){
+                    set_response(client, INTERNAL_ERROR, session_hdr);
+                    return;
+                }
+                break;
+            }
+
+            // Client is listening once the reflector adds it, PLAY is
+            // answered when the RAP reply comes
+            if(queue_rap_msg(worker, RAP_CLIENTS_ADD, client->listener_id,
+                             &client->dest, client) != 0){
+                set_response(client, INTERNAL_ERROR, session_hdr);
+                return;
+            }
+            client->playing = TRUE;
+            wheel_cancel(&worker->idle, &client->idle);
+            return;
+    }
+
+    client->playing = TRUE;
+    client->paused = FALSE;
+    client_playing(worker, client, TRUE);
+    wheel_cancel(&worker->idle, &client->idle);
+    set_response(client, PLAY_OK, session_hdr);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Pause the stream of a client (PAUSE of its session). The client is kept
+/// everywhere it is registered - a unicast client is masked in the
+/// reflector, an interleaved one stops getting frames, a multicast viewer
+/// stays in the group (the group is shared). The paused session times out
+/// unless the client keeps it alive.
+///
+/// \param worker The worker owning the connection.
+/// \param client The client structure.
+//////////////////////////////////////////////////////////////////////////////
+static void pause_client(RTSP_Worker *worker, RTSP_Client *client){
+    // Nothing plays yet (or any more)
+    if(!client->playing) return;
+
+    switch(client->transport.delivery){
+        case TRANSPORT_INTERLEAVED:
+            interleave_stop(worker, client);
+            break;
+        case TRANSPORT_MULTICAST:
+            break;
+        default:
+            queue_rap_msg(worker, RAP_CLIENTS_PAUSE, client->listener_id,
+                          &client->dest, NULL);
+    }
+
+    client->playing = FALSE;
+    client->paused = TRUE;
+    client_playing(worker, client, FALSE);
+    wheel_arm(&worker->idle, &client->idle, ev_now(worker->loop), TIMEOUT);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Add a viewer to the multicast group of its stream (PLAY). The first
+/// viewer makes the first worker register the group with the reflector.
+///
+/// \param worker The worker owning the connection.
+/// \param client The client structure (multicast transport).
+//////////////////////////////////////////////////////////////////////////////
+static void group_join(RTSP_Worker *worker, RTSP_Client *client){
+    RTSP_Server *srv = worker->srv;
+    RTSP_Group key;                         // listener and group (lookup)
+    RTSP_Group *group;
+    gboolean first;
+
+    if(client->group != NULL) return;
+
+    key.listener_id = client->listener_id != NULL ? client->listener_id
+                                                  : srv->listener_id;
+    key.addr = client->dest;
+
+    pthread_mutex_lock(&srv->groups_lock);
+    if((group = g_hash_table_lookup(srv->groups, &key)) == NULL){
+        group = g_new0(RTSP_Group, 1);
+        group->listener_id = key.listener_id;
+        group->addr = key.addr;
+        g_hash_table_insert(srv->groups, group, group);
+    }
+    first = (group->viewers++ == 0);
+    pthread_mutex_unlock(&srv->groups_lock);
+
+    client->group = group;
+    if(first) groups_notify(worker);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Remove a viewer from its multicast group (TEARDOWN, connection closed).
+/// The last viewer makes the first worker remove the group.
+///
+/// \param worker The worker owning the connection.
+/// \param client The client structure (does nothing if it views no group).
+//////////////////////////////////////////////////////////////////////////////
+static void group_leave(RTSP_Worker *worker, RTSP_Client *client){
+    if(client->group == NULL) return;
+
+    group_release(worker, client->group);
+    client->group = NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Drop one viewer (or lease) of a multicast group.
+///
+/// \param worker The calling worker.
+/// \param group The group.
+//////////////////////////////////////////////////////////////////////////////
+static void group_release(RTSP_Worker *worker, RTSP_Group *group){
+    RTSP_Server *srv = worker->srv;
+    gboolean last;
+
+    pthread_mutex_lock(&srv->groups_lock);
+    last = (--group->viewers == 0);
+    pthread_mutex_unlock(&srv->groups_lock);
+
+    if(last) groups_notify(worker);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Let the first worker bring the reflector's groups up to date (at once if
+/// called by the first worker).
+///
+/// \param worker The calling worker.
+//////////////////////////////////////////////////////////////////////////////
+static void groups_notify(RTSP_Worker *worker){
+    RTSP_Worker *first = &worker->srv->workers[0];
+
+    if(worker == first)
+        groups_sync(worker);
+    else
+        ev_async_send(first->loop, &worker->srv->ev_groups);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Groups changed by the other workers (\a groups_notify).
+///
+/// \param loop The loop of the first worker.
+/// \param w The async watcher (worker data).
+/// \param revents Flags for this event.
+//////////////////////////////////////////////////////////////////////////////
+static void groups_wake(struct ev_loop *loop, struct ev_async *w, int revents){
+    UNUSED(loop);
+    UNUSED(revents);
+
+    groups_sync((RTSP_Worker *) w->data);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Register the groups which got viewers and remove the groups which lost
+/// them (first worker only, its RAP channel carries all the group updates).
+/// Groups without viewers are forgotten.
+///
+/// \param worker The first worker.
+//////////////////////////////////////////////////////////////////////////////
+static void groups_sync(RTSP_Worker *worker){
+    RTSP_Server *srv = worker->srv;
+    RTSP_Group *group;
+    GHashTableIter iter;
+
+    pthread_mutex_lock(&srv->groups_lock);
+    g_hash_table_iter_init(&iter, srv->groups);
+    while(g_hash_table_iter_next(&iter, (gpointer *) &group, NULL)){
+        if(group->viewers > 0 && !group->registered){
+            if(queue_rap_msg(worker, RAP_CLIENTS_ADD, group->listener_id,
+                             &group->addr, NULL) == 0)
+                group->registered = TRUE;
+            else
+                logerror(worker->module->id.mclass, worker->module->id.name,
+                         LOG_ERROR, worker->module->errctx,
+                         "Failed to register a multicast group (no RAP)");
+        }
+        else if(group->viewers == 0){
+            if(group->registered)
+                queue_rap_msg(worker, RAP_CLIENTS_REMOVE, group->listener_id,
+                              &group->addr, NULL);
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+    pthread_mutex_unlock(&srv->groups_lock);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Hash of a multicast group - the listener, the group and the port.
+///
+/// \param key The group (RTSP_Group).
+/// \return The hash.
+//////////////////////////////////////////////////////////////////////////////
+static guint group_hash(gconstpointer key){
+    const RTSP_Group *group = (const RTSP_Group *) key;
+
+    return g_direct_hash(group->listener_id)
+           ^ ((group->addr.SIN_ADDR.s_addr ^ group->addr.SIN_PORT) * 2654435761u);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Compare two multicast groups (listener IDs are interned).
+///
+/// \param a The first group (RTSP_Group).
+/// \param b The second group (RTSP_Group).
+/// \return TRUE if they are the same group of the same listener.
+//////////////////////////////////////////////////////////////////////////////
+static gboolean group_equal(gconstpointer a, gconstpointer b){
+    const RTSP_Group *x = (const RTSP_Group *) a;
+    const RTSP_Group *y = (const RTSP_Group *) b;
+
+    return x->listener_id == y->listener_id
+           && x->addr.SIN_ADDR.s_addr == y->addr.SIN_ADDR.s_addr
+           && x->addr.SIN_PORT == y->addr.SIN_PORT;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Distribute the packets pushed by the reflector (\a m_push_data) to the
+/// interleaved clients of their listeners. The clients get references, the
+/// packets are never copied.
+///
+/// \param loop The worker loop.
+/// \param w The async watcher (worker data).
+/// \param revents Flags for this event.
+//////////////////////////////////////////////////////////////////////////////
+static void feed_flush(struct ev_loop *loop, struct ev_async *w, int revents){
+    RTSP_Worker *worker = (RTSP_Worker *) w->data;
+    RTSP_Server *srv = worker->srv;
+    struct data *batch[FEED_SIZE];          // packets taken from the feed
+    struct data *data;                      // current packet
+    RTSP_Client *client;                    // interleaved client
+    GList *link, *next;
+    unsigned long dropped;                  // drops of the client's ring
+    guint count = 0;
+    guint i;
+
+    UNUSED(loop);
+    UNUSED(revents);
+
+    pthread_mutex_lock(&worker->feed_lock);
+    while(worker->feed_head != worker->feed_tail)
+        batch[count++] = worker->feed[worker->feed_head++ & (FEED_SIZE - 1)];
+    pthread_mutex_unlock(&worker->feed_lock);
+
+    for(i = 0; i < count; i++){
+        data = batch[i];
+
+        for(link = worker->interleaved.head; link != NULL; link = next){
+            next = link->next;
+            client = (RTSP_Client *) link->data;
+
+            if(!listener_matches(client->listener_id != NULL
+                                 ? client->listener_id : srv->listener_id,
+                                 data->name))
+                continue;
+
+            dropped = client->frames.dropped;
+            if(!frames_push(&client->frames, data, srv->frame_policy)){
+                client_close(worker, client, "interleaved frames not read");
+                continue;
+            }
+            worker->stats.frames_dropped += client->frames.dropped - dropped;
+
+            start_write(worker, client);
+        }
+
+        data_free(data);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Does a packet come from a listener? Packets carry the name of the
+/// listener module, clients the listener ID (with or without the class,
+/// e.g. listener/udp-0.0.0.0:1234).
+///
+/// \param listener_id Listener of the client.
+/// \param name Name of the listener the packet comes from.
+/// \return TRUE if they are the same listener.
+//////////////////////////////////////////////////////////////////////////////
+static gboolean listener_matches(const char *listener_id, const char *name){
+    const char *slash;
+
+    if(strcmp(listener_id, name) == 0) return TRUE;
+
+    slash = strchr(listener_id, '/');
+
+    return slash != NULL && strcmp(slash + 1, name) == 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Message processing function launched from \a accept_connection after READ
+/// event occured. Received data are appended to the client's input buffer
+/// and all complete requests found there are processed.
+///
+/// \param loop Event loop structure (worker loop).
+/// \param w The watcher structure calling process (after a READ event).
+/// \param revents Event flags for current event.
+//////////////////////////////////////////////////////////////////////////////
+static void process(struct ev_loop *loop, struct ev_io *w, int revents){
+
+    // Something is very wrong!
+    if(w == NULL) return;
+    
+    ssize_t length;                             // bytes read
+    struct module *module;                      // module structure
+    RTSP_Worker *worker;                        // worker structure
+    RTSP_Client *client;                        // client structure
+    RTSP_In_Buffer *in;                         // client input buffer
+
+    // Get data from watcher
+    worker = (RTSP_Worker *)w->data;
+    module = worker->module;
     client = ((RTSP_Client *) (((char *)w)
                            - offsetof(RTSP_Client, ev_read)));
 
@@ -528,218 +1628,488 @@ static void process(struct ev_loop *loop, struct ev_io *w, int revents){
         return;
     }
 
-    // Read incoming msg from socket
+    in = &client->in;
+    length = 0;
+
+    // Read incoming data from socket
     if (revents & EV_READ){
-        memset(msg,'\0',sizeof(msg));
+        // End of the buffer reached, move unprocessed data to the beginning
+        if(in->tail == sizeof(in->data) && in->head > 0){
+            memmove(in->data, in->data + in->head, in->tail - in->head);
+            in->tail -= in->head;
+            in->scan -= in->head;
+            in->head = 0;
+        }
 
-        read(client->socket, msg, sizeof(msg) - 1);
+        length = read(client->socket, in->data + in->tail,
+                      sizeof(in->data) - in->tail);
 
-        // Reset timeout timer
-        ev_timer_again(loop, &client->timer);
-    }
+        // Nothing to read yet (spurious wakeup)
+        if(length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK
+                          || errno == EINTR))
+            return;
 
-    inet_ntop(AF_INET46, &(client->clientaddr->SIN_ADDR),
-              clnt_straddr,sizeof(clnt_straddr));
+        if(length > 0){
+            in->tail += length;
+
+            // Reset timeout timer
+            wheel_arm(&worker->idle, &client->idle, ev_now(loop), TIMEOUT);
+        }
+    }
 
     // Could not read message from socket buffer
-    if(msg == NULL || strlen(msg) == 0){
+    if(length <= 0){
         logm(&module->id, LOG_INFO, "Unable to read incoming message (wrong "
              "format or connection closed)");
 
-        // Stop READ watcher
-        ev_io_stop(EV_A_ w);
-
         // Clean-up and terminate
-        if(client != NULL){
-            close(client->socket);
+        client_close(worker, client, NULL);
+        return;
+    }
 
-            logm(&module->id, LOG_INFO, "Connection to %s:%d terminated",
-                 clnt_straddr, ntohs(client->clientaddr->SIN_PORT));
+    process_buffer(worker, client);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Process all complete requests waiting in the client's input buffer
+/// (pipelined requests are answered in one go). Processing stops when the
+/// output buffer cannot take another response, the READ watcher is stopped
+/// until \a send_msg makes room again.
+///
+/// \param worker The worker owning the connection.
+/// \param client The client structure (input and output buffers).
+//////////////////////////////////////////////////////////////////////////////
+static void process_buffer(RTSP_Worker *worker, RTSP_Client *client){
+    RTSP_In_Buffer *in = &client->in;   // client input buffer
+    struct module *module;              // module structure
+    struct ev_loop *loop;               // worker loop
+    size_t length;                      // length of the next request
+    const char *msg;                    // the next request
+    gboolean full;                      // no room for another response
 
-            // Remove client from client list
-            if(client->sessionID != NULL){
-                pthread_mutex_lock(&srv->srv_mutex);
-                g_hash_table_remove(srv->client_list,client->sessionID);
-                pthread_mutex_unlock(&srv->srv_mutex);
+    module = worker->module;
+    loop = worker->loop;
 
-                // Send RAP to remove this client
-                RAP_Msg_data *rap_msg_data = (RAP_Msg_data *) g_malloc0(sizeof(RAP_Msg_data));
+    for(;;){
+        full = (client->out.responses == MAX_PIPELINE);
+        if(client->state == CLIENT_DRAINING || full || client->rap != NULL)
+            break;
 
-                rap_msg_data->ip = (char *) g_malloc0(sizeof(clnt_straddr));
-                strcpy(rap_msg_data->ip, clnt_straddr);
-                rap_msg_data->type = RAP_CLIENTS_REMOVE;
+        // Frames of the client (RTCP reports) are not requests
+        if(!skip_frames(in)) break;
 
-                send_rap_msg(module, rap_msg_data);
+        // Is there a complete request (headers)?
+        if((length = find_request(in)) != 0){
+            msg = in->data + in->head;
+            parse_request(&client->req, msg, length);
 
-                g_free(client->sessionID);
-            }
+            // Wait for the message body
+            length += client->req.content_length;
+        }
 
-            g_free(client->clientaddr);
-            ev_timer_stop(loop, &client->timer);
-            g_free(client->timer.data);
-            g_free(client);
+        // Request does not fit into the buffer
+        if(length > sizeof(in->data)
+           || (length == 0 && in->head == 0 && in->tail == sizeof(in->data))){
+            logm(&module->id, LOG_INFO, "Received request is too long");
+            set_response(client, BAD_REQUEST, NULL);
+            client->state = CLIENT_DRAINING;
+            break;
         }
 
+        if(length == 0 || in->tail - in->head < length) break;
+
+        handle_request(worker, client);
+
+        in->head += length;
+        in->scan = in->head;
+    }
+
+    // Everything processed, start from the beginning of the buffer
+    if(in->head == in->tail) in->head = in->tail = in->scan = 0;
+
+    // Is this the end, is the output full or does a request wait for the
+    // reflector? Stop the READ watcher
+    if(client->state == CLIENT_DRAINING || full || client->rap != NULL)
+        ev_io_stop(loop, &client->ev_read);
+    else if(!ev_is_active(&client->ev_read)) ev_io_start(loop, &client->ev_read);
+
+    // Nothing to send
+    if(client->out.first == client->out.count){
+        if(client->state == CLIENT_DRAINING)
+            client_close(worker, client, NULL);
         return;
     }
 
-    // Allocate memory for request data structure
-    client->req = g_malloc0(sizeof(RTSP_Request));
+    // Start the WRITE watcher
+    if(client->state == CLIENT_READING) client->state = CLIENT_WRITING;
+    start_write(worker, client);
+}
 
-    // Allocation failed - clean-up and terminate
-    if(client->req == NULL){
-        logerror(module->id.mclass, module->id.name, LOG_ERROR,
-                 module->errctx, "Memory allocation failure - connection closed");
+//////////////////////////////////////////////////////////////////////////////
+/// Start the WRITE watcher of a client (if it is not running already).
+///
+/// \param worker The worker owning the connection.
+/// \param client The client structure.
+//////////////////////////////////////////////////////////////////////////////
+static void start_write(RTSP_Worker *worker, RTSP_Client *client){
+    if(ev_is_active(&client->ev_write)) return;
 
-        ev_io_stop(EV_A_ w);
+    client->ev_write.data = worker;
+    ev_io_init(&client->ev_write,send_msg,client->socket,EV_WRITE);
+    ev_io_start(worker->loop,&client->ev_write);
+}
 
-        close(client->socket);
+//////////////////////////////////////////////////////////////////////////////
+/// Skip interleaved frames ('$', channel, length) at the beginning of the
+/// input buffer. A frame may be longer than the buffer, the rest of it is
+/// skipped as it arrives.
+///
+/// \param in The input buffer.
+/// \return TRUE if a request may follow, FALSE if the rest of a frame (or
+///         of its header) has not been received yet.
+//////////////////////////////////////////////////////////////////////////////
+static gboolean skip_frames(RTSP_In_Buffer *in){
+    const unsigned char *header;
+    size_t length;
+
+    for(;;){
+        if(in->skip > 0){
+            length = MIN(in->skip, in->tail - in->head);
+            in->head += length;
+            in->skip -= length;
+            if(in->skip > 0) return FALSE;
+        }
 
-        // Remove client from client list
-        if(client->sessionID != NULL){
-            pthread_mutex_lock(&srv->srv_mutex);
-            g_hash_table_remove(srv->client_list,client->sessionID);
-            pthread_mutex_unlock(&srv->srv_mutex);
+        if(in->head == in->tail || in->data[in->head] != '$') break;
+        if(in->tail - in->head < FRAME_HEADER) return FALSE;
 
-            // Send RAP to remove this client
-            RAP_Msg_data *rap_msg_data = (RAP_Msg_data *) g_malloc0(sizeof(RAP_Msg_data));
+        header = (const unsigned char *) in->data + in->head;
+        in->skip = FRAME_HEADER + ((size_t) header[2] << 8 | header[3]);
+    }
 
-            rap_msg_data->ip = (char *) g_malloc0(sizeof(clnt_straddr));
-            strcpy(rap_msg_data->ip, clnt_straddr);
-            rap_msg_data->type = RAP_CLIENTS_REMOVE;
+    if(in->scan < in->head) in->scan = in->head;
 
-            send_rap_msg(module, rap_msg_data);
+    return TRUE;
+}
 
-            g_free(client->sessionID);
-        }
+//////////////////////////////////////////////////////////////////////////////
+/// Look for the end of the first request in the input buffer (\a msg_end).
+/// The search continues where the previous one ended, so every received
+/// byte is scanned only once.
+///
+/// \param in The input buffer.
+/// \return Length of the first request (zero if it is not complete yet).
+//////////////////////////////////////////////////////////////////////////////
+static size_t find_request(RTSP_In_Buffer *in){
+    const size_t end_len = sizeof(msg_end) - 1;
+    char *end;
 
-        g_free(client->clientaddr);
-        ev_timer_stop(loop, &client->timer);
-        g_free(client->timer.data);
-        g_free(client);
+    // Skip empty lines between requests
+    while(in->head < in->tail
+          && (in->data[in->head] == '\r' || in->data[in->head] == '\n'))
+        in->head++;
 
-        return;
+    if(in->scan < in->head) in->scan = in->head;
+
+    end = memmem(in->data + in->scan, in->tail - in->scan, msg_end, end_len);
+
+    if(end == NULL){
+        // The end could be split between this and the next read
+        if(in->tail - in->head >= end_len) in->scan = in->tail - end_len + 1;
+        return 0;
     }
 
-    // Log request origin
-    logm(&module->id, LOG_INFO,"Processing RTSP request/message from %s:%d",
-        clnt_straddr, ntohs(client->clientaddr->SIN_PORT));
+    return (end + end_len) - (in->data + in->head);
+}
 
-    // Reset the request data structure
-    memset(client->req,'\0',sizeof(RTSP_Request));
+//////////////////////////////////////////////////////////////////////////////
+/// Parse the request line and the headers of a request. Nothing is copied,
+/// the request structure only describes where everything is in \a msg.
+///
+/// \param req The target request structure.
+/// \param msg The request (points into the input buffer, not a c_str).
+/// \param length Length of the request line and headers (incl. \a msg_end).
+/// \return TRUE if the request line is valid, FALSE otherwise.
+//////////////////////////////////////////////////////////////////////////////
+static gboolean parse_request(RTSP_Request *req, const char *msg,
+                              size_t length){
+    size_t request_line_length;     // for parser retval
+    const char *value;              // header value
+    size_t value_len;               // length of the header value
+    size_t i;
+
+    // Reset the request data structure (headers are overwritten)
+    req->method = req->object = req->version = NULL;
+    req->method_len = req->object_len = req->version_len = 0;
+    req->method_id = RTSP_ID_ERROR;
+    req->hdrs = NULL;
+    req->hdr_count = 0;
+    req->content_length = 0;
+    memset(req->known, '\0', sizeof(req->known));
 
     // Preliminary request check
-    request_line_length = ragel_parse_request_line(msg, strlen(msg), client->req);
+    request_line_length = ragel_parse_request_line(msg, length, req);
+
+    if(request_line_length == 0 || req->method == NULL || req->version == NULL)
+        return FALSE;
 
+    // Parse the rest of RTSP headers
+    req->hdrs = msg + request_line_length;
+    if(eris_parse_headers_slices(req->hdrs, length - request_line_length,
+                                 req->hdr, ERIS_MAX_HEADERS,
+                                 &req->hdr_count) == 0)
+        req->hdr_count = 0;
+
+    // Index well-known headers (the last one wins)
+    for(i = 0; i < req->hdr_count; i++)
+        if(req->hdr[i].id != ERIS_HDR_OTHER)
+            req->known[req->hdr[i].id] = i + 1;
+
+    // Length of the message body
+    if((value = request_header(req, ERIS_HDR_CONTENT_LENGTH, &value_len)) != NULL)
+        req->content_length = parse_number(value, value_len, MAX_MSG + 1);
+
+    return TRUE;
+}
 
-    // Parser did not recognize RTSP protocol, stop timer and set req_err
-    if(client->req->version == NULL || client->req->method == NULL){
+//////////////////////////////////////////////////////////////////////////////
+/// Get the value of a well-known header of the parsed request.
+///
+/// \param req The parsed request.
+/// \param id The header identifier.
+/// \param len Where to store length of the value.
+/// \return Pointer to the value (not a c_str), NULL if there is no such header.
+//////////////////////////////////////////////////////////////////////////////
+static const char *request_header(const RTSP_Request *req, eris_header_id id,
+                                  size_t *len){
+    const eris_header_slice *hdr;
+
+    if(id >= ERIS_HDR_OTHER || req->known[id] == 0) return NULL;
+
+    hdr = &req->hdr[req->known[id] - 1];
+    *len = hdr->value_length;
+
+    return req->hdrs + hdr->value_offset;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Parse a decimal number at the beginning of a string (not a c_str).
+///
+/// \param str The string.
+/// \param len Length of the string.
+/// \param max The result is limited to this value.
+/// \return The number, zero if the string does not start with a digit.
+//////////////////////////////////////////////////////////////////////////////
+static size_t parse_number(const char *str, size_t len, size_t max){
+    size_t number = 0;
+    size_t i;
+
+    for(i = 0; i < len && str[i] >= '0' && str[i] <= '9'; i++){
+        number = number * 10 + (str[i] - '0');
+        if(number >= max) return max;
+    }
+
+    return number;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Process one complete (parsed) request and append the response to the
+/// client's output buffer.
+///
+/// \param worker The worker owning the connection.
+/// \param client The client structure (with the parsed request).
+//////////////////////////////////////////////////////////////////////////////
+static void handle_request(RTSP_Worker *worker, RTSP_Client *client){
+    char session_buf[SESSION_HDR_MAX];          // client session ID (c_str)
+    char *session_hdr = NULL;                   // client session ID (from msg)
+    const char *hdr;                            // header value (from msg)
+    size_t hdr_len;                             // length of the header value
+    gboolean hashtableret;                      // session remove retval
+    char clnt_straddr[ADDRSTR_LEN];             // client address as c_str
+    int req_err = FALSE;                        // processing error
+    struct module *module;                      // module structure
+    RTSP_Request *req = &client->req;           // the parsed request
+    const char *listener_id;                    // listener of the stream
+    RTSP_Transport transport;                   // transport of the client
+    RTSP_Transport multicast;                   // multicast of the stream
+    size_t i;
+
+    module = worker->module;
+
+    inet_ntop(AF_INET46, &(client->clientaddr->SIN_ADDR),
+              clnt_straddr,sizeof(clnt_straddr));
+
+    // Log request origin
+    logm(&module->id, LOG_INFO,"Processing RTSP request/message from %s:%d",
+        clnt_straddr, ntohs(client->clientaddr->SIN_PORT));
+
+    // Parser did not recognize RTSP protocol, set req_err
+    if(req->version == NULL || req->method == NULL){
         logm(&module->id, LOG_INFO, "Received request is invalid (parser)");
-        ev_timer_stop(loop, &client->timer);
         req_err = TRUE;
     }
 
     // Everything is ok, RTSP ver. is 1.0
-    if( !req_err && strcmp(client->req->version,"RTSP/1.0") == 0){
+    if( !req_err && req->version_len == sizeof("RTSP/1.0") - 1
+        && memcmp(req->version, "RTSP/1.0", req->version_len) == 0){
 
         // RTSP request info - version and method
-        logm(&module->id, LOG_INFO, "Request: %s from %s:%d",
-             client->req->method, clnt_straddr,
+        logm(&module->id, LOG_INFO, "Request: %.*s from %s:%d",
+             (int) req->method_len, req->method, clnt_straddr,
              ntohs(client->clientaddr->SIN_PORT));
 
-        // Parse the rest of RTSP headers
-        headers_length = eris_parse_headers(msg + request_line_length,
-                                            strlen(msg) - request_line_length,
-                                            &client->req->headers);
-
         // No headers, set response and skip the rest
-        if(headers_length == 0 || client->req->headers == NULL){
+        if(req->hdr_count == 0){
             set_response(client, BAD_REQUEST, session_hdr);
-            ev_timer_stop(loop, &client->timer);
-            client->stop = TRUE;
+            client->state = CLIENT_DRAINING;
         }
         else{
 
             // Get CSeq value from headers
-            client->msg_cseq = atoi(g_hash_table_lookup(client->req->headers,
-                                                        eris_hdr_cseq));
+            hdr = request_header(req, ERIS_HDR_CSEQ, &hdr_len);
+            client->msg_cseq = (hdr != NULL)
+                               ? (int) parse_number(hdr, hdr_len, G_MAXINT) : 0;
 
             // Check CSeq existence (VLC problems)
             if(client->msg_cseq <= 0){
                 // Basic cseq check - something is wrong
                 set_response(client,BAD_REQUEST,session_hdr);
-                ev_timer_stop(loop, &client->timer);
-                client->stop = TRUE;
+                client->state = CLIENT_DRAINING;
             }
             else{
 
-                // Get session ID from headers
-                session_hdr = g_hash_table_lookup(client->req->headers,
-                                                  eris_hdr_session);
+                // Get session ID from headers (without parameters)
+                hdr = request_header(req, ERIS_HDR_SESSION, &hdr_len);
+                if(hdr != NULL){
+                    for(i = 0; i < hdr_len && hdr[i] != ';'; i++);
+                    if(i < sizeof(session_buf)){
+                        memcpy(session_buf, hdr, i);
+                        session_buf[i] = '\0';
+                        session_hdr = session_buf;
+                    }
+                }
+
+                // A session of a closed connection goes on in this one
+                if(session_hdr != NULL && client->sessionID[0] == '\0')
+                    adopt_session(worker, client, session_hdr);
 
                 // Select method handler
-                switch(client->req->method_id){
+                switch(req->method_id){
                     case RTSP_ID_OPTIONS:
                         // Respond with server capabilities
                         set_response(client,OPTIONS_PUBLIC_OK,session_hdr);
                         break;
                     case RTSP_ID_DESCRIBE:
-                        // Send audio/video specs in SDP
-                        set_response(client,DESCRIBE_OK,session_hdr);
+                        // Send audio/video specs in SDP (of the stream)
+                        describe(worker, client, session_hdr);
                         break;
                     case RTSP_ID_SETUP:
-                        // Generate session id
-                        if(session_hdr == NULL){
-                            session_hdr = gen_sess_id(client);
+                        // A session named by the request must be the one
+                        // of the connection (or just adopted by it)
+                        if((session_hdr != NULL)
+                           && ((client->sessionID[0] == '\0')
+                               || (strcmp(session_hdr, client->sessionID) != 0))){
+                            set_response(client,SESSION_NOT_FOUND, session_hdr);
+                            break;
+                        }
+
+                        // Route the client to the listener of the stream
+                        if((listener_id = stream_listener(worker, req,
+                                                          &multicast)) == NULL){
+                            set_response(client, STREAM_NOT_FOUND, session_hdr);
+                            break;
+                        }
+
+                        // Choose the transport (clients without the header
+                        // get the default one)
+                        hdr = request_header(req, ERIS_HDR_TRANSPORT, &hdr_len);
+                        if(hdr == NULL)
+                            transport = transport_default;
+                        else if(!transport_parse(hdr, hdr_len, TRANSPORT_UNICAST
+                                                 | TRANSPORT_INTERLEAVED
+                                                 | multicast.delivery,
+                                                 &transport)){
+                            logm(&module->id, LOG_INFO, "Unsupported transport "
+                                 "%.*s from %s:%d", (int) hdr_len, hdr,
+                                 clnt_straddr,
+                                 ntohs(client->clientaddr->SIN_PORT));
+                            set_response(client, UNSUPPORTED_TRANSPORT,
+                                         session_hdr);
+                            break;
+                        }
+
+                        // Multicast viewers share the group of the stream
+                        if(transport.delivery == TRANSPORT_MULTICAST){
+                            multicast.profile = transport.profile;
+                            transport = multicast;
+                        }
+
+                        // The session keeps the transport it was set up with
+                        if(client->sessionID[0] == '\0'){
+                            client->transport = transport;
+                            if(transport.delivery == TRANSPORT_MULTICAST)
+                                client->dest.SIN_ADDR = transport.destination;
+                            client->dest.SIN_PORT = htons(transport.client_port);
+                        }
+
+                        // Generate session id (a connection keeps the one
+                        // it has, a second ID would orphan the first one)
+                        if(session_hdr == NULL && client->sessionID[0] != '\0')
+                            session_hdr = client->sessionID;
+                        else if(session_hdr == NULL){
+                            client->listener_id = listener_id;
+                            gen_sess_id(worker, client);
+                            session_hdr = client->sessionID;
 
                             logm(&module->id, LOG_INFO, "New RTSP session ID "
                                  "for %s:%d is %s", clnt_straddr,
                                  ntohs(client->clientaddr->SIN_PORT),
                                  session_hdr);
-
-                            // Remember ID, basic security feature
-                            client->sessionID = g_strdup(session_hdr);
                         }
 
-                        set_response(client,SETUP_OK,session_hdr);
+                        set_response(client, client->transport.delivery
+                                             == TRANSPORT_INTERLEAVED
+                                             ? SETUP_INTERLEAVED_OK : SETUP_OK,
+                                     session_hdr);
 
                         break;
                     case RTSP_ID_PLAY:
-                        // Test Sess ID and add client
-                        if((session_hdr != NULL) && (client->sessionID != NULL)
+                        // Test Sess ID and add (or resume) client
+                        if((session_hdr != NULL) && (client->sessionID[0] != '\0')
                             && (strcmp(session_hdr, client->sessionID) == 0)){
-                            
-                            // Client is now listening
-                            // Send RAP message to add this client
-                            RAP_Msg_data *rap_msg_data = (RAP_Msg_data *) g_malloc0(sizeof(RAP_Msg_data));
-                            
-                            rap_msg_data->ip = (char *) g_malloc0(sizeof(clnt_straddr));
-                            strcpy(rap_msg_data->ip, clnt_straddr);
-                            rap_msg_data->type = RAP_CLIENTS_ADD;
-
-                            send_rap_msg(module, rap_msg_data);
-
-                            // Prepare response and set timer
-                            set_response(client,PLAY_OK, session_hdr);
-
-                            ev_timer_stop(loop, &client->timer);
-
-                            // Register a new client
-                            pthread_mutex_lock(&srv->srv_mutex);
-                            g_hash_table_insert(srv->client_list,
-                                                g_strdup(session_hdr),
-                                                g_memdup(client->clientaddr,
-                                                sizeof(ADDR_TYPE)));
-                            pthread_mutex_unlock(&srv->srv_mutex);
+                            play_client(worker, client, session_hdr);
                         }
                         else{
                             set_response(client,SESSION_NOT_FOUND, session_hdr);
                         }
                         break;
+                    case RTSP_ID_PAUSE:
+                        // The client stays where it is, only the stream stops
+                        if((session_hdr != NULL) && (client->sessionID[0] != '\0')
+                            && (strcmp(session_hdr, client->sessionID) == 0)){
+                            pause_client(worker, client);
+                            set_response(client, PAUSE_OK, session_hdr);
+                        }
+                        else{
+                            set_response(client,SESSION_NOT_FOUND, session_hdr);
+                        }
+                        break;
+                    case RTSP_ID_GET_PARAMETERS:
+                        // Keepalive - reading the request has already
+                        // refreshed the timeout, no parameters are reported
+                        if((session_hdr != NULL) && (client->sessionID[0] != '\0')
+                            && (strcmp(session_hdr, client->sessionID) == 0))
+                            set_response(client, GET_PARAMETER_OK, session_hdr);
+                        else if((session_hdr == NULL) || (session_hdr[0] == '\0'
+                            && client->sessionID[0] == '\0'))
+                            set_response(client, GET_PARAMETER_NOSESSION_OK, NULL);
+                        else
+                            set_response(client,SESSION_NOT_FOUND, session_hdr);
+                        break;
                     case RTSP_ID_TEARDOWN:
                         // STOP requests will be described as RTSP_ID_TEARDOWN
-                        // End session, remove client info from the client_list
-                        if((session_hdr != NULL) && (client->sessionID != NULL)
+                        // End session, remove client info from the session table
+                        if((session_hdr != NULL) && (client->sessionID[0] != '\0')
                             && (strcmp(session_hdr, client->sessionID) == 0)){
 
                             set_response(client,TEARDOWN_OK, session_hdr);
@@ -748,28 +2118,31 @@ static void process(struct ev_loop *loop, struct ev_io *w, int revents){
                                  "Session with ID %s ended", session_hdr);
 
                             // Remove the client
-                            pthread_mutex_lock(&srv->srv_mutex);
-                            hashtableret = g_hash_table_remove(srv->client_list,
-                                                               session_hdr);
-                            pthread_mutex_unlock(&srv->srv_mutex);
+                            hashtableret = session_remove(
+                                    session_shard(worker, client->session),
+                                    client->session);
 
                             if(!hashtableret)
                                 logerror(module->id.mclass, module->id.name,
                                          LOG_ERROR, module->errctx,
                                          "Failed to remove a client from "
-                                         "client list (wrong session ID?)");
-                            ev_timer_stop(loop, &client->timer);
-
-                            // Send RAP to remove this client
-                            RAP_Msg_data *rap_msg_data = (RAP_Msg_data *) g_malloc0(sizeof(RAP_Msg_data));
-
-                            rap_msg_data->ip = (char *) g_malloc0(sizeof(clnt_straddr));
-                            strcpy(rap_msg_data->ip, clnt_straddr);
-                            rap_msg_data->type = RAP_CLIENTS_REMOVE;
-
-                            send_rap_msg(module, rap_msg_data);
-
-                            client->stop = TRUE;
+                                         "session table (wrong session ID?)");
+
+                            // Send RAP to remove this client (only once,
+                            // only if PLAY has added it)
+                            if(client->transport.delivery
+                               == TRANSPORT_INTERLEAVED)
+                                interleave_stop(worker, client);
+                            else if(client->transport.delivery
+                                    == TRANSPORT_MULTICAST)
+                                group_leave(worker, client);
+                            else if(client->playing || client->paused)
+                                queue_rap_msg(worker, RAP_CLIENTS_REMOVE,
+                                              client->listener_id,
+                                              &client->dest, NULL);
+                            client->sessionID[0] = '\0';
+
+                            client->state = CLIENT_DRAINING;
                         }
                         else{
                             set_response(client,SESSION_NOT_FOUND, session_hdr);
@@ -778,53 +2151,94 @@ static void process(struct ev_loop *loop, struct ev_io *w, int revents){
                     default:
                         // Send 501 Not Implemented message to the client
                         set_response(client,NOT_IMPLEMENTED, session_hdr);
-                        ev_timer_stop(loop, &client->timer);
-                        client->stop = TRUE;
+                        client->state = CLIENT_DRAINING;
                 }
             }
         }
     }
-    else{
-        // Send 400 Bad Request message to the client
-        logm(&module->id, LOG_INFO,
-             "Unknown request type/format (probably not RTSP/1.0)",
-             clnt_straddr, ntohs(client->clientaddr->SIN_PORT));
+    else{
+        // Send 400 Bad Request message to the client
+        logm(&module->id, LOG_INFO,
+             "Unknown request type/format (probably not RTSP/1.0) from %s:%d",
+             clnt_straddr, ntohs(client->clientaddr->SIN_PORT));
+
+        set_response(client,BAD_REQUEST,session_hdr);
+        client->state = CLIENT_DRAINING;
+    }
+
+    logm(&module->id, LOG_INFO,"Request from %s:%d processed",
+        clnt_straddr, ntohs(client->clientaddr->SIN_PORT));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Answer a DESCRIBE request with the prebuilt response of the requested
+/// stream (or the built-in SDP if there is no catalog). The response keeps
+/// the catalog alive until it is sent.
+///
+/// \param worker The worker owning the connection.
+/// \param client The client structure (with the parsed request).
+/// \param session_hdr Session ID of the request.
+//////////////////////////////////////////////////////////////////////////////
+static void describe(RTSP_Worker *worker, RTSP_Client *client,
+                     char *session_hdr){
+    RTSP_Catalog *catalog = worker_catalog(worker);
+    const RTSP_Stream *stream;              // the requested stream
+    RTSP_Out_Buffer *out = &client->out;    // client output segments
+    int slot = out->responses;              // slot of the response
+
+    if(catalog == NULL){
+        set_response(client, DESCRIBE_OK, session_hdr);
+        return;
+    }
 
-        set_response(client,BAD_REQUEST,session_hdr);
-        ev_timer_stop(loop, &client->timer);
-        client->stop = TRUE;
+    stream = catalog_lookup(catalog, client->req.object,
+                            client->req.object_len);
+    if(stream == NULL){
+        logm(&worker->module->id, LOG_INFO, "Stream %.*s not found",
+             (int) client->req.object_len, client->req.object);
+        set_response(client, STREAM_NOT_FOUND, session_hdr);
+        return;
     }
 
-    // Prepare data for response
-    client->ev_write.data = module;
+    if(queue_response(client, &stream->describe, session_hdr) == 0)
+        out->catalog[slot] = catalog_ref(catalog);
+}
 
-    // Is this the end? Stop the READ watcher
-    if(client->stop) ev_io_stop(EV_A_ w);
+//////////////////////////////////////////////////////////////////////////////
+/// Find the listener a SETUP request is routed to - the listener of the
+/// catalog stream the URL belongs to (the module's listener if there is no
+/// catalog).
+///
+/// \param worker The worker owning the connection.
+/// \param req The request.
+/// \param multicast Multicast transport of the stream (no delivery if the
+///                  stream has no group).
+/// \return Listener ID (interned) or NULL if the stream is unknown.
+//////////////////////////////////////////////////////////////////////////////
+static const char *stream_listener(RTSP_Worker *worker,
+                                   const RTSP_Request *req,
+                                   RTSP_Transport *multicast){
+    RTSP_Catalog *catalog = worker_catalog(worker);
+    const RTSP_Stream *stream;
 
-    // Start the WRITE watcher
-    ev_io_init(&client->ev_write,send_msg,client->socket,EV_WRITE);
-    ev_io_start(loop,&client->ev_write);
-    
-    logm(&module->id, LOG_INFO,"Request from %s:%d processed",
-        clnt_straddr, ntohs(client->clientaddr->SIN_PORT));
+    memset(multicast, 0, sizeof(*multicast));
 
-    // Clean-up request structure
-    g_free(client->req->method);
-    g_free(client->req->object);
-    g_free(client->req->version);
+    if(catalog == NULL) return worker->srv->listener_id;
 
-    if(client->req->headers != NULL) g_hash_table_destroy(client->req->headers);
+    stream = catalog_route(catalog, req->object, req->object_len);
+    if(stream == NULL) return NULL;
 
-    // Session_hdr has been freed in client->req->headers
-    g_free(client->req);
-    client->req = NULL;
+    *multicast = stream->multicast;
+
+    return stream->listener_id;
 }
 
 //////////////////////////////////////////////////////////////////////////////
-/// Sends a response message to the client as soon as the socket is ready
-/// for write (WRITE event).
+/// Sends responses waiting in the output buffer to the client as soon as the
+/// socket is ready for write (WRITE event). A partial write is resumed on the
+/// next WRITE event.
 ///
-/// \param loop The main loop (\a module_data and logs).
+/// \param loop The worker loop (\a module_data and logs).
 /// \param w The watcher structure triggering send_msg (client data).
 /// \param revents Flags for this event.
 //////////////////////////////////////////////////////////////////////////////
@@ -835,15 +2249,19 @@ static void send_msg(struct ev_loop *loop, struct ev_io *w, int revents){
     char clnt_straddr[ADDRSTR_LEN];     // client address as c_str
     RTSP_Client *client;                // client structure
     struct module *module;              // module structure
-    RTSP_Server *srv;                   // module structure
+    RTSP_Worker *worker;                // worker structure
+    RTSP_Out_Buffer *out;               // responses waiting to be sent
+    struct iovec *iov;                  // segment being written
+    ssize_t written;                    // bytes written
 
     // Get data
     client = ((RTSP_Client *) (((char *)w) - offsetof(RTSP_Client,ev_write)));
-    module = (struct module *)w->data;
-    srv = module_data(module, RTSP_Server);
+    out = &client->out;
+    worker = (RTSP_Worker *)w->data;
+    module = worker->module;
 
     // Check data existence
-    if(client == NULL || client->response == NULL || srv == NULL){
+    if(client == NULL){
          logerror(module->id.mclass, module->id.name, LOG_ERROR, module->errctx,
                   "Couldn't send a response - unexpected NULL pointer");
          return;
@@ -852,78 +2270,424 @@ static void send_msg(struct ev_loop *loop, struct ev_io *w, int revents){
     inet_ntop(AF_INET46, &(client->clientaddr->SIN_ADDR), clnt_straddr,
               sizeof(clnt_straddr));
 
-    // Send response to the client
-    if (revents & EV_WRITE){
-        write(client->socket,client->response,strlen(client->response));
+    // A frame sent partially goes first, responses must not split it
+    if(client->frames.offset > 0
+       && (send_frames(worker, client, 2) < 0 || client->frames.offset > 0))
+        return;
+
+    // Send responses to the client
+    if ((revents & EV_WRITE) && out->first < out->count){
+        written = writev(client->socket, out->iov + out->first,
+                         out->count - out->first);
+
+        if(written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK
+                           || errno == EINTR))
+            return;
+        else if(written <= 0){
+            client_close(worker, client, "write failed");
+            return;
+        }
+
+        // Skip the segments written completely, trim the partial one
+        while(written > 0 && out->first < out->count){
+            iov = &out->iov[out->first];
+            if((size_t) written < iov->iov_len){
+                iov->iov_base = (char *) iov->iov_base + written;
+                iov->iov_len -= written;
+                break;
+            }
+            written -= iov->iov_len;
+            out->first++;
+        }
+
+        // Wait for the next WRITE event
+        if(out->first < out->count) return;
 
         logm(&module->id, LOG_INFO, "Response sent to %s:%d",
                  clnt_straddr, ntohs(client->clientaddr->SIN_PORT));
     }
 
-    // Stop WRITE watcher and clean-up
+    // Responses sent, clean-up
+    if(client->state == CLIENT_WRITING || client->state == CLIENT_DRAINING){
+        release_output(out);
+
+        // The last responses are sent, terminate
+        if(client->state == CLIENT_DRAINING){
+            client_close(worker, client, NULL);
+            return;
+        }
+
+        // Process requests which did not fit into the output buffer (the
+        // WRITE watcher stays on if there are new responses)
+        client->state = CLIENT_READING;
+        process_buffer(worker, client);
+        if(client->state != CLIENT_READING) return;
+    }
+
+    // Interleaved frames
+    if(frames_pending(&client->frames)
+       && (send_frames(worker, client, FRAME_IOV) < 0
+           || frames_pending(&client->frames)))
+        return;
+
+    // Nothing more to send, stop WRITE watcher
     ev_io_stop(EV_A_ w);
-    g_free(client->response);
-    client->response = NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Write interleaved frames waiting in the client's ring, straight from the
+/// reflector's buffers.
+///
+/// \param worker The worker owning the connection.
+/// \param client The client structure.
+/// \param max Max. number of segments written (two per frame).
+/// \return Zero on success (or if the socket is full), -1 if the client
+///         has been closed.
+//////////////////////////////////////////////////////////////////////////////
+static int send_frames(RTSP_Worker *worker, RTSP_Client *client, int max){
+    RTSP_Frame_Ring *ring = &client->frames;
+    struct iovec iov[FRAME_IOV];            // segments of the frames
+    unsigned long sent = ring->sent;        // frames sent before
+    ssize_t written;                        // bytes written
+    int count;
+
+    if((count = frames_iov(ring, iov, MIN(max, FRAME_IOV))) == 0) return 0;
+
+    written = writev(client->socket, iov, count);
+
+    if(written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK
+                       || errno == EINTR))
+        return 0;
+    else if(written <= 0){
+        client_close(worker, client, "write failed");
+        return -1;
+    }
 
-    // Is this the end? Clean-up and terminate
-    if(client->stop){
-        // Stop timer
-        ev_timer_stop(loop, &client->timer);
-        close(client->socket);
+    frames_consume(ring, written);
+    worker->stats.frames_sent += ring->sent - sent;
 
-        logm(&module->id, LOG_INFO, "Connection to %s:%d terminated",
-                 clnt_straddr, ntohs(client->clientaddr->SIN_PORT));
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Queue a CLIENTS update for the reflector. All the updates go over the
+/// RAP channel of the first worker, the other workers queue theirs for it
+/// (\a RTSP_Server::updates), so the updates of an address and port reach
+/// the reflector in the order they were made, whichever worker made them.
+/// A client of another worker waits through a forward (\a RAP_Forward).
+///
+/// \param worker The calling worker.
+/// \param type Update type {ADD, REMOVE, PAUSE, RESUME}.
+/// \param listener_id Listener of the client (NULL for the default one).
+/// \param addr Address of the client to be added/removed (and its port).
+/// \param client Client waiting for the add (NULL if nobody waits); its
+///               request is resumed by \a rap_reply.
+/// \return Zero on success, -1 if the update cannot be sent (the client
+///         does not wait then, the caller answers it with INTERNAL_ERROR
+///         as \a rap_reply would).
+//////////////////////////////////////////////////////////////////////////////
+static int queue_rap_msg(RTSP_Worker *worker, enum msg_type type,
+                         const char *listener_id, const ADDR_TYPE *addr,
+                         RTSP_Client *client){
+    RTSP_Server *srv = worker->srv;         // server structure
+    RTSP_Worker *first = &srv->workers[0];  // owner of the RAP channel
+    RAP_Update *update;                     // update handed over
+
+    if(listener_id == NULL) listener_id = srv->listener_id;
+
+    // Updates queued by the other workers go first
+    if(worker == first){
+        updates_flush(worker);
+        return batch_rap_msg(worker, type, listener_id, addr, client, NULL);
+    }
+
+    update = g_new0(RAP_Update, 1);
+    update->type = type;
+    update->listener_id = listener_id;
+    update->addr = *addr;
+    if(client != NULL){
+        update->forward = g_new0(RAP_Forward, 1);
+        update->forward->worker = worker;
+        update->forward->waiters.clients = g_slist_prepend(NULL, client);
+        client->rap = &update->forward->waiters;
+    }
+
+    pthread_mutex_lock(&srv->updates_lock);
+    g_queue_push_tail(&srv->updates, update);
+    pthread_mutex_unlock(&srv->updates_lock);
+
+    ev_async_send(first->loop, &srv->ev_updates);
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Updates queued by the other workers (\a queue_rap_msg).
+///
+/// \param loop The loop of the first worker.
+/// \param w The async watcher (worker data).
+/// \param revents Flags for this event.
+//////////////////////////////////////////////////////////////////////////////
+static void updates_wake(struct ev_loop *loop, struct ev_async *w, int revents){
+    UNUSED(loop);
+    UNUSED(revents);
+
+    updates_flush((RTSP_Worker *) w->data);
+}
 
-        // Remove client from client list
-        if(client->sessionID != NULL){
-            pthread_mutex_lock(&srv->srv_mutex);
-            g_hash_table_remove(srv->client_list,client->sessionID);
-            pthread_mutex_unlock(&srv->srv_mutex);
+//////////////////////////////////////////////////////////////////////////////
+/// Take the updates queued by the other workers into the batch of the first
+/// worker, in the order they were queued. A waiting client whose update
+/// cannot be sent gets the failure back through its forward.
+///
+/// \param worker The first worker.
+//////////////////////////////////////////////////////////////////////////////
+static void updates_flush(RTSP_Worker *worker){
+    RTSP_Server *srv = worker->srv;
+    RAP_Update *update;
+    GQueue updates;                         // the queue (taken out)
+
+    pthread_mutex_lock(&srv->updates_lock);
+    updates = srv->updates;
+    g_queue_init(&srv->updates);
+    pthread_mutex_unlock(&srv->updates_lock);
+
+    while((update = g_queue_pop_head(&updates)) != NULL){
+        if(batch_rap_msg(worker, update->type, update->listener_id,
+                         &update->addr, NULL, update->forward) != 0
+           && update->forward != NULL)
+            forward_reply(update->forward, FALSE);
+        g_free(update);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Collect a CLIENTS update (first worker only). Updates are collected for
+/// \a RTSP_Server::rap_window seconds (or until \a RTSP_Server::rap_batch
+/// addresses are collected) and sent together by \a rap_flush; updates of
+/// the same address and port (and listener) are coalesced.
+///
+/// \param worker The first worker (owner of the RAP channel).
+/// \param type Update type {ADD, REMOVE, PAUSE, RESUME}.
+/// \param listener_id Listener of the client (interned).
+/// \param addr Address of the client to be added/removed (and its port).
+/// \param client Client of this worker waiting for the add (or NULL).
+/// \param forward Client of another worker waiting for the add (or NULL).
+/// \return Zero on success, -1 if the RAP channel is closed (nobody waits
+///         for the update then).
+//////////////////////////////////////////////////////////////////////////////
+static int batch_rap_msg(RTSP_Worker *worker, enum msg_type type,
+                         const char *listener_id, const ADDR_TYPE *addr,
+                         RTSP_Client *client, RAP_Forward *forward){
+    RTSP_Rap_Channel *rap = &worker->rap;   // RAP channel of the worker
+    RTSP_Server *srv = worker->srv;         // server structure
+    RAP_Batch_Entry *entry;                 // collected updates of addr
+    RAP_Batch_Entry key;                    // listener and address (lookup)
+    RAP_Waiters waiting;                    // the client (no batching)
+
+    if(rap->fd < 0) return -1;
+
+    worker->stats.rap_updates++;
+
+    // No batching, send at once
+    if(srv->rap_window <= 0.){
+        waiting.clients = client != NULL ? g_slist_prepend(NULL, client) : NULL;
+        waiting.forwards = forward != NULL ? g_slist_prepend(NULL, forward)
+                                           : NULL;
+        if(send_rap_msg(worker, type, listener_id, addr, &waiting) != 0){
+            g_slist_free(waiting.clients);
+            g_slist_free(waiting.forwards);
+            return -1;
+        }
+        return 0;
+    }
+
+    key.listener_id = listener_id;
+    key.addr = *addr;
+    if((entry = g_hash_table_lookup(rap->batch, &key)) == NULL){
+        entry = g_new0(RAP_Batch_Entry, 1);
+        entry->listener_id = listener_id;
+        entry->addr = *addr;
+        entry->first = entry->last = entry->mask = RAP_CLIENTS_NONE;
+        g_hash_table_insert(rap->batch, entry, entry);
+    }
+
+    if(type == RAP_CLIENTS_PAUSE || type == RAP_CLIENTS_RESUME)
+        entry->mask = type;
+    else{
+        // A removed address loses its mask; an added one must be unmasked
+        // if the add cancels out a remove (the reflector keeps the mask)
+        if(type == RAP_CLIENTS_REMOVE)
+            entry->mask = RAP_CLIENTS_NONE;
+        else if(entry->mask != RAP_CLIENTS_NONE
+                || entry->first == RAP_CLIENTS_REMOVE)
+            entry->mask = RAP_CLIENTS_RESUME;
+
+        if(entry->first == RAP_CLIENTS_NONE) entry->first = type;
+        entry->last = type;
+    }
+
+    if(client != NULL){
+        entry->waiters.clients = g_slist_prepend(entry->waiters.clients, client);
+        client->rap = &entry->waiters;
+    }
+    if(forward != NULL)
+        entry->waiters.forwards = g_slist_prepend(entry->waiters.forwards,
+                                                  forward);
+
+    // The window starts with the first update, a full batch is sent in the
+    // next loop iteration (never from inside a client's request)
+    if(g_hash_table_size(rap->batch) >= srv->rap_batch){
+        ev_timer_stop(worker->loop, &rap->ev_batch);
+        ev_timer_set(&rap->ev_batch, 0., 0.);
+        ev_timer_start(worker->loop, &rap->ev_batch);
+    }
+    else if(!ev_is_active(&rap->ev_batch)){
+        ev_timer_set(&rap->ev_batch, srv->rap_window, 0.);
+        ev_timer_start(worker->loop, &rap->ev_batch);
+    }
 
-            // Send RAP to remove this client
-            RAP_Msg_data *rap_msg_data = (RAP_Msg_data *) g_malloc0(sizeof(RAP_Msg_data));
+    return 0;
+}
 
-            rap_msg_data->ip = (char *) g_malloc0(sizeof(clnt_straddr));
-            strcpy(rap_msg_data->ip, clnt_straddr);
-            rap_msg_data->type = RAP_CLIENTS_REMOVE;
+//////////////////////////////////////////////////////////////////////////////
+/// Send the collected CLIENTS updates (end of the batch window). Every
+/// address gets at most one message, all the messages go out in one write.
+/// Clients waiting for an add which was cancelled by a later remove (or
+/// which only restored a removed address) get their response at once.
+///
+/// \param loop The worker loop.
+/// \param w The batch timer of the RAP channel.
+/// \param revents Received events.
+//////////////////////////////////////////////////////////////////////////////
+static void rap_flush(struct ev_loop *loop, struct ev_timer *w, int revents){
+    RTSP_Worker *worker = (RTSP_Worker *) w->data;
+    RTSP_Rap_Channel *rap = &worker->rap;
+    RAP_Batch_Entry *entry;                 // collected updates of an address
+    GHashTableIter iter;
+    GSList *entries = NULL;                 // the batch (taken out)
+    GSList *item;
+    gpointer value;
+
+    UNUSED(loop);
+    UNUSED(revents);
+
+    // Responses may start a new batch, take this one out first
+    g_hash_table_iter_init(&iter, rap->batch);
+    while(g_hash_table_iter_next(&iter, NULL, &value)){
+        g_hash_table_iter_steal(&iter);
+        entries = g_slist_prepend(entries, value);
+    }
+    worker->stats.rap_flushes++;
 
-            send_rap_msg(module, rap_msg_data);
+    for(item = entries; item != NULL; item = item->next){
+        entry = (RAP_Batch_Entry *) item->data;
 
-            g_free(client->sessionID);
+        // Add and remove cancel out (or only the mask changes)
+        if(entry->first != entry->last || entry->first == RAP_CLIENTS_NONE){
+            rap_reply(worker, &entry->waiters, TRUE);
+        }
+        // Waiters (if any) get the reply of the add
+        else if(entry->last == RAP_CLIENTS_ADD){
+            if(send_rap_msg(worker, RAP_CLIENTS_ADD, entry->listener_id,
+                            &entry->addr, &entry->waiters) != 0)
+                rap_reply(worker, &entry->waiters, FALSE);
+        }
+        // The address is removed, an add in between has been answered
+        else{
+            send_rap_msg(worker, RAP_CLIENTS_REMOVE, entry->listener_id,
+                         &entry->addr, NULL);
+            rap_reply(worker, &entry->waiters, TRUE);
         }
 
-        g_free(client->clientaddr);
-        g_free(client->timer.data);
-        g_free(client);
+        // Pause/resume goes after the add (the reflector knows the address)
+        if(entry->mask != RAP_CLIENTS_NONE)
+            send_rap_msg(worker, entry->mask, entry->listener_id,
+                         &entry->addr, NULL);
+
+        g_free(entry);
     }
+
+    g_slist_free(entries);
 }
 
 //////////////////////////////////////////////////////////////////////////////
-/// Sends RAP msg to the chosen UNIX socket (address is stored in srv data
-/// structure) - CLIENTS ADD or CLIENTS REMOVE msgs only.
+/// Hash of a batch entry - the listener, the IP address and the port.
 ///
-/// \param module Module data structure pointer (logging and srv data).
-/// \param data Client's IP address and msg type structure.
+/// \param key The entry (RAP_Batch_Entry).
+/// \return The hash.
 //////////////////////////////////////////////////////////////////////////////
-static int send_rap_msg(struct module *module, RAP_Msg_data *data){
-    RTSP_Server *srv;                   // module structure
-    char buffer[250];
-    char out_buffer[100];
+static guint batch_hash(gconstpointer key){
+    const RAP_Batch_Entry *entry = (const RAP_Batch_Entry *) key;
 
-    if(module == NULL || data == NULL) return -1;
+    return g_direct_hash(entry->listener_id)
+           ^ ((entry->addr.SIN_ADDR.s_addr ^ entry->addr.SIN_PORT) * 2654435761u);
+}
 
-    srv = module_data(module, RTSP_Server);
-    
-    if(srv == NULL) return -1;
+//////////////////////////////////////////////////////////////////////////////
+/// Compare two batch entries (listener IDs are interned).
+///
+/// \param a The first entry (RAP_Batch_Entry).
+/// \param b The second entry (RAP_Batch_Entry).
+/// \return TRUE if they collect updates of the same client.
+//////////////////////////////////////////////////////////////////////////////
+static gboolean batch_equal(gconstpointer a, gconstpointer b){
+    const RAP_Batch_Entry *x = (const RAP_Batch_Entry *) a;
+    const RAP_Batch_Entry *y = (const RAP_Batch_Entry *) b;
+
+    return x->listener_id == y->listener_id
+           && x->addr.SIN_ADDR.s_addr == y->addr.SIN_ADDR.s_addr
+           && x->addr.SIN_PORT == y->addr.SIN_PORT;
+}
 
-    bzero(out_buffer, strlen(out_buffer));
+//////////////////////////////////////////////////////////////////////////////
+/// Append a CLIENTS message to the RAP channel. The message is written when
+/// the UNIX socket is writable, together with all the other messages queued
+/// meanwhile; the loop never waits for the reflector.
+///
+/// \param worker The worker owning the RAP channel.
+/// \param type Message type {ADD, REMOVE, PAUSE, RESUME}.
+/// \param listener_id Target listener.
+/// \param addr Address of the client to be added/removed (with the port the
+///             stream goes to, zero if the reflector should use its own).
+/// \param waiters Clients waiting for the reply (taken over on success,
+///                the lists are emptied), NULL if nobody waits.
+/// \return Zero on success, -1 if the RAP channel is closed.
+//////////////////////////////////////////////////////////////////////////////
+static int send_rap_msg(RTSP_Worker *worker, enum msg_type type,
+                        const char *listener_id, const ADDR_TYPE *addr,
+                        RAP_Waiters *waiters){
+    RTSP_Rap_Channel *rap = &worker->rap;   // RAP channel of the worker
+    struct module *module = worker->module; // module structure
+    char clnt_straddr[ADDRSTR_LEN];         // client address as c_str
+    char port_line[sizeof(rap_port_msg) + 8]; // port header (or empty)
+    RAP_Request *request;                   // request waiting for a reply
+    GSList *item;
 
-    switch(data->type){
+    if(rap->fd < 0) return -1;
+
+    inet_ntop(AF_INET46, &(addr->SIN_ADDR), clnt_straddr, sizeof(clnt_straddr));
+    port_line[0] = '\0';
+    if(addr->SIN_PORT != 0)
+        snprintf(port_line, sizeof(port_line), rap_port_msg,
+                 (unsigned) ntohs(addr->SIN_PORT));
+
+    switch(type){
         case RAP_CLIENTS_ADD:
-            sprintf(out_buffer, rap_add_msg, srv->listener_id, data->ip);
+            g_string_append_printf(rap->out, rap_add_msg,
+                                   listener_id, clnt_straddr, port_line);
             break;
         case RAP_CLIENTS_REMOVE:
-            sprintf(out_buffer, rap_remove_msg, srv->listener_id, data->ip);
+            g_string_append_printf(rap->out, rap_remove_msg,
+                                   listener_id, clnt_straddr, port_line);
+            break;
+        case RAP_CLIENTS_PAUSE:
+            g_string_append_printf(rap->out, rap_pause_msg,
+                                   listener_id, clnt_straddr, port_line);
+            break;
+        case RAP_CLIENTS_RESUME:
+            g_string_append_printf(rap->out, rap_resume_msg,
+                                   listener_id, clnt_straddr, port_line);
             break;
         default:
             logerror(module->id.mclass, module->id.name, LOG_ERROR, module->errctx,
@@ -931,146 +2695,544 @@ static int send_rap_msg(struct module *module, RAP_Msg_data *data){
             return -1;
     }
 
-    if(write(srv->unixsocket_fd, out_buffer, strlen(out_buffer)) < 0) return -1;
+    request = g_new0(RAP_Request, 1);
+    request->type = type;
+    if(waiters != NULL){
+        request->waiters = *waiters;
+        waiters->clients = waiters->forwards = NULL;
+    }
+    for(item = request->waiters.clients; item != NULL; item = item->next)
+        ((RTSP_Client *) item->data)->rap = &request->waiters;
+    g_queue_push_tail(&rap->pending, request);
+    worker->stats.rap_sent++;
+
+    if(!ev_is_active(&rap->ev_write)) ev_io_start(worker->loop, &rap->ev_write);
 
-    bzero(buffer, strlen(buffer));
+    return 0;
+}
 
-    read(srv->unixsocket_fd, buffer, 248);
+//////////////////////////////////////////////////////////////////////////////
+/// Write queued RAP messages (WRITE event on the RAP channel).
+///
+/// \param loop The worker loop.
+/// \param w The WRITE watcher of the RAP channel.
+/// \param revents Received events.
+//////////////////////////////////////////////////////////////////////////////
+static void rap_write(struct ev_loop *loop, struct ev_io *w, int revents){
+    RTSP_Worker *worker = (RTSP_Worker *) w->data;
+    RTSP_Rap_Channel *rap = &worker->rap;
+    ssize_t written;                        // bytes written
+
+    UNUSED(revents);
+
+    written = write(rap->fd, rap->out->str + rap->sent,
+                    rap->out->len - rap->sent);
+    if(written < 0){
+        if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+        rap_fail(worker);
+        return;
+    }
 
-    g_free(data->ip);
-    g_free(data);
+    // Everything written, wait for the next message
+    rap->sent += written;
+    if(rap->sent == rap->out->len){
+        g_string_truncate(rap->out, 0);
+        rap->sent = 0;
+        ev_io_stop(loop, w);
+    }
+}
 
-    return 0;
+//////////////////////////////////////////////////////////////////////////////
+/// Read RAP replies (READ event on the RAP channel). Every final reply
+/// ("RAP/1.0 <code> ...") belongs to the oldest pending request, 1xx
+/// replies are informational only. The body of a reply (Content-Length)
+/// is skipped.
+///
+/// \param loop The worker loop.
+/// \param w The READ watcher of the RAP channel.
+/// \param revents Received events.
+//////////////////////////////////////////////////////////////////////////////
+static void rap_read(struct ev_loop *loop, struct ev_io *w, int revents){
+    RTSP_Worker *worker = (RTSP_Worker *) w->data;
+    RTSP_Rap_Channel *rap = &worker->rap;
+    struct module *module = worker->module;
+    RAP_Request *request;                   // request the reply belongs to
+    const char *end;                        // end of the reply headers
+    const char *line;                       // header line
+    size_t length;                          // length of the reply headers
+    size_t body;                            // length of the reply body
+    ssize_t received;                       // bytes read
+    int code;                               // reply code
+
+    UNUSED(loop);
+    UNUSED(revents);
+
+    received = read(rap->fd, rap->in + rap->in_len,
+                    sizeof(rap->in) - rap->in_len);
+    if(received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK
+                        || errno == EINTR))
+        return;
+    if(received <= 0){
+        rap_fail(worker);
+        return;
+    }
+    rap->in_len += received;
+
+    for(;;){
+        // Skip the body of the previous reply
+        body = rap->skip < rap->in_len ? rap->skip : rap->in_len;
+        memmove(rap->in, rap->in + body, rap->in_len - body);
+        rap->in_len -= body;
+        rap->skip -= body;
+        if(rap->skip > 0) break;
+
+        end = memmem(rap->in, rap->in_len, msg_end, sizeof(msg_end) - 1);
+        if(end == NULL){
+            // A reply longer than the buffer cannot be matched any more
+            if(rap->in_len == sizeof(rap->in)){
+                logerror(module->id.mclass, module->id.name, LOG_ERROR,
+                         module->errctx, "RAP reply too long");
+                rap_fail(worker);
+            }
+            break;
+        }
+        length = end - rap->in + sizeof(msg_end) - 1;
+
+        // Reply code and body length
+        code = 0;
+        if(length > 12 && memcmp(rap->in, "RAP/1.0 ", 8) == 0)
+            code = parse_number(rap->in + 8, 3, 999);
+
+        for(line = rap->in, body = 0; line < end;
+            line = (const char *) memchr(line, '\n', end - line) + 1){
+            if(end - line > 15 && g_ascii_strncasecmp(line, "Content-Length:", 15) == 0){
+                for(line += 15; *line == ' '; line++);
+                body = parse_number(line, strspn(line, "0123456789"), G_MAXINT);
+            }
+            if(memchr(line, '\n', end - line) == NULL) break;
+        }
+        rap->skip = length + body;
+
+        if(code >= 100 && code < 200) continue;
+
+        request = g_queue_pop_head(&rap->pending);
+        if(request == NULL){
+            logm(&module->id, LOG_INFO, "Unexpected RAP reply (code %d)", code);
+            continue;
+        }
+
+        if(code < 200 || code >= 300)
+            logerror(module->id.mclass, module->id.name, LOG_ERROR,
+                     module->errctx, "RAP CLIENTS %s failed (code %d)",
+                     rap_type_names[request->type], code);
+
+        rap_reply(worker, &request->waiters, code >= 200 && code < 300);
+        g_free(request);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Finish a CLIENTS add - the waiting clients (those still connected) get
+/// their PLAY responses and their next requests are processed; clients of
+/// other workers get the result through their forwards.
+///
+/// \param worker The worker owning the waiting clients.
+/// \param waiters Clients waiting for the add (the lists are emptied).
+/// \param ok The reflector accepted the add.
+//////////////////////////////////////////////////////////////////////////////
+static void rap_reply(RTSP_Worker *worker, RAP_Waiters *waiters, gboolean ok){
+    RTSP_Client *client;                    // client waiting for the reply
+    GSList *clients = waiters->clients;     // the waiting clients
+    GSList *forwards = waiters->forwards;   // clients of the other workers
+    GSList *item;
+
+    waiters->clients = NULL;
+    waiters->forwards = NULL;
+
+    for(item = forwards; item != NULL; item = item->next)
+        forward_reply((RAP_Forward *) item->data, ok);
+    g_slist_free(forwards);
+
+    for(item = clients; item != NULL; item = item->next){
+        client = (RTSP_Client *) item->data;
+        client->rap = NULL;
+
+        if(ok){
+            // Register a new client
+            client_playing(worker, client, TRUE);
+
+            set_response(client, PLAY_OK, client->sessionID);
+        }
+        else{
+            client->playing = FALSE;
+            set_response(client, INTERNAL_ERROR, NULL);
+            wheel_arm(&worker->idle, &client->idle, ev_now(worker->loop),
+                      TIMEOUT);
+        }
+
+        process_buffer(worker, client);
+    }
+
+    g_slist_free(clients);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Hand the result of a CLIENTS add back to the worker of the waiting
+/// client (\a replies_wake answers it there).
+///
+/// \param forward The waiting client.
+/// \param ok The reflector accepted the add.
+//////////////////////////////////////////////////////////////////////////////
+static void forward_reply(RAP_Forward *forward, gboolean ok){
+    RTSP_Worker *worker = forward->worker;
+
+    forward->ok = ok;
+
+    pthread_mutex_lock(&worker->replies_lock);
+    g_queue_push_tail(&worker->replies, forward);
+    pthread_mutex_unlock(&worker->replies_lock);
+
+    ev_async_send(worker->loop, &worker->ev_replies);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Answer the clients whose adds the first worker finished
+/// (\a forward_reply).
+///
+/// \param loop The worker loop.
+/// \param w The async watcher (worker data).
+/// \param revents Flags for this event.
+//////////////////////////////////////////////////////////////////////////////
+static void replies_wake(struct ev_loop *loop, struct ev_async *w, int revents){
+    RTSP_Worker *worker = (RTSP_Worker *) w->data;
+    RAP_Forward *forward;
+    GQueue replies;                         // the queue (taken out)
+
+    UNUSED(loop);
+    UNUSED(revents);
+
+    pthread_mutex_lock(&worker->replies_lock);
+    replies = worker->replies;
+    g_queue_init(&worker->replies);
+    pthread_mutex_unlock(&worker->replies_lock);
+
+    while((forward = g_queue_pop_head(&replies)) != NULL){
+        rap_reply(worker, &forward->waiters, forward->ok);
+        g_free(forward);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Free the waiter lists of a request nobody will answer (module cleanup).
+///
+/// \param waiters The waiters (the lists are emptied).
+//////////////////////////////////////////////////////////////////////////////
+static void waiters_free(RAP_Waiters *waiters){
+    GSList *item;
+
+    for(item = waiters->forwards; item != NULL; item = item->next){
+        waiters_free(&((RAP_Forward *) item->data)->waiters);
+        g_free(item->data);
+    }
+    g_slist_free(waiters->forwards);
+    g_slist_free(waiters->clients);
+    waiters->clients = waiters->forwards = NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Close a broken RAP channel, all pending requests fail.
+///
+/// \param worker The worker owning the RAP channel.
+//////////////////////////////////////////////////////////////////////////////
+static void rap_fail(RTSP_Worker *worker){
+    RTSP_Rap_Channel *rap = &worker->rap;
+    struct module *module = worker->module;
+    RAP_Request *request;                   // request which failed
+
+    logerror(module->id.mclass, module->id.name, LOG_ERROR, module->errctx,
+             "RAP channel of worker %d closed", worker->id);
+
+    ev_io_stop(worker->loop, &rap->ev_read);
+    ev_io_stop(worker->loop, &rap->ev_write);
+    close(rap->fd);
+    rap->fd = -1;
+
+    g_string_truncate(rap->out, 0);
+    rap->sent = rap->in_len = rap->skip = 0;
+
+    while(!g_queue_is_empty(&rap->pending)){
+        request = g_queue_pop_head(&rap->pending);
+        rap_reply(worker, &request->waiters, FALSE);
+        g_free(request);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Build the response templates (DESCRIBE with the built-in SDP).
+///
+/// \param srv The server structure (owner of the templates).
+//////////////////////////////////////////////////////////////////////////////
+static void response_init(RTSP_Server *srv){
+    int type;
+
+    for(type = 0; type < RESPONSE_TYPES; type++)
+        template_build(&srv->responses[type], response_parts[type],
+                       describe_ok_body);
 }
 
 //////////////////////////////////////////////////////////////////////////////
-/// Set default response. Static messages are combined with dynamic session
-/// IDs and time stamps.
+/// Set default response (see \a queue_response).
 ///
 /// \param client The target client structure.
 /// \param msg_type Type of the response message (enum).
 /// \param session_hdr Session ID of the current client.
+/// \return Zero on success, -1 if there is no room for the response.
 //////////////////////////////////////////////////////////////////////////////
 static int set_response(RTSP_Client *client,RTSP_Response_Msg msg_type, char* session_hdr){
-    char *msg;                              // outgoing message
-    char clnt_straddr[ADDRSTR_LEN];         // client address as c_str
-    char *timestamp;                        // current timestamp
-
-    // MAX_MSG_OUT-1 characters (default value is 600)
-    msg = g_malloc0(MAX_MSG_OUT*sizeof(char));
-
-    if(msg == NULL || client == NULL){
+    if(client == NULL){
         return -1;
     }
 
-    // Temporary STOP solution (STOP is not being used anyway)
-    if(msg_type == STOP_OK) msg_type = TEARDOWN_OK;
+    if(msg_type < 0 || msg_type >= RESPONSE_TYPES) msg_type = INTERNAL_ERROR;
 
-    inet_ntop(AF_INET46, &(client->clientaddr->SIN_ADDR),
-              clnt_straddr,sizeof(clnt_straddr));
+    return queue_response(client, &client->worker->srv->responses[msg_type],
+                          session_hdr);
+}
 
-    // Select message type and construct the message
-    switch(msg_type){
-        case OPTIONS_PUBLIC_OK:
-            sprintf(msg, "%s%s%s%d%s%s%s", rtsp_ok, msg_newline,
-                    msg_cseq, client->msg_cseq, msg_newline, options_public_ok,
-                    msg_end);
-            break;
-        case BAD_REQUEST:
-            sprintf(msg, "%s%s%s%d%s", rtsp_bad_request, msg_newline,
-                    msg_cseq ,client->msg_cseq, msg_end);
-            break;
-        case NOT_IMPLEMENTED:
-            sprintf(msg, "%s%s%s%d%s", rtsp_not_implemented, msg_newline,
-                    msg_cseq, client->msg_cseq, msg_end);
-            break;
-        case DESCRIBE_OK:
-            timestamp = rtsp_timestamp();
-            sprintf(msg, "%s%s%s%d%s%s%s%s%s%d%s%s%s", rtsp_ok, msg_newline,
-                    msg_cseq, client->msg_cseq, msg_newline, msg_date,
-                    timestamp, msg_newline, describe_ok_headers,
-                    sizeof(describe_ok_body), msg_end, describe_ok_body,
-                    msg_end);
-            g_free(timestamp);
-            break;
-        case SETUP_OK:
-            sprintf(msg, "%s%s%s%d%s%s%s%s%s%s%s%s%s", rtsp_ok, msg_newline,
-                    msg_cseq, client->msg_cseq, msg_newline, msg_server,
-                    msg_newline, msg_sess, session_hdr, msg_timeout,
-                    msg_newline, msg_transport, msg_end);
-            break;
-        case SESSION_NOT_FOUND:
-            sprintf(msg, "%s%s%s%d%s", rtsp_sess_not_found, msg_newline,
-                    msg_cseq, client->msg_cseq, msg_end);
-            break;
-        case PLAY_OK:
-            sprintf(msg, "%s%s%s%d%s%s%s%s", rtsp_ok, msg_newline, msg_cseq,
-                    client->msg_cseq, msg_newline, msg_sess, session_hdr,
-                    msg_end);
-            break;
-        case TEARDOWN_OK:
-            sprintf(msg, "%s%s%s%d%s%s%s%s", rtsp_ok, msg_newline, msg_cseq,
-                    client->msg_cseq, msg_newline, msg_sess, session_hdr,
-                    msg_end);
-            break;
-        default:
-            //unknown error msg
-            sprintf(msg, "%s%s%s%d%s", rtsp_internal_srv_error, msg_newline,
-                    msg_cseq, client->msg_cseq, msg_end);
-            break;
+//////////////////////////////////////////////////////////////////////////////
+/// Queue a response. The preformatted template is appended to the client's
+/// output segments, only CSeq, Date and Session are formatted (into the
+/// client's scratch area). Nothing is allocated.
+///
+/// \param client The target client structure.
+/// \param tmpl Template of the response.
+/// \param session_hdr Session ID of the current client.
+/// \return Zero on success, -1 if there is no room for the response.
+//////////////////////////////////////////////////////////////////////////////
+static int queue_response(RTSP_Client *client,
+                          const RTSP_Response_Template *tmpl,
+                          char *session_hdr){
+    RTSP_Out_Buffer *out = &client->out;    // client output segments
+    struct iovec *iov;                      // segment being filled in
+    char *scratch;                          // room for the dynamic parts
+    size_t size;                            // room left in scratch
+    int length;                             // length of a dynamic part
+    int i;
+
+    if(out->responses == MAX_PIPELINE) return -1;
+
+    scratch = out->scratch + out->responses * RESPONSE_SCRATCH;
+    size = RESPONSE_SCRATCH;
+
+    for(i = 0; i < tmpl->count; i++){
+        iov = &out->iov[out->count++];
+        *iov = tmpl->iov[i];
+
+        switch(tmpl->field[i]){
+            case TMPL_CSEQ:
+                length = snprintf(scratch, size, "%d", client->msg_cseq);
+                break;
+            case TMPL_DATE:
+                length = rtsp_date(client->worker->srv,
+                                   ev_now(client->worker->loop), scratch, size);
+                break;
+            case TMPL_SESSION:
+                length = snprintf(scratch, size, "%s",
+                                  session_hdr != NULL ? session_hdr : "");
+                break;
+            case TMPL_TRANSPORT:
+                length = transport_format(&client->transport, scratch, size);
+                break;
+            default:
+                continue;
+        }
+
+        // Truncated if it does not fit (cannot happen with SESSION_HDR_MAX)
+        if(length < 0) length = 0;
+        if((size_t) length >= size) length = size - 1;
+
+        iov->iov_base = scratch;
+        iov->iov_len = length;
+        scratch += length;
+        size -= length;
     }
 
-    // Assign message to the client
-    client->response = msg;
-    
+    out->responses++;
+
     return 0;
 }
 
 //////////////////////////////////////////////////////////////////////////////
-/// Get a time stamp for the response message or a session ID generator.
+/// Empty the output buffer (the responses were sent or the connection is
+/// closed) and drop the catalogs the responses pointed into.
+///
+/// \param out The output buffer.
 //////////////////////////////////////////////////////////////////////////////
-static char *rtsp_timestamp() {
-  char buffer[31] = { 0, };     // buffer for timestamp
+static void release_output(RTSP_Out_Buffer *out){
+    int i;
+
+    for(i = 0; i < MAX_PIPELINE; i++){
+        if(out->catalog[i] != NULL){
+            catalog_unref(out->catalog[i]);
+            out->catalog[i] = NULL;
+        }
+    }
 
-  // Get current time
-  time_t now = time(NULL);
-  struct tm *t = gmtime(&now);
+    out->count = out->first = out->responses = 0;
+}
 
-  // Formatting
-  strftime(buffer, 30, "%a, %d %b %Y %H:%M:%S GMT", t);
+//////////////////////////////////////////////////////////////////////////////
+/// Get the stream catalog of a worker. The worker keeps a reference to the
+/// catalog it uses and takes the lock only when a reload has published a
+/// new one, so lookups never contend.
+///
+/// \param worker The worker.
+/// \return The catalog or NULL if there is none.
+//////////////////////////////////////////////////////////////////////////////
+static RTSP_Catalog *worker_catalog(RTSP_Worker *worker){
+    RTSP_Server *srv = worker->srv;
+
+    if(g_atomic_int_get(&srv->catalog_gen) != worker->catalog_gen){
+        pthread_mutex_lock(&srv->catalog_lock);
+        if(worker->catalog != NULL) catalog_unref(worker->catalog);
+        worker->catalog = (srv->catalog != NULL)
+                          ? catalog_ref(srv->catalog) : NULL;
+        worker->catalog_gen = srv->catalog_gen;
+        pthread_mutex_unlock(&srv->catalog_lock);
+    }
 
-  return g_strdup(buffer);
+    return worker->catalog;
 }
 
 //////////////////////////////////////////////////////////////////////////////
-/// Generate a new session ID from the client IP, port and current timestamp.
+/// Reload the stream catalog when its file changes. The new catalog is
+/// published at once, the workers switch to it on their next DESCRIBE;
+/// responses already queued keep the old one alive until they are sent.
+/// A catalog which cannot be loaded is ignored (the old one stays).
 ///
-/// \param client The client structure (with IP and port number).
-/// \return Pointer to a c_str with the new session ID.
+/// \param loop The loop of the first worker.
+/// \param w The stat watcher (worker data).
+/// \param revents Flags for this event.
 //////////////////////////////////////////////////////////////////////////////
-static char *gen_sess_id(RTSP_Client *client){
+static void catalog_reload(struct ev_loop *loop, struct ev_stat *w,
+                           int revents){
+    RTSP_Worker *worker = (RTSP_Worker *) w->data;
+    RTSP_Server *srv = worker->srv;
+    struct module *module = worker->module;
+    RTSP_Catalog *catalog;                  // the new catalog
+    RTSP_Catalog *old;                      // the replaced catalog
+    GError *error = NULL;                   // load error
+
+    UNUSED(loop);
+    UNUSED(revents);
+
+    // Removed (being replaced), wait for the new file
+    if(w->attr.st_nlink == 0) return;
+
+    catalog = catalog_load(srv->catalog_file, srv->listener_id,
+                           tmpl_describe_ok, &error);
+    if(catalog == NULL){
+        logerror(module->id.mclass, module->id.name, LOG_ERROR, module->errctx,
+                 "Unable to reload stream catalog %s: %s", srv->catalog_file,
+                 error != NULL ? error->message : "?");
+        g_clear_error(&error);
+        return;
+    }
 
-    char tmp[ADDRSTR_LEN + 31 + 5];         // text buffer
-    char clnt_straddr[ADDRSTR_LEN];         // client address as c_str
-    char tmp1[12];                          // session ID buffer
-    char *timestamp;                        // timestamp
+    pthread_mutex_lock(&srv->catalog_lock);
+    old = srv->catalog;
+    srv->catalog = catalog;
+    g_atomic_int_inc(&srv->catalog_gen);
+    pthread_mutex_unlock(&srv->catalog_lock);
 
-    inet_ntop(AF_INET46, &(client->clientaddr->SIN_ADDR),
-              clnt_straddr,sizeof(clnt_straddr));
+    catalog_unref(old);
+
+    logm(&module->id, LOG_INFO, "Stream catalog %s reloaded (%u streams)",
+         srv->catalog_file, g_hash_table_size(catalog->streams));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Format a time stamp for the response message or a session ID generator.
+///
+/// \param buffer Target buffer.
+/// \param size Size of \a buffer.
+/// \param now Time to be formatted.
+/// \return Length of the time stamp (zero if it does not fit).
+//////////////////////////////////////////////////////////////////////////////
+static size_t rtsp_timestamp(char *buffer, size_t size, time_t now) {
+  struct tm t;
 
-    // Reset buffers
-    memset(tmp,'\0',sizeof(tmp));
-    memset(tmp1,'\0',sizeof(tmp1));
+  gmtime_r(&now, &t);
 
-    timestamp = rtsp_timestamp();
+  // Formatting
+  return strftime(buffer, size, "%a, %d %b %Y %H:%M:%S GMT", &t);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Get the current date from the server's cache. The cache is regenerated
+/// by the first worker noticing a new second, the others keep reading the
+/// old value until the new one is complete. Workers whose loop time lags
+/// behind never move the cache back.
+///
+/// \param srv The server structure (owner of the cache).
+/// \param now Loop time of the calling worker (ev_now()).
+/// \param buffer Target buffer.
+/// \param size Size of \a buffer.
+/// \return Length of the date (zero if it does not fit).
+//////////////////////////////////////////////////////////////////////////////
+static size_t rtsp_date(RTSP_Server *srv, ev_tstamp now, char *buffer,
+                        size_t size){
+    RTSP_Date_Cache *date = &srv->date;     // shared cache
+    time_t second = (time_t) now;           // second to be formatted
+    gint seq;                               // sequence before the copy
+    size_t length;                          // length of the date
+
+    for(;;){
+        seq = g_atomic_int_get(&date->seq);
+
+        // Another worker is regenerating the date
+        if(seq & 1) continue;
+
+        // New second - regenerate (if nobody else has started meanwhile)
+        if(second > date->second){
+            if(g_atomic_int_compare_and_exchange(&date->seq, seq, seq + 1)){
+                date->len = rtsp_timestamp(date->text, sizeof(date->text),
+                                           second);
+                date->second = second;
+                g_atomic_int_set(&date->seq, seq + 2);
+            }
+            continue;
+        }
+
+        length = date->len < size ? date->len : 0;
+        memcpy(buffer, date->text, length);
+
+        // Not changed during the copy
+        if(g_atomic_int_get(&date->seq) == seq) return length;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Generate a new session ID for the client (stored in \a client->sessionID
+/// and \a client->session) and reserve it in the worker's session table.
+/// IDs come from the worker's SipHash generator, their low bits carry the
+/// worker's index, so the owning shard is known from the ID and the check
+/// for an ID already in use is a single lookup.
+///
+/// \param worker The worker owning the client (generator, shard).
+/// \param client The client structure (target of the ID).
+//////////////////////////////////////////////////////////////////////////////
+static void gen_sess_id(RTSP_Worker *worker, RTSP_Client *client){
+    uint64_t id;                            // new session ID
 
-    // Formatting
-    sprintf(tmp,"%s%d%s",clnt_straddr,
-            ntohs(client->clientaddr->SIN_PORT),timestamp);
-    sprintf(tmp1,"%d",g_str_hash(tmp));
+    do{
+        id = (sessid_next(&worker->sessid) & ~(uint64_t) (MAX_WORKERS - 1))
+             | (uint64_t) worker->id;
+    }while(id == 0 || id == SESSION_TOMBSTONE
+           || session_lookup(&worker->sessions, id, NULL));
 
-    // Free timestamp
-    g_free(timestamp);
+    client->session = id;
+    sessid_format(id, client->sessionID);
 
-    return g_strdup(tmp1);
+    client_playing(worker, client, FALSE);
 }
@@ -34,10 +34,21 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
 #include <pthread.h>
 #include <netinet/ip.h>
 #include <netinet/udp.h>
 
+#include "rtsp_request.h"
+#include "rtsp_sessid.h"
+#include "rtsp_session.h"
+#include "rtsp_pool.h"
+#include "rtsp_wheel.h"
+#include "rtsp_response.h"
+#include "rtsp_catalog.h"
+#include "rtsp_transport.h"
+#include "rtsp_frames.h"
+
 //////////////////////////////////////////////////////////////////////////////
 /// Default name of the module.
 ///
@@ -95,6 +106,11 @@ static void m_stop(struct module *module);
 //////////////////////////////////////////////////////////////////////////////
 static int m_config(struct module *module, const char *name, int start);
 
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void m_push_data(struct module *module, void *data);
+
 //////////////////////////////////////////////////////////////////////////////
 /// Module interface structure.
 //////////////////////////////////////////////////////////////////////////////
@@ -106,32 +122,105 @@ static struct module_interface iface = {
     m_main,         ///< main()
     m_stop,         ///< stop()
     m_clean,        ///< clean()
-    NULL,           ///< push_data()
+    m_push_data,    ///< push_data()
     NULL,           ///< push_message()
     NULL,           ///< events()
     m_config        ///< config()
 };
 
 //////////////////////////////////////////////////////////////////////////////
-/// Default input buffer size (max. size of received messages).
+/// Input buffer size of each client (max. size of a received request).
+//////////////////////////////////////////////////////////////////////////////
+#define MAX_MSG 4096
+
+//////////////////////////////////////////////////////////////////////////////
+/// Room for the dynamic parts (CSeq, Date, Session, Transport) of one response.
+/// A multicast Transport carries the group address (IPv6 in the worst case).
 //////////////////////////////////////////////////////////////////////////////
-#define MAX_MSG 1024
+#define RESPONSE_SCRATCH 192
 
 //////////////////////////////////////////////////////////////////////////////
-/// Default output buffer size (max. size of sent messages).
+/// Max. length of a session ID received in the Session header.
 //////////////////////////////////////////////////////////////////////////////
-#define MAX_MSG_OUT 600
+#define SESSION_HDR_MAX 64
 
 //////////////////////////////////////////////////////////////////////////////
-/// Listening backlog (for TCP socket listener).
+/// Max. number of pipelined responses waiting in the output buffer.
 //////////////////////////////////////////////////////////////////////////////
-#define LISTENQ 10
+#define MAX_PIPELINE 4
+
+//////////////////////////////////////////////////////////////////////////////
+/// Default listening backlog (for TCP socket listener).
+//////////////////////////////////////////////////////////////////////////////
+#define LISTENQ "1024"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Default maximum of connections accepted per READ event on a listener.
+//////////////////////////////////////////////////////////////////////////////
+#define ACCEPT_BATCH "64"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Default window (ms) for collecting CLIENTS updates.
+//////////////////////////////////////////////////////////////////////////////
+#define RAP_WINDOW "20"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Default maximum of addresses in one batch of CLIENTS updates.
+//////////////////////////////////////////////////////////////////////////////
+#define RAP_BATCH "256"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Default granularity (ms) of the client timeouts.
+//////////////////////////////////////////////////////////////////////////////
+#define TIMEOUT_TICK "1000"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Maximum number of worker loops (see \a PARAM_WORKERS).
+//////////////////////////////////////////////////////////////////////////////
+#define MAX_WORKERS 64
 
 //////////////////////////////////////////////////////////////////////////////
 /// Default timeout for read_ev events (MUST end with a comma).
 //////////////////////////////////////////////////////////////////////////////
 #define TIMEOUT 60.
 
+//////////////////////////////////////////////////////////////////////////////
+/// Number of client structures allocated at once by a worker.
+//////////////////////////////////////////////////////////////////////////////
+#define CLIENT_SLAB 64
+
+//////////////////////////////////////////////////////////////////////////////
+/// Default lease (seconds) of a session whose connection has been closed.
+//////////////////////////////////////////////////////////////////////////////
+#define SESSION_LEASE "60"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Number of lease structures allocated at once by a worker.
+//////////////////////////////////////////////////////////////////////////////
+#define LEASE_SLAB 64
+
+//////////////////////////////////////////////////////////////////////////////
+/// Default number of frames queued for an interleaved client.
+//////////////////////////////////////////////////////////////////////////////
+#define FRAME_QUEUE "256"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Default policy for frames of interleaved clients reading too slowly.
+//////////////////////////////////////////////////////////////////////////////
+#define FRAME_POLICY "drop-oldest"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Max. number of iovec segments written at once to an interleaved client
+/// (two per frame).
+//////////////////////////////////////////////////////////////////////////////
+#define FRAME_IOV 64
+
+//////////////////////////////////////////////////////////////////////////////
+/// Number of packets of the reflector waiting for a worker (power of two,
+/// more are dropped).
+//////////////////////////////////////////////////////////////////////////////
+#define FEED_SIZE 1024
+
 //////////////////////////////////////////////////////////////////////////////
 /// Types of response messages (a few fixed responses).
 //////////////////////////////////////////////////////////////////////////////
@@ -141,10 +230,18 @@ typedef enum {
     NOT_IMPLEMENTED,    ///< Response to an unknown request (method).
     DESCRIBE_OK,        ///< Response to a valid DESCRIBE request (with SDP).
     SETUP_OK,           ///< Response to a valid SETUP request (with SessionID).
+    SETUP_INTERLEAVED_OK, ///< Response to a SETUP of interleaved delivery.
     SESSION_NOT_FOUND,  ///< Response to an unknown/invalid SessionID.
     PLAY_OK,            ///< Response to a valid PLAY request.
     STOP_OK,            ///< Response to a valid STOP request (== TEARDOWN_OK).
-    TEARDOWN_OK         ///< Response to a valid TEARDOWN request (clean-up).
+    TEARDOWN_OK,        ///< Response to a valid TEARDOWN request (clean-up).
+    PAUSE_OK,           ///< Response to a valid PAUSE request.
+    GET_PARAMETER_OK,   ///< Response to a GET_PARAMETER (keepalive).
+    GET_PARAMETER_NOSESSION_OK, ///< Response to a GET_PARAMETER without a session.
+    INTERNAL_ERROR,     ///< Response to a request which could not be handled.
+    STREAM_NOT_FOUND,   ///< Response to a DESCRIBE of a stream not in the catalog.
+    UNSUPPORTED_TRANSPORT, ///< Response to a SETUP with no transport we serve.
+    RESPONSE_TYPES      ///< Number of response types (not a response).
 } RTSP_Response_Msg;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -157,77 +254,30 @@ typedef enum {
 } RTSP_Server_State;
 
 //////////////////////////////////////////////////////////////////////////////
-/// Types of RTSP methods (MUST be the same as in rtsp_ragel_request_line.rl).
-/// Method and RTSP version are identified in \a ragel_parse_request_line(...).
-//////////////////////////////////////////////////////////////////////////////
-enum RTSP_method_token {
-  RTSP_ID_ERROR,            ///< An ERROR message (not used).
-  RTSP_ID_DESCRIBE,         ///< A DESCRIBE message (used).
-  RTSP_ID_ANNOUNCE,         ///< An ANNOUNCE message (not used).
-  RTSP_ID_GET_PARAMETERS,   ///< A GET_PARAMETERS message (not used).
-  RTSP_ID_OPTIONS,          ///< An OPTIONS message (used).
-  RTSP_ID_PAUSE,            ///< A PAUSE message (not used).
-  RTSP_ID_PLAY,             ///< A PLAY message (used, MUST contain SessID).
-  RTSP_ID_RECORD,           ///< A RECORD message (not used).
-  RTSP_ID_REDIRECT,         ///< A REDIRECT message (not used).
-  RTSP_ID_SETUP,            ///< A SETUP message (used)
-  RTSP_ID_STOP,             ///< A STOP message (== RTSP_ID_TEARDOWN, for now)
-  RTSP_ID_TEARDOWN          ///< A TEARDOWN message (used, MUST contain SessID.)
-};
+/// Connection states. Every connection ends in \a client_close, which moves
+/// it to CLIENT_CLOSED; the structure is freed after the callbacks of the
+/// current loop iteration (\a reclaim).
+//////////////////////////////////////////////////////////////////////////////
+typedef enum {
+    CLIENT_READING,     ///< Waiting for requests, no responses pending.
+    CLIENT_WRITING,     ///< Responses waiting for the WRITE event.
+    CLIENT_DRAINING,    ///< Last responses being sent, then the end.
+    CLIENT_CLOSED       ///< Connection closed, waiting to be freed.
+} RTSP_Client_State;
 
 //////////////////////////////////////////////////////////////////////////////
-/// Types of RAP msgs - only for adding and removing clients from sessions
+/// Types of RAP msgs - adding and removing clients from sessions, masking
+/// the clients of paused sessions (the reflector keeps them, but does not
+/// send them anything)
 //////////////////////////////////////////////////////////////////////////////
 enum msg_type{
     RAP_CLIENTS_ADD,
-    RAP_CLIENTS_REMOVE
+    RAP_CLIENTS_REMOVE,
+    RAP_CLIENTS_PAUSE,
+    RAP_CLIENTS_RESUME,
+    RAP_CLIENTS_NONE    ///< No update (\a RAP_Batch_Entry only).
 };
 
-//////////////////////////////////////////////////////////////////////////////
-/// RTSP request structure - client info, method, headers
-//////////////////////////////////////////////////////////////////////////////
-typedef struct {
-    //////////////////////////////////////////////////////////////////
-    /// String representing the method used
-    ///
-    /// Mostly used for logging purposes.
-    //////////////////////////////////////////////////////////////////
-    char *method;
-
-    //////////////////////////////////////////////////////////////////
-    /// Machine-readable ID of the method
-    ///
-    /// Used by the state machine to choose the callback method.
-    //////////////////////////////////////////////////////////////////
-    enum RTSP_method_token method_id;
-
-    //////////////////////////////////////////////////////////////////
-    /// Object of the request
-    ///
-    /// Represents the object to work on, usually the URL for the
-    /// request (either a resource URL or a track URL). It can be "*"
-    /// for methods like OPTIONS.
-    //////////////////////////////////////////////////////////////////
-    char *object;
-
-    //////////////////////////////////////////////////////////////////
-    /// Protocol version used
-    ///
-    /// This can only be RTSP/1.0 right now.
-    //////////////////////////////////////////////////////////////////
-    char *version;
-
-    //////////////////////////////////////////////////////////////////
-    /// All the headers of the request, unparsed.
-    ///
-    /// This hash table contains all the headers of the request, in
-    /// unparsed string form; they can used for debugging purposes or
-    /// simply to access the original value of an header for
-    /// pass-through copy.
-    /////////////////////////////////////////////////////////////////
-    GHashTable *headers;
-}RTSP_Request;
-
 //////////////////////////////////////////////////////////////////////////////
 /// Channel parameter name.
 //////////////////////////////////////////////////////////////////////////////
@@ -238,6 +288,116 @@ typedef struct {
 //////////////////////////////////////////////////////////////////////////////
 #define PARAM_PORT_DESC "port number to listen on (defaults to 554)"
 
+//////////////////////////////////////////////////////////////////////////////
+/// Workers parameter name.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_WORKERS  "Workers"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Workers parameter description.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_WORKERS_DESC "number of worker loops, each with its own listener (defaults to 1)"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Backlog parameter name.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_BACKLOG  "Backlog"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Backlog parameter description.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_BACKLOG_DESC "listen backlog of each worker (defaults to " LISTENQ ")"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Accept batch parameter name.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_ACCEPT_BATCH  "Accept-Batch"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Accept batch parameter description.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_ACCEPT_BATCH_DESC "max. connections accepted per wakeup (defaults to " ACCEPT_BATCH ")"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Statistics interval parameter name.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_STATS_INTERVAL  "Stats-Interval"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Statistics interval parameter description.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_STATS_INTERVAL_DESC "seconds between worker statistics logs (0 disables)"
+
+//////////////////////////////////////////////////////////////////////////////
+/// RAP batch window parameter name.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_RAP_WINDOW  "RAP-Batch-Window"
+
+//////////////////////////////////////////////////////////////////////////////
+/// RAP batch window parameter description.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_RAP_WINDOW_DESC "milliseconds CLIENTS updates are collected before they are sent (0 sends them at once)"
+
+//////////////////////////////////////////////////////////////////////////////
+/// RAP batch size parameter name.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_RAP_BATCH  "RAP-Batch-Size"
+
+//////////////////////////////////////////////////////////////////////////////
+/// RAP batch size parameter description.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_RAP_BATCH_DESC "max. addresses collected before the batch is sent (defaults to " RAP_BATCH ")"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Timeout granularity parameter name.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_TIMEOUT_TICK  "Timeout-Granularity"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Timeout granularity parameter description.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_TIMEOUT_TICK_DESC "milliseconds between checks of idle clients (defaults to " TIMEOUT_TICK ")"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Session lease parameter name.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_SESSION_LEASE  "Session-Lease"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Session lease parameter description.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_SESSION_LEASE_DESC "seconds a session outlives its connection, a reconnected client takes it over (0 ends sessions with their connections, defaults to " SESSION_LEASE ")"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Stream catalog parameter name.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_CATALOG  "Catalog"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Stream catalog parameter description.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_CATALOG_DESC "stream catalog file, reloaded when it changes (empty serves the built-in SDP for every URL)"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Interleaved queue parameter name.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_FRAME_QUEUE  "Interleaved-Queue"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Interleaved queue parameter description.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_FRAME_QUEUE_DESC "frames queued for each client of interleaved (RTP/AVP/TCP) delivery (defaults to " FRAME_QUEUE ")"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Interleaved policy parameter name.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_FRAME_POLICY  "Interleaved-Policy"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Interleaved policy parameter description.
+//////////////////////////////////////////////////////////////////////////////
+#define PARAM_FRAME_POLICY_DESC "frames for a full queue: drop-oldest, drop-newest or close (defaults to " FRAME_POLICY ")"
+
 //////////////////////////////////////////////////////////////////////////////
 /// Address parameter name.
 //////////////////////////////////////////////////////////////////////////////
@@ -273,6 +433,17 @@ typedef struct {
 //////////////////////////////////////////////////////////////////////////////
 static struct module_param params[] = {
     { NULL, PARAM_PORT, PARAM_PORT_DESC, "554", NULL },
+    { NULL, PARAM_WORKERS, PARAM_WORKERS_DESC, "1", NULL },
+    { NULL, PARAM_BACKLOG, PARAM_BACKLOG_DESC, LISTENQ, NULL },
+    { NULL, PARAM_ACCEPT_BATCH, PARAM_ACCEPT_BATCH_DESC, ACCEPT_BATCH, NULL },
+    { NULL, PARAM_STATS_INTERVAL, PARAM_STATS_INTERVAL_DESC, "0", NULL },
+    { NULL, PARAM_RAP_WINDOW, PARAM_RAP_WINDOW_DESC, RAP_WINDOW, NULL },
+    { NULL, PARAM_RAP_BATCH, PARAM_RAP_BATCH_DESC, RAP_BATCH, NULL },
+    { NULL, PARAM_TIMEOUT_TICK, PARAM_TIMEOUT_TICK_DESC, TIMEOUT_TICK, NULL },
+    { NULL, PARAM_SESSION_LEASE, PARAM_SESSION_LEASE_DESC, SESSION_LEASE, NULL },
+    { NULL, PARAM_CATALOG, PARAM_CATALOG_DESC, "", NULL },
+    { NULL, PARAM_FRAME_QUEUE, PARAM_FRAME_QUEUE_DESC, FRAME_QUEUE, NULL },
+    { NULL, PARAM_FRAME_POLICY, PARAM_FRAME_POLICY_DESC, FRAME_POLICY, NULL },
     { NULL, PARAM_BIND_ADDR, PARAM_BIND_ADDR_DESC, "0.0.0.0", NULL },
     { NULL, PARAM_LISTENER_ID, PARAM_LISTENER_ID_DESC, "listener/udp-0.0.0.0:1234", NULL },
     { NULL, PARAM_UNIX_SOCKET, PARAM_UNIX_SOCKET_DESC, "/tmp/reflector", NULL },
@@ -284,65 +455,332 @@ static struct module_param params[] = {
 #define params_count (sizeof(params) / sizeof(struct module_param))
 
 //////////////////////////////////////////////////////////////////////////////
-/// Server structure - address, port, listening socket, number of clients etc.
+/// Worker statistics (logged every \a PARAM_STATS_INTERVAL seconds).
 //////////////////////////////////////////////////////////////////////////////
 typedef struct {
-    ADDR_TYPE *servaddr;            ///< Local address the server is listening on.
+    unsigned long accept_wakeups;   ///< READ events on the listening socket.
+    unsigned long accepted;         ///< Connections accepted.
+    unsigned long accept_max;       ///< Most connections accepted per wakeup.
+    unsigned long rap_updates;      ///< CLIENTS updates requested (add/remove).
+    unsigned long rap_sent;         ///< CLIENTS messages sent to the reflector.
+    unsigned long rap_flushes;      ///< Batches sent.
+    unsigned long frames_sent;      ///< Interleaved frames sent.
+    unsigned long frames_dropped;   ///< Interleaved frames dropped (slow readers).
+    unsigned long feed_dropped;     ///< Packets dropped by a full \a RTSP_Worker::feed.
+    unsigned long leased;           ///< Sessions detached from closed connections.
+    unsigned long adopted;          ///< Detached sessions taken over by a connection.
+    unsigned long expired;          ///< Detached sessions ended by their lease.
+}RTSP_Worker_Stats;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Session counts (server-wide statistics).
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    guint sessions;         ///< Sessions in the table.
+    guint playing;          ///< Sessions added by PLAY.
+    guint viewers;          ///< Playing sessions of multicast delivery.
+}RTSP_Session_Count;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Multicast group of a stream - one client of the reflector shared by all
+/// the multicast viewers of the stream. Only the first worker registers and
+/// removes groups (\a groups_sync), so the viewers of all the workers share
+/// one registration.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    const char *listener_id;    ///< Listener of the stream (interned).
+    ADDR_TYPE addr;             ///< Group address and RTP port.
+    gint viewers;               ///< Viewers and leases holding the group
+                                ///< (\a RTSP_Server::groups_lock).
+    gboolean registered;        ///< The reflector has been told to add it.
+}RTSP_Group;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Lease of a detached session - the session ends when the lease expires,
+/// unless a new connection adopts it first (the session table then holds
+/// another lease, this one only lets the multicast group go).
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    RTSP_Wheel_Entry entry;     ///< Expiry in \a RTSP_Worker::leases.
+    uint64_t session;           ///< The detached session.
+    guint lease;                ///< Lease number (\a RTSP_Session_Info::lease).
+    RTSP_Group *group;          ///< Multicast group held for the session.
+}RTSP_Lease;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Size of the buffer for RAP replies (longer replies are skipped).
+//////////////////////////////////////////////////////////////////////////////
+#define RAP_IN_BUFFER 1024
+
+//////////////////////////////////////////////////////////////////////////////
+/// Clients waiting for the result of a CLIENTS add (their PLAY requests).
+/// A client leaving earlier removes itself from the list; clients of other
+/// workers wait through their forwards (only their own worker touches
+/// them).
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    GSList *clients;            ///< Waiting clients (RTSP_Client).
+    GSList *forwards;           ///< Waiting clients of other workers (RAP_Forward).
+}RAP_Waiters;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Client of another worker waiting for a CLIENTS add sent by the first
+/// worker. The first worker only sets \a ok and hands the forward back to
+/// \a worker (\a RTSP_Worker::replies), which answers the client.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    RAP_Waiters waiters;        ///< The waiting client (unless it has left).
+    struct RTSP_Worker *worker; ///< Worker owning the client.
+    gboolean ok;                ///< The reflector accepted the add.
+}RAP_Forward;
+
+//////////////////////////////////////////////////////////////////////////////
+/// CLIENTS update of another worker, queued for the first worker
+/// (\a RTSP_Server::updates).
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    enum msg_type type;         ///< Update type {ADD, REMOVE, PAUSE, RESUME}.
+    const char *listener_id;    ///< Listener of the client (interned).
+    ADDR_TYPE addr;             ///< Address and port of the client.
+    RAP_Forward *forward;       ///< Client waiting for the add (or NULL).
+}RAP_Update;
+
+//////////////////////////////////////////////////////////////////////////////
+/// RAP request waiting for its reply. Replies come in the order of the
+/// requests, so the oldest request gets the next reply.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    RAP_Waiters waiters;        ///< Clients waiting for the reply.
+    enum msg_type type;         ///< Request type {ADD, REMOVE, PAUSE, RESUME}.
+}RAP_Request;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Address collected in the current batch. The reflector keeps a set of
+/// addresses (and ports), so only the last update matters; an add followed by a remove
+/// (or the other way round) cancels out and nothing is sent. Pause and
+/// resume are collected apart, the last one is sent after the add/remove.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    const char *listener_id;    ///< Listener of the client(s) (interned).
+    ADDR_TYPE addr;             ///< Address and port of the client(s).
+    enum msg_type first;        ///< First add/remove in the batch (or NONE).
+    enum msg_type last;         ///< Last add/remove in the batch (or NONE).
+    enum msg_type mask;         ///< Last pause/resume in the batch (or NONE).
+    RAP_Waiters waiters;        ///< Clients waiting for the add.
+}RAP_Batch_Entry;
+
+//////////////////////////////////////////////////////////////////////////////
+/// RAP channel - non-blocking connection to the reflector's UNIX socket.
+/// Requests are appended to \a out and written (pipelined) when the socket
+/// is writable, replies are read and matched to \a pending when readable.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    int fd;                     ///< Local UNIX socket (msg-interface).
+    ev_io ev_read;              ///< Watcher of replies.
+    ev_io ev_write;             ///< Watcher of pending requests (if any).
+    GString *out;               ///< Requests not written yet.
+    gsize sent;                 ///< Bytes of \a out already written.
+    char in[RAP_IN_BUFFER];     ///< Replies received.
+    size_t in_len;              ///< Length of \a in.
+    size_t skip;                ///< Body bytes of the last reply to skip.
+    GQueue pending;             ///< Requests waiting for replies (RAP_Request).
+    GHashTable *batch;          ///< Collected updates (listener, IP and
+                                ///< port, RAP_Batch_Entry is its own key).
+    ev_timer ev_batch;          ///< End of the batch window.
+}RTSP_Rap_Channel;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Worker structure - one event loop with its own listening socket (bound
+/// with SO_REUSEPORT, the kernel spreads connections among workers) and its
+/// own shard of the session table. Only the first worker connects to the
+/// reflector, the others queue their CLIENTS updates for it, so the updates
+/// of an address and port are never reordered between RAP connections.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct RTSP_Worker {
+    int id;                         ///< Index of the worker (0 runs in m_main).
+    struct module *module;          ///< Pointer to module structure (logs).
+    struct RTSP_Server *srv;        ///< Server this worker belongs to.
     int list_s;                     ///< Socket for incoming messages.
-    GHashTable *client_list;        ///< List of active clients (sessID -> addr).
-    RTSP_Server_State server_state; ///< Current state of the server.
-    pthread_mutex_t srv_mutex;      ///< Structure mutex (mainly for client list).
+    RTSP_Session_Shard sessions;    ///< Sessions of the worker's clients.
     ev_io ev_accept;                ///< Watcher structure (waiting for READ event).
-    struct ev_loop *loop;           ///< Main loop (runs until m_stop is called).
-    int unixsocket_fd;              ///< Local UNIX socket (msg-interface) for RAP
-    char *listener_id;
+    ev_async ev_stop;               ///< Wakes the loop up when m_stop is called.
+    ev_periodic ev_stats;           ///< Periodic statistics log.
+    RTSP_Wheel idle;                ///< Idle timeouts of the clients.
+    ev_periodic ev_idle;            ///< Tick of \a idle.
+    RTSP_Worker_Stats stats;        ///< Worker statistics.
+    struct ev_loop *loop;           ///< Worker loop (runs until m_stop is called).
+    pthread_t thread;               ///< Thread running the loop (id > 0 only).
+    gboolean running;               ///< Thread has been started (id > 0 only).
+    RTSP_Rap_Channel rap;           ///< Connection to the reflector (id 0 only).
+    RTSP_Sessid_Gen sessid;         ///< Session ID generator of the worker.
+    RTSP_Catalog *catalog;          ///< Catalog used by the worker (a reference).
+    gint catalog_gen;               ///< Generation of \a catalog.
+    RTSP_Pool clients;              ///< Client structures (owner thread only).
+    RTSP_Wheel leases;              ///< Leases of the sessions detached here.
+    RTSP_Pool lease_pool;           ///< Lease structures (owner thread only).
+    guint lease_seq;                ///< Leases given out by the worker.
+    struct RTSP_Client *closed;     ///< Closed clients waiting to be freed.
+    ev_check ev_reclaim;            ///< Frees \a closed after the callbacks.
+    GQueue interleaved;             ///< Playing clients of interleaved delivery.
+    volatile gint interleaved_count; ///< Length of \a interleaved (any thread).
+    pthread_mutex_t feed_lock;      ///< Lock of \a feed.
+    struct data *feed[FEED_SIZE];   ///< Packets pushed by the reflector (ring).
+    guint feed_head;                ///< First packet in \a feed.
+    guint feed_tail;                ///< Next free slot of \a feed.
+    ev_async ev_feed;               ///< Wakes the loop up for \a feed.
+    pthread_mutex_t replies_lock;   ///< Lock of \a replies.
+    GQueue replies;                 ///< Answered forwards (RAP_Forward).
+    ev_async ev_replies;            ///< Wakes the loop up for \a replies.
+}RTSP_Worker;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Date header cache - the current date is formatted at most once per second
+/// and shared by all workers. Readers copy \a text without a lock and retry
+/// if \a seq changed (or is odd, i.e. being regenerated) meanwhile.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    volatile gint seq;      ///< Sequence number (odd while being written).
+    time_t second;          ///< Second the \a text was generated for.
+    char text[32];          ///< Formatted date.
+    size_t len;             ///< Length of \a text.
+}RTSP_Date_Cache;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Server structure - address, port, worker loops, number of clients etc.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct RTSP_Server {
+    ADDR_TYPE *servaddr;            ///< Local address the server is listening on.
+    RTSP_Server_State server_state; ///< Current state of the server.
+    int worker_count;               ///< Number of worker loops.
+    int backlog;                    ///< Listen backlog of each worker.
+    int accept_batch;               ///< Max. connections accepted per wakeup.
+    int stats_interval;             ///< Seconds between statistics logs.
+    ev_tstamp rap_window;           ///< Batch window of CLIENTS updates.
+    guint rap_batch;                ///< Max. addresses in one batch.
+    ev_tstamp timeout_tick;         ///< Granularity of the client timeouts.
+    ev_tstamp lease;                ///< Lease of detached sessions (0 = none).
+    RTSP_Worker *workers;           ///< Array of \a worker_count workers.
+    const char *listener_id;        ///< Default listener (interned).
+    RTSP_Response_Template responses[RESPONSE_TYPES]; ///< Preformatted responses.
+    RTSP_Date_Cache date;           ///< Current date (shared by the workers).
+    const char *catalog_file;       ///< Stream catalog file (NULL if none).
+    RTSP_Catalog *catalog;          ///< Current catalog (\a catalog_lock).
+    volatile gint catalog_gen;      ///< Incremented when \a catalog changes.
+    pthread_mutex_t catalog_lock;   ///< Lock of \a catalog.
+    ev_stat ev_catalog;             ///< Watcher of \a catalog_file (worker 0).
+    guint frame_queue;              ///< Frames queued per interleaved client.
+    RTSP_Frame_Policy frame_policy; ///< Frames for a full queue.
+    GHashTable *groups;             ///< Multicast groups (RTSP_Group is its own key).
+    pthread_mutex_t groups_lock;    ///< Lock of \a groups.
+    ev_async ev_groups;             ///< Wakes up \a groups_sync (worker 0).
+    GQueue updates;                 ///< CLIENTS updates of the other workers
+                                    ///< (RAP_Update, \a updates_lock).
+    pthread_mutex_t updates_lock;   ///< Lock of \a updates.
+    ev_async ev_updates;            ///< Wakes up \a updates_flush (worker 0).
 }RTSP_Server;
 
 //////////////////////////////////////////////////////////////////////////////
-/// Client structure - address, port, session ID, server state
+/// Input buffer - bytes received from the client. Complete requests are
+/// taken from \a head, new data are appended at \a tail, \a scan marks
+/// where the search for the end of the next request continues. The buffer
+/// is reused for the whole connection (unread data are moved to the
+/// beginning when the end is reached).
 //////////////////////////////////////////////////////////////////////////////
 typedef struct {
+    char data[MAX_MSG];     ///< Received data.
+    size_t head;            ///< Start of the first unprocessed request.
+    size_t tail;            ///< End of received data.
+    size_t scan;            ///< Position to continue the \a msg_end search.
+    size_t skip;            ///< Bytes of a client's frame still to be skipped.
+}RTSP_In_Buffer;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Output buffer - responses waiting for the WRITE event. Static segments
+/// point into the server's templates, dynamic ones into \a scratch. The
+/// segments are written with one writev(), \a first and the segment it
+/// points to are advanced after a partial write.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    struct iovec iov[RESPONSE_SEGMENTS * MAX_PIPELINE]; ///< Segments to be sent.
+    int count;              ///< Number of segments in \a iov.
+    int first;              ///< First segment not written completely.
+    int responses;          ///< Number of responses in \a iov.
+    char scratch[RESPONSE_SCRATCH * MAX_PIPELINE]; ///< Dynamic parts.
+    RTSP_Catalog *catalog[MAX_PIPELINE]; ///< Catalogs the responses point into.
+}RTSP_Out_Buffer;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Client structure - address, port, session ID, server state. Clients are
+/// allocated from the worker's \a RTSP_Worker::clients pool together with
+/// their address.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct RTSP_Client {
     int socket;             ///< Socket for IN/OUT messages (after accept).
     int msg_cseq;           ///< Current CSeq value (ignored at the time).
-    ADDR_TYPE *clientaddr;  ///< Remote address of the client.
-    RTSP_Request *req;      ///< Structure for request data (headers and content).
-    char *response;         ///< Pointer to response message (c_str).
-    char *sessionID;        ///< Pointer to client sessionID (for PLAY, TEARDOWN).
-    gboolean stop;          ///< Processing state (true == error and end).
+    ADDR_TYPE *clientaddr;  ///< Remote address of the client (\a addr).
+    ADDR_TYPE addr;         ///< Storage of \a clientaddr.
+    RTSP_Request req;       ///< View of the request being processed.
+    RTSP_In_Buffer in;      ///< Received data (requests).
+    RTSP_Out_Buffer out;    ///< Responses waiting to be sent.
+    char sessionID[SESSION_ID_LEN + 1]; ///< Client sessionID (for PLAY, TEARDOWN), empty if none.
+    uint64_t session;       ///< Binary form of \a sessionID (key in the table).
+    RTSP_Client_State state; ///< Connection state.
+    struct RTSP_Client *closed; ///< Next closed client (\a RTSP_Worker::closed).
     ev_io ev_write;         ///< Watcher structure (waiting for READ events).
     ev_io ev_read;          ///< Watcher structure (waiting for WRITE events).
-    ev_timer timer;         ///< Timer structure (for READ timeout in \a TIMEOUT).
+    RTSP_Wheel_Entry idle;  ///< READ timeout (\a TIMEOUT) in the worker's wheel.
+    RTSP_Worker *worker;    ///< Worker owning the connection.
+    RAP_Waiters *rap;       ///< Waiters of the CLIENTS add the client waits for.
+    const char *listener_id; ///< Listener of the client's stream (SETUP).
+    RTSP_Transport transport; ///< Transport negotiated by SETUP.
+    ADDR_TYPE dest;         ///< Destination of the stream (IP, client port).
+    RTSP_Frame_Ring frames; ///< Frames of interleaved delivery (PLAY).
+    GList link;             ///< Link in \a RTSP_Worker::interleaved.
+    RTSP_Group *group;      ///< Multicast group the client views (PLAY).
+    gboolean playing;       ///< PLAY accepted (or waiting for the reflector).
+    gboolean paused;        ///< Stream paused by PAUSE (until the next PLAY).
 }RTSP_Client;
 
 //////////////////////////////////////////////////////////////////////////////
-/// Timeout structure - data needed for successfull timeout (and clean-up)
+/// \see rtsp.c
 //////////////////////////////////////////////////////////////////////////////
-typedef struct {
-    struct module *module;  ///< Pointer to module structure (module data, log).
-    RTSP_Client *client;    ///< Pointer to client structure (clean-up).
-}timeout_data;
+static int worker_init(struct module *module,
+                       RTSP_Worker *worker,
+                       ADDR_TYPE *servaddr,
+                       const char *unix_socket);
 
 //////////////////////////////////////////////////////////////////////////////
-/// Structure for RAP msg sender - contains IP in c_str and msg type,
-///                                the rest is a template
+/// \see rtsp.c
 //////////////////////////////////////////////////////////////////////////////
-typedef struct{
-    char *ip;               ///< client's IP address in c_str
-    enum msg_type type;     ///< msg type {ADD, REMOVE}
-}RAP_Msg_data;
+static void *worker_main(void *arg);
 
 //////////////////////////////////////////////////////////////////////////////
-/// Preliminary request parser from Feng. This function will get protocol type,
-/// protocol version and requested method from received message.
-///
-/// \param msg Message to be parsed (c_str).
-/// \param length Length of the message passed on in \a msg.
-/// \param req Target request structure (allocated).
-/// \return Length of headers read (and parsed) from message.
+/// \see rtsp.c
 //////////////////////////////////////////////////////////////////////////////
-extern size_t ragel_parse_request_line(const char *msg,
-                                       const size_t length,
-                                       RTSP_Request *req);
+static void worker_stop(struct ev_loop *loop,
+                        struct ev_async *w,
+                        int revents);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void worker_stats(struct ev_loop *loop,
+                         struct ev_periodic *w,
+                         int revents);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void count_session(uint64_t id,
+                          const RTSP_Session_Info *info,
+                          gpointer data);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void setup_client(RTSP_Worker *worker,
+                         int sd,
+                         ADDR_TYPE *clientaddr);
 
 //////////////////////////////////////////////////////////////////////////////
 /// \see rtsp.c
@@ -351,6 +789,143 @@ static void process(struct ev_loop *loop,
                     struct ev_io *w,
                     int revents);
 
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void process_buffer(RTSP_Worker *worker, RTSP_Client *client);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static size_t find_request(RTSP_In_Buffer *in);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static gboolean skip_frames(RTSP_In_Buffer *in);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void start_write(RTSP_Worker *worker, RTSP_Client *client);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static int send_frames(RTSP_Worker *worker, RTSP_Client *client, int max);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void interleave_start(RTSP_Worker *worker, RTSP_Client *client);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void interleave_stop(RTSP_Worker *worker, RTSP_Client *client);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void client_playing(RTSP_Worker *worker,
+                           RTSP_Client *client,
+                           gboolean playing);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void play_client(RTSP_Worker *worker,
+                        RTSP_Client *client,
+                        char *session_hdr);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void pause_client(RTSP_Worker *worker, RTSP_Client *client);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void group_join(RTSP_Worker *worker, RTSP_Client *client);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void group_leave(RTSP_Worker *worker, RTSP_Client *client);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void group_release(RTSP_Worker *worker, RTSP_Group *group);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void groups_notify(RTSP_Worker *worker);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void groups_wake(struct ev_loop *loop,
+                        struct ev_async *w,
+                        int revents);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void groups_sync(RTSP_Worker *worker);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static guint group_hash(gconstpointer key);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static gboolean group_equal(gconstpointer a, gconstpointer b);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void feed_flush(struct ev_loop *loop,
+                       struct ev_async *w,
+                       int revents);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static gboolean listener_matches(const char *listener_id, const char *name);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static gboolean parse_request(RTSP_Request *req,
+                              const char *msg,
+                              size_t length);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static const char *request_header(const RTSP_Request *req,
+                                  eris_header_id id,
+                                  size_t *len);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static size_t parse_number(const char *str, size_t len, size_t max);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void handle_request(RTSP_Worker *worker, RTSP_Client *client);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void response_init(RTSP_Server *srv);
+
 //////////////////////////////////////////////////////////////////////////////
 /// \see rtsp.c
 //////////////////////////////////////////////////////////////////////////////
@@ -361,12 +936,58 @@ static int set_response(RTSP_Client *client,
 //////////////////////////////////////////////////////////////////////////////
 /// \see rtsp.c
 //////////////////////////////////////////////////////////////////////////////
-static char *rtsp_timestamp();
+static int queue_response(RTSP_Client *client,
+                          const RTSP_Response_Template *tmpl,
+                          char *session_hdr);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void release_output(RTSP_Out_Buffer *out);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void describe(RTSP_Worker *worker,
+                     RTSP_Client *client,
+                     char *session_hdr);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static const char *stream_listener(RTSP_Worker *worker,
+                                   const RTSP_Request *req,
+                                   RTSP_Transport *multicast);
 
 //////////////////////////////////////////////////////////////////////////////
 /// \see rtsp.c
 //////////////////////////////////////////////////////////////////////////////
-static char *gen_sess_id(RTSP_Client *client);
+static RTSP_Catalog *worker_catalog(RTSP_Worker *worker);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void catalog_reload(struct ev_loop *loop,
+                           struct ev_stat *w,
+                           int revents);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static size_t rtsp_timestamp(char *buffer, size_t size, time_t now);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static size_t rtsp_date(RTSP_Server *srv,
+                        ev_tstamp now,
+                        char *buffer,
+                        size_t size);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void gen_sess_id(RTSP_Worker *worker, RTSP_Client *client);
 
 //////////////////////////////////////////////////////////////////////////////
 /// \see rtsp.c
@@ -378,10 +999,53 @@ static void accept_connection(struct ev_loop *loop,
 //////////////////////////////////////////////////////////////////////////////
 /// \see rtsp.c
 //////////////////////////////////////////////////////////////////////////////
-static void timeout(struct ev_loop *loop,
-                    struct ev_timer *timer,
+static void timeout(RTSP_Wheel_Entry *entry,
+                    gpointer data);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static RTSP_Session_Shard *session_shard(RTSP_Worker *worker, uint64_t id);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static gboolean lease_session(RTSP_Worker *worker, RTSP_Client *client);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void lease_expired(RTSP_Wheel_Entry *entry,
+                          gpointer data);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void adopt_session(RTSP_Worker *worker,
+                          RTSP_Client *client,
+                          const char *session_hdr);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void client_close(RTSP_Worker *worker,
+                         RTSP_Client *client,
+                         const char *reason);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void reclaim(struct ev_loop *loop,
+                    struct ev_check *w,
                     int revents);
 
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void idle_tick(struct ev_loop *loop,
+                      struct ev_periodic *w,
+                      int revents);
+
 //////////////////////////////////////////////////////////////////////////////
 /// \see rtsp.c
 //////////////////////////////////////////////////////////////////////////////
@@ -392,7 +1056,104 @@ static void send_msg(struct ev_loop *loop,
 //////////////////////////////////////////////////////////////////////////////
 /// \see rtsp.c
 //////////////////////////////////////////////////////////////////////////////
-static int send_rap_msg(struct module *module, RAP_Msg_data *data);
+static int queue_rap_msg(RTSP_Worker *worker,
+                         enum msg_type type,
+                         const char *listener_id,
+                         const ADDR_TYPE *addr,
+                         RTSP_Client *client);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void updates_wake(struct ev_loop *loop,
+                         struct ev_async *w,
+                         int revents);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void updates_flush(RTSP_Worker *worker);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static int batch_rap_msg(RTSP_Worker *worker,
+                         enum msg_type type,
+                         const char *listener_id,
+                         const ADDR_TYPE *addr,
+                         RTSP_Client *client,
+                         RAP_Forward *forward);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void rap_flush(struct ev_loop *loop,
+                      struct ev_timer *w,
+                      int revents);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static int send_rap_msg(RTSP_Worker *worker,
+                        enum msg_type type,
+                        const char *listener_id,
+                        const ADDR_TYPE *addr,
+                        RAP_Waiters *waiters);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static guint batch_hash(gconstpointer key);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static gboolean batch_equal(gconstpointer a,
+                            gconstpointer b);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void rap_write(struct ev_loop *loop,
+                      struct ev_io *w,
+                      int revents);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void rap_read(struct ev_loop *loop,
+                     struct ev_io *w,
+                     int revents);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void rap_reply(RTSP_Worker *worker,
+                      RAP_Waiters *waiters,
+                      gboolean ok);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void forward_reply(RAP_Forward *forward,
+                          gboolean ok);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void replies_wake(struct ev_loop *loop,
+                         struct ev_async *w,
+                         int revents);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void waiters_free(RAP_Waiters *waiters);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp.c
+//////////////////////////////////////////////////////////////////////////////
+static void rap_fail(RTSP_Worker *worker);
 
 //////////////////////////////////////////////////////////////////////////////
 /// Default RTSP_OK response header
@@ -430,13 +1191,24 @@ const char msg_sess[] = "Session: ";
 const char msg_timeout[] = ";timeout=60";
 
 //////////////////////////////////////////////////////////////////////////////
-/// Default transport info
+/// Default Transport word
+//////////////////////////////////////////////////////////////////////////////
+const char msg_transport[] = "Transport: ";
+
+//////////////////////////////////////////////////////////////////////////////
+/// Default transport info (after the negotiated transport)
 //////////////////////////////////////////////////////////////////////////////
-const char msg_transport[] =
-"Transport: udp;"
-"source=127.0.0.1;"
-"server_port=1234;"
-"client_port=1234";
+const char msg_transport_source[] =
+";source=127.0.0.1;"
+"server_port=1234";
+
+//////////////////////////////////////////////////////////////////////////////
+/// Transport of clients which do not send a Transport header
+//////////////////////////////////////////////////////////////////////////////
+const RTSP_Transport transport_default = {
+    TRANSPORT_UDP, TRANSPORT_UNICAST,
+    TRANSPORT_DEFAULT_PORT, TRANSPORT_DEFAULT_PORT
+};
 
 //////////////////////////////////////////////////////////////////////////////
 /// Default server info
@@ -463,10 +1235,21 @@ const char rtsp_internal_srv_error[] = "RTSP/1.0 500 Internal Server Error";
 //////////////////////////////////////////////////////////////////////////////
 const char rtsp_sess_not_found[] = "RTSP/1.0 454 Session Not Found";
 
+//////////////////////////////////////////////////////////////////////////////
+/// Default Not Found response header
+//////////////////////////////////////////////////////////////////////////////
+const char rtsp_not_found[] = "RTSP/1.0 404 Not Found";
+
+//////////////////////////////////////////////////////////////////////////////
+/// Default Unsupported Transport response header
+//////////////////////////////////////////////////////////////////////////////
+const char rtsp_unsupported_transport[] = "RTSP/1.0 461 Unsupported Transport";
+
 //////////////////////////////////////////////////////////////////////////////
 /// Default Options response -- Public
 //////////////////////////////////////////////////////////////////////////////
-const char options_public_ok[] = "Public: DESCRIBE, SETUP, STOP, TEARDOWN, PLAY";
+const char options_public_ok[] =
+"Public: DESCRIBE, SETUP, STOP, TEARDOWN, PLAY, PAUSE, GET_PARAMETER";
 
 //////////////////////////////////////////////////////////////////////////////
 /// Default Describe response headers and msg body
@@ -476,7 +1259,7 @@ const char describe_ok_headers[] =
 "Content-Length: ";
 
 //////////////////////////////////////////////////////////////////////////////
-/// Default Describe response - SDP
+/// Default Describe response - SDP (used when there is no stream catalog)
 //////////////////////////////////////////////////////////////////////////////
 const char describe_ok_body[] =
 "v=0\r\n"
@@ -487,23 +1270,142 @@ const char describe_ok_body[] =
 "c=IN IP4 127.0.0.1\r\n"
 "t=0 0\r\n"
 "a=recvonly\r\n"
-"m=video 1234 udp 33";
+"m=video 1234 udp 33\r\n";
 
 //////////////////////////////////////////////////////////////////////////////
-/// Templates for RAP messages (CLIENTS ADD and CLIENTS REMOVE)
+/// Response templates (indexed by RTSP_Response_Msg, built in m_init)
+//////////////////////////////////////////////////////////////////////////////
+
+#define TMPL_STATUS(status) \
+    { TMPL_TEXT, status }, { TMPL_TEXT, msg_newline }, \
+    { TMPL_TEXT, msg_cseq }, { TMPL_CSEQ, NULL }
+
+const RTSP_Template_Part tmpl_options_ok[] = {
+    TMPL_STATUS(rtsp_ok), { TMPL_TEXT, msg_newline },
+    { TMPL_TEXT, options_public_ok }, { TMPL_TEXT, msg_end }, { TMPL_END, NULL }
+};
+
+const RTSP_Template_Part tmpl_describe_ok[] = {
+    TMPL_STATUS(rtsp_ok), { TMPL_TEXT, msg_newline },
+    { TMPL_TEXT, msg_date }, { TMPL_DATE, NULL }, { TMPL_TEXT, msg_newline },
+    { TMPL_TEXT, describe_ok_headers }, { TMPL_LENGTH, NULL },
+    { TMPL_TEXT, msg_end }, { TMPL_BODY, NULL }, { TMPL_END, NULL }
+};
+
+const RTSP_Template_Part tmpl_setup_ok[] = {
+    TMPL_STATUS(rtsp_ok), { TMPL_TEXT, msg_newline },
+    { TMPL_TEXT, msg_server }, { TMPL_TEXT, msg_newline },
+    { TMPL_TEXT, msg_sess }, { TMPL_SESSION, NULL }, { TMPL_TEXT, msg_timeout },
+    { TMPL_TEXT, msg_newline }, { TMPL_TEXT, msg_transport },
+    { TMPL_TRANSPORT, NULL }, { TMPL_TEXT, msg_transport_source },
+    { TMPL_TEXT, msg_end }, { TMPL_END, NULL }
+};
+
+const RTSP_Template_Part tmpl_setup_interleaved_ok[] = {
+    TMPL_STATUS(rtsp_ok), { TMPL_TEXT, msg_newline },
+    { TMPL_TEXT, msg_server }, { TMPL_TEXT, msg_newline },
+    { TMPL_TEXT, msg_sess }, { TMPL_SESSION, NULL }, { TMPL_TEXT, msg_timeout },
+    { TMPL_TEXT, msg_newline }, { TMPL_TEXT, msg_transport },
+    { TMPL_TRANSPORT, NULL }, { TMPL_TEXT, msg_end }, { TMPL_END, NULL }
+};
+
+const RTSP_Template_Part tmpl_session_ok[] = {
+    TMPL_STATUS(rtsp_ok), { TMPL_TEXT, msg_newline },
+    { TMPL_TEXT, msg_sess }, { TMPL_SESSION, NULL }, { TMPL_TEXT, msg_end },
+    { TMPL_END, NULL }
+};
+
+const RTSP_Template_Part tmpl_status_ok[] = {
+    TMPL_STATUS(rtsp_ok), { TMPL_TEXT, msg_newline },
+    { TMPL_TEXT, msg_date }, { TMPL_DATE, NULL }, { TMPL_TEXT, msg_end },
+    { TMPL_END, NULL }
+};
+
+const RTSP_Template_Part tmpl_bad_request[] = {
+    TMPL_STATUS(rtsp_bad_request), { TMPL_TEXT, msg_end }, { TMPL_END, NULL }
+};
+
+const RTSP_Template_Part tmpl_not_implemented[] = {
+    TMPL_STATUS(rtsp_not_implemented), { TMPL_TEXT, msg_end }, { TMPL_END, NULL }
+};
+
+const RTSP_Template_Part tmpl_sess_not_found[] = {
+    TMPL_STATUS(rtsp_sess_not_found), { TMPL_TEXT, msg_end }, { TMPL_END, NULL }
+};
+
+const RTSP_Template_Part tmpl_internal_error[] = {
+    TMPL_STATUS(rtsp_internal_srv_error), { TMPL_TEXT, msg_end }, { TMPL_END, NULL }
+};
+
+const RTSP_Template_Part tmpl_not_found[] = {
+    TMPL_STATUS(rtsp_not_found), { TMPL_TEXT, msg_end }, { TMPL_END, NULL }
+};
+
+const RTSP_Template_Part tmpl_unsupported_transport[] = {
+    TMPL_STATUS(rtsp_unsupported_transport), { TMPL_TEXT, msg_end },
+    { TMPL_END, NULL }
+};
+
+const RTSP_Template_Part *response_parts[RESPONSE_TYPES] = {
+    tmpl_options_ok,        // OPTIONS_PUBLIC_OK
+    tmpl_bad_request,       // BAD_REQUEST
+    tmpl_not_implemented,   // NOT_IMPLEMENTED
+    tmpl_describe_ok,       // DESCRIBE_OK
+    tmpl_setup_ok,          // SETUP_OK
+    tmpl_setup_interleaved_ok, // SETUP_INTERLEAVED_OK
+    tmpl_sess_not_found,    // SESSION_NOT_FOUND
+    tmpl_session_ok,        // PLAY_OK
+    tmpl_session_ok,        // STOP_OK
+    tmpl_session_ok,        // TEARDOWN_OK
+    tmpl_session_ok,        // PAUSE_OK
+    tmpl_session_ok,        // GET_PARAMETER_OK
+    tmpl_status_ok,         // GET_PARAMETER_NOSESSION_OK
+    tmpl_internal_error,    // INTERNAL_ERROR
+    tmpl_not_found,         // STREAM_NOT_FOUND
+    tmpl_unsupported_transport // UNSUPPORTED_TRANSPORT
+};
+
+//////////////////////////////////////////////////////////////////////////////
+/// Templates for RAP messages (CLIENTS ADD, REMOVE and EDIT), the last
+/// argument is the optional port line (\a rap_port_msg)
 //////////////////////////////////////////////////////////////////////////////
 
 const char rap_add_msg[] =
 "CLIENTS RAP/1.0\r\n"
 "Target: %s\r\n"
 "Action: add\r\n"
-"Address: %s/32\r\n\r\n";
+"Address: %s/32\r\n%s\r\n";
 
 const char rap_remove_msg[] =
 "CLIENTS RAP/1.0\r\n"
 "Target: %s\r\n"
 "Action: remove\r\n"
-"Address: %s/32\r\n\r\n";
+"Address: %s/32\r\n%s\r\n";
+
+const char rap_pause_msg[] =
+"CLIENTS RAP/1.0\r\n"
+"Target: %s\r\n"
+"Action: edit\r\n"
+"Address: %s/32\r\n"
+"Break: yes\r\n%s\r\n";
+
+const char rap_resume_msg[] =
+"CLIENTS RAP/1.0\r\n"
+"Target: %s\r\n"
+"Action: edit\r\n"
+"Address: %s/32\r\n"
+"Break: no\r\n%s\r\n";
+
+//////////////////////////////////////////////////////////////////////////////
+/// Names of the RAP message types (logs, indexed by enum msg_type)
+//////////////////////////////////////////////////////////////////////////////
+const char *const rap_type_names[] = { "add", "remove", "pause", "resume" };
+
+//////////////////////////////////////////////////////////////////////////////
+/// Port of the client in RAP messages (extension header, clients behind one
+/// NAT share the address)
+//////////////////////////////////////////////////////////////////////////////
+const char rap_port_msg[] = "Port: %u\r\n";
 
 #endif
 
@@ -0,0 +1,384 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Stream catalog of the RTSP module. The catalog is a key file with one
+/// group per stream, named by the path of the stream URL:
+///
+/// \code
+/// [/lectures/d1]
+/// Listener=listener/udp-0.0.0.0:1234
+/// SDP-File=/etc/rum2/d1.sdp
+///
+/// [/lectures/d2]
+/// SDP=v=0\no=- 0 0 IN IP4 127.0.0.1\ns=D2\nc=IN IP4 127.0.0.1\nt=0 0\n...
+/// Multicast-Group=239.1.2.3
+/// Multicast-Port=5004
+/// Multicast-TTL=8
+/// \endcode
+///
+/// Streams without a Listener use the module's listener. Streams with a
+/// Multicast-Group may be set up as multicast (RTP on the even port, RTCP on
+/// the next one); all their multicast viewers share the group. The DESCRIBE
+/// response of every stream is built when the catalog is loaded, so serving
+/// it costs one hash lookup. SETUP requests of the tracks of a stream
+/// (\a catalog_route) are routed to the stream's listener.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#if HAVE_CONFIG_H
+    #include "config.h"
+#endif
+
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "rtsp_catalog.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Catalog key - listener ID.
+//////////////////////////////////////////////////////////////////////////////
+#define CATALOG_LISTENER "Listener"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Catalog key - session description.
+//////////////////////////////////////////////////////////////////////////////
+#define CATALOG_SDP "SDP"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Catalog key - file with the session description.
+//////////////////////////////////////////////////////////////////////////////
+#define CATALOG_SDP_FILE "SDP-File"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Catalog key - multicast group of the stream.
+//////////////////////////////////////////////////////////////////////////////
+#define CATALOG_MULTICAST_GROUP "Multicast-Group"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Catalog key - RTP port of the multicast group.
+//////////////////////////////////////////////////////////////////////////////
+#define CATALOG_MULTICAST_PORT "Multicast-Port"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Catalog key - time to live of the multicast packets.
+//////////////////////////////////////////////////////////////////////////////
+#define CATALOG_MULTICAST_TTL_KEY "Multicast-TTL"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Get the path of a stream URL - "rtsp://host:port" and trailing slashes
+/// are dropped.
+///
+/// \param url The URL (need not be null-terminated).
+/// \param len Length of \a url.
+/// \param path Target buffer (CATALOG_PATH_MAX bytes).
+/// \return Zero on success, -1 if the path is too long.
+//////////////////////////////////////////////////////////////////////////////
+static int catalog_path(const char *url, size_t len, char *path){
+    const char *slash;
+
+    if(len >= sizeof("rtsp://") - 1
+       && g_ascii_strncasecmp(url, "rtsp://", sizeof("rtsp://") - 1) == 0){
+        url += sizeof("rtsp://") - 1;
+        len -= sizeof("rtsp://") - 1;
+        slash = memchr(url, '/', len);
+        len -= (slash != NULL) ? (size_t) (slash - url) : len;
+        url = slash;
+    }
+
+    while(len > 1 && url[len - 1] == '/') len--;
+
+    if(len >= CATALOG_PATH_MAX) return -1;
+
+    if(len == 0){
+        path[0] = '/';
+        path[1] = '\0';
+    }
+    else{
+        memcpy(path, url, len);
+        path[len] = '\0';
+    }
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Normalize a session description - lines end with CRLF.
+///
+/// \param sdp The description (any line ends).
+/// \return The description (newly allocated).
+//////////////////////////////////////////////////////////////////////////////
+static char *catalog_sdp(const char *sdp){
+    GString *out = g_string_sized_new(strlen(sdp) + 32);
+    const char *end;
+
+    while(*sdp != '\0'){
+        end = sdp + strcspn(sdp, "\r\n");
+        if(end > sdp){
+            g_string_append_len(out, sdp, end - sdp);
+            g_string_append(out, "\r\n");
+        }
+        sdp = end + strspn(end, "\r\n");
+    }
+
+    return g_string_free(out, FALSE);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Check that an address is a multicast group.
+///
+/// \param addr The address.
+/// \return TRUE for a multicast address.
+//////////////////////////////////////////////////////////////////////////////
+static gboolean catalog_is_multicast(const IN_ADDR *addr){
+#if USE_IP6
+    return IN6_IS_ADDR_MULTICAST(addr);
+#else
+    return IN_MULTICAST(ntohl(addr->s_addr));
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Read the multicast transport of a stream.
+///
+/// \param keys The catalog.
+/// \param group Catalog group of the stream.
+/// \param multicast Target transport (no delivery if there is no group).
+/// \param error Reason of the failure.
+/// \return TRUE on success, FALSE if the group, port or TTL is invalid.
+//////////////////////////////////////////////////////////////////////////////
+static gboolean catalog_multicast(GKeyFile *keys, const char *group,
+                                  RTSP_Transport *multicast, GError **error){
+    char *address;
+    gint port;
+    gint ttl = CATALOG_MULTICAST_TTL;
+
+    memset(multicast, 0, sizeof(*multicast));
+
+    address = g_key_file_get_string(keys, group, CATALOG_MULTICAST_GROUP, NULL);
+    if(address == NULL) return TRUE;
+
+    if(inet_pton(AF_INET46, address, &multicast->destination) != 1
+       || !catalog_is_multicast(&multicast->destination)){
+        g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                    "Invalid multicast group %s of stream %s", address, group);
+        g_free(address);
+        return FALSE;
+    }
+    g_free(address);
+
+    port = g_key_file_get_integer(keys, group, CATALOG_MULTICAST_PORT, NULL);
+    if(port <= 0 || port >= G_MAXUINT16 || (port & 1) != 0){
+        g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                    "Multicast port of stream %s must be even (1-65534)", group);
+        return FALSE;
+    }
+
+    if(g_key_file_has_key(keys, group, CATALOG_MULTICAST_TTL_KEY, NULL))
+        ttl = g_key_file_get_integer(keys, group, CATALOG_MULTICAST_TTL_KEY,
+                                     NULL);
+    if(ttl <= 0 || ttl > G_MAXUINT8){
+        g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                    "Invalid multicast TTL of stream %s", group);
+        return FALSE;
+    }
+
+    multicast->profile = TRANSPORT_RTP_AVP;
+    multicast->delivery = TRANSPORT_MULTICAST;
+    multicast->client_port = (guint16) port;
+    multicast->client_port_end = (guint16) (port + 1);
+    multicast->ttl = (guint8) ttl;
+
+    return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Free a stream (hash table value).
+///
+/// \param data The stream (RTSP_Stream).
+//////////////////////////////////////////////////////////////////////////////
+static void catalog_stream_free(gpointer data){
+    RTSP_Stream *stream = (RTSP_Stream *) data;
+
+    template_clean(&stream->describe);
+    g_free(stream->path);
+    g_free(stream->sdp);
+    g_free(stream);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Load a catalog and build the DESCRIBE responses of its streams.
+///
+/// \param file The catalog file.
+/// \param listener_id Listener of the streams without their own.
+/// \param describe Template of the DESCRIBE response (TMPL_BODY is the SDP).
+/// \param error Reason of the failure.
+/// \return The catalog (one reference) or NULL on failure.
+//////////////////////////////////////////////////////////////////////////////
+RTSP_Catalog *catalog_load(const char *file, const char *listener_id,
+                           const RTSP_Template_Part *describe,
+                           GError **error){
+    RTSP_Catalog *catalog;
+    RTSP_Stream *stream;
+    RTSP_Transport multicast;
+    GKeyFile *keys;
+    char path[CATALOG_PATH_MAX];
+    char **groups;
+    char *sdp;
+    char *sdp_file;
+    char *listener;
+    gsize i;
+
+    keys = g_key_file_new();
+    if(!g_key_file_load_from_file(keys, file, G_KEY_FILE_NONE, error)){
+        g_key_file_free(keys);
+        return NULL;
+    }
+
+    catalog = g_new0(RTSP_Catalog, 1);
+    catalog->refs = 1;
+    catalog->streams = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                             catalog_stream_free);
+
+    groups = g_key_file_get_groups(keys, NULL);
+    for(i = 0; groups[i] != NULL; i++){
+        if(catalog_path(groups[i], strlen(groups[i]), path) != 0){
+            g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                        "Stream path too long: %s", groups[i]);
+            break;
+        }
+
+        if(!catalog_multicast(keys, groups[i], &multicast, error)) break;
+
+        // The description is given inline or in a file of its own
+        sdp = g_key_file_get_string(keys, groups[i], CATALOG_SDP, NULL);
+        sdp_file = g_key_file_get_string(keys, groups[i], CATALOG_SDP_FILE,
+                                         NULL);
+        if(sdp == NULL && sdp_file != NULL)
+            g_file_get_contents(sdp_file, &sdp, NULL, error);
+        g_free(sdp_file);
+
+        if(sdp == NULL){
+            if(error != NULL && *error == NULL)
+                g_set_error(error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND,
+                            "No SDP for stream %s", groups[i]);
+            break;
+        }
+
+        stream = g_new0(RTSP_Stream, 1);
+        stream->path = g_strdup(path);
+        stream->listener_id = g_intern_string(listener_id);
+        if((listener = g_key_file_get_string(keys, groups[i],
+                                             CATALOG_LISTENER, NULL)) != NULL){
+            stream->listener_id = g_intern_string(listener);
+            g_free(listener);
+        }
+        stream->sdp = catalog_sdp(sdp);
+        stream->multicast = multicast;
+        g_free(sdp);
+
+        template_build(&stream->describe, describe, stream->sdp);
+        g_hash_table_replace(catalog->streams, stream->path, stream);
+    }
+
+    // All or nothing - a broken catalog does not replace a working one
+    if(groups[i] != NULL){
+        catalog_unref(catalog);
+        catalog = NULL;
+    }
+
+    g_strfreev(groups);
+    g_key_file_free(keys);
+
+    return catalog;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Find the stream of a request URL.
+///
+/// \param catalog The catalog.
+/// \param url The URL (RTSP_Request::object, need not be null-terminated).
+/// \param len Length of \a url.
+/// \return The stream or NULL if there is no such stream.
+//////////////////////////////////////////////////////////////////////////////
+const RTSP_Stream *catalog_lookup(const RTSP_Catalog *catalog,
+                                  const char *url, size_t len){
+    char path[CATALOG_PATH_MAX];
+
+    if(catalog_path(url, len, path) != 0) return NULL;
+
+    return (const RTSP_Stream *) g_hash_table_lookup(catalog->streams, path);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Find the stream a URL belongs to - the stream itself or the longest
+/// stream path the URL starts with (track URLs like stream/trackID=0).
+///
+/// \param catalog The catalog.
+/// \param url The URL (RTSP_Request::object, need not be null-terminated).
+/// \param len Length of \a url.
+/// \return The stream or NULL if there is no such stream.
+//////////////////////////////////////////////////////////////////////////////
+const RTSP_Stream *catalog_route(const RTSP_Catalog *catalog,
+                                 const char *url, size_t len){
+    const RTSP_Stream *stream;
+    char path[CATALOG_PATH_MAX];
+    char *slash;
+
+    if(catalog_path(url, len, path) != 0) return NULL;
+
+    for(;;){
+        stream = (const RTSP_Stream *) g_hash_table_lookup(catalog->streams,
+                                                           path);
+        if(stream != NULL || strcmp(path, "/") == 0) return stream;
+
+        // Drop the last segment (up to the root)
+        if((slash = strrchr(path, '/')) == NULL) return NULL;
+        slash[slash == path ? 1 : 0] = '\0';
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Take a reference to a catalog.
+///
+/// \param catalog The catalog.
+/// \return The catalog.
+//////////////////////////////////////////////////////////////////////////////
+RTSP_Catalog *catalog_ref(RTSP_Catalog *catalog){
+    g_atomic_int_inc(&catalog->refs);
+
+    return catalog;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Drop a reference to a catalog, the last one frees it.
+///
+/// \param catalog The catalog.
+//////////////////////////////////////////////////////////////////////////////
+void catalog_unref(RTSP_Catalog *catalog){
+    if(!g_atomic_int_dec_and_test(&catalog->refs)) return;
+
+    g_hash_table_destroy(catalog->streams);
+    g_free(catalog);
+}
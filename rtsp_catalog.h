@@ -0,0 +1,100 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Stream catalog of the RTSP module - URL to SDP and listener mapping.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef MSGIFACE_RTSP_CATALOG_H
+#define MSGIFACE_RTSP_CATALOG_H
+
+#include <glib.h>
+
+#include "rtsp_response.h"
+#include "rtsp_transport.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Max. length of a stream path (longer URLs are never found).
+//////////////////////////////////////////////////////////////////////////////
+#define CATALOG_PATH_MAX 256
+
+//////////////////////////////////////////////////////////////////////////////
+/// Default time to live of the multicast packets of a stream.
+//////////////////////////////////////////////////////////////////////////////
+#define CATALOG_MULTICAST_TTL 16
+
+//////////////////////////////////////////////////////////////////////////////
+/// One stream of the catalog.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    char *path;                         ///< Path of the stream URL (key).
+    const char *listener_id;            ///< Listener the clients are added to
+                                        ///< (interned, never freed).
+    char *sdp;                          ///< Session description.
+    RTSP_Response_Template describe;    ///< Prebuilt DESCRIBE response.
+    RTSP_Transport multicast;           ///< Multicast transport of the stream
+                                        ///< (no delivery if it has no group).
+}RTSP_Stream;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Stream catalog. A loaded catalog is never modified, a reload builds a new
+/// one; the catalog is freed when the last reference is dropped (the server,
+/// the workers and the responses still waiting to be sent hold references).
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    volatile gint refs;                 ///< Reference count.
+    GHashTable *streams;                ///< Streams (path -> RTSP_Stream).
+}RTSP_Catalog;
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_catalog.c
+//////////////////////////////////////////////////////////////////////////////
+extern RTSP_Catalog *catalog_load(const char *file,
+                                  const char *listener_id,
+                                  const RTSP_Template_Part *describe,
+                                  GError **error);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_catalog.c
+//////////////////////////////////////////////////////////////////////////////
+extern const RTSP_Stream *catalog_lookup(const RTSP_Catalog *catalog,
+                                         const char *url, size_t len);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_catalog.c
+//////////////////////////////////////////////////////////////////////////////
+extern const RTSP_Stream *catalog_route(const RTSP_Catalog *catalog,
+                                        const char *url, size_t len);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_catalog.c
+//////////////////////////////////////////////////////////////////////////////
+extern RTSP_Catalog *catalog_ref(RTSP_Catalog *catalog);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_catalog.c
+//////////////////////////////////////////////////////////////////////////////
+extern void catalog_unref(RTSP_Catalog *catalog);
+
+#endif
@@ -30,6 +30,7 @@
 #define LIBERIS_HEADERS_H__
 
 #include <glib.h>
+#include <stdint.h>
 
 /**
  * @defgroup headers Header handling
@@ -99,7 +100,47 @@ static const char eris_hdr_www_authenticate[] = "WWW-Authenticate";
  * @}
  */
 
+/**
+ * @brief Well-known headers
+ *
+ * Headers which are resolved to an identifier already by the parser,
+ * so that looking them up later is a plain array access.
+ */
+typedef enum {
+  ERIS_HDR_CSEQ,
+  ERIS_HDR_SESSION,
+  ERIS_HDR_TRANSPORT,
+  ERIS_HDR_RANGE,
+  ERIS_HDR_CONTENT_LENGTH,
+  ERIS_HDR_USER_AGENT,
+  /** Any other header (also the number of well-known headers) */
+  ERIS_HDR_OTHER
+} eris_header_id;
+
+/**
+ * @brief Maximum number of headers stored by eris_parse_headers_slices()
+ */
+#define ERIS_MAX_HEADERS 32
+
+/**
+ * @brief Position of a header inside the parsed string
+ *
+ * Offsets are relative to the beginning of the string passed to
+ * eris_parse_headers_slices(); nothing is copied.
+ */
+typedef struct {
+  eris_header_id id;
+  uint16_t name_offset;
+  uint16_t name_length;
+  uint16_t value_offset;
+  uint16_t value_length;
+} eris_header_slice;
+
 size_t eris_parse_headers(const char *hdrs_string, size_t len, GHashTable **table);
+size_t eris_parse_headers_slices(const char *hdrs_string, size_t len,
+                                 eris_header_slice *slices, size_t max,
+                                 size_t *count);
+eris_header_id eris_header_lookup(const char *name, size_t len);
 void eris_flatten_headers(GHashTable *hdrs, GString *str);
 
 /**
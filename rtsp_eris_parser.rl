@@ -45,9 +45,21 @@
       . ':' . SP . print+ > hdr_val_start % hdr_val_end . CRLF;
 
   action save_header {
-      g_hash_table_insert(*table,
-                          g_strndup(hdr, hdr_size),
-                          g_strndup(hdr_val, hdr_val_size));
+      if ( table != NULL ) {
+        g_hash_table_insert(*table,
+                            g_strndup(hdr, hdr_size),
+                            g_strndup(hdr_val, hdr_val_size));
+      } else {
+        if ( *count == max || p - hdrs_string > G_MAXUINT16 )
+          return 0;
+
+        slices[*count].id = eris_header_lookup(hdr, hdr_size);
+        slices[*count].name_offset = hdr - hdrs_string;
+        slices[*count].name_length = hdr_size;
+        slices[*count].value_offset = hdr_val - hdrs_string;
+        slices[*count].value_length = hdr_val_size;
+        (*count)++;
+      }
   }
 
   action exit_parser {
@@ -58,6 +70,76 @@
 
 }%%
 
+/**
+ * @brief Common parser for eris_parse_headers() and
+ *        eris_parse_headers_slices()
+ *
+ * Headers are stored in @p table when it is not NULL, in the @p slices
+ * array otherwise.
+ */
+static size_t parse_headers(const char *hdrs_string, size_t len,
+                            GHashTable **table,
+                            eris_header_slice *slices, size_t max,
+                            size_t *count)
+{
+  const char *p = hdrs_string, *pe = p + len, *eof = pe;
+
+  int cs, line;
+
+  const char *hdr = NULL, *hdr_val = NULL;
+  size_t hdr_size = 0, hdr_val_size = 0;
+
+  %% write data noerror;
+  %% write init;
+  %% write exec;
+
+  if ( cs < headers_parser_first_final )
+    return 0;
+
+  cs = headers_parser_en_main;
+
+  return p-hdrs_string;
+}
+
+/**
+ * @brief Resolve a header name to a well-known header identifier
+ * @param name The header name (not NULL-terminated)
+ * @param len Length of the header name
+ *
+ * @return The identifier, ERIS_HDR_OTHER for any other header
+ */
+eris_header_id eris_header_lookup(const char *name, size_t len)
+{
+  switch ( len ) {
+  case sizeof(eris_hdr_cseq) - 1:
+    if ( g_ascii_strncasecmp(name, eris_hdr_cseq, len) == 0 )
+      return ERIS_HDR_CSEQ;
+    break;
+  case sizeof(eris_hdr_range) - 1:
+    if ( g_ascii_strncasecmp(name, eris_hdr_range, len) == 0 )
+      return ERIS_HDR_RANGE;
+    break;
+  case sizeof(eris_hdr_session) - 1:
+    if ( g_ascii_strncasecmp(name, eris_hdr_session, len) == 0 )
+      return ERIS_HDR_SESSION;
+    break;
+  case sizeof(eris_hdr_transport) - 1:
+    if ( g_ascii_strncasecmp(name, eris_hdr_transport, len) == 0 )
+      return ERIS_HDR_TRANSPORT;
+    break;
+  case sizeof(eris_hdr_user_agent) - 1:
+    if ( g_ascii_strncasecmp(name, eris_hdr_user_agent, len) == 0 )
+      return ERIS_HDR_USER_AGENT;
+    break;
+  case sizeof(eris_hdr_content_length) - 1:
+    if ( g_ascii_strncasecmp(name, eris_hdr_content_length, len) == 0 )
+      return ERIS_HDR_CONTENT_LENGTH;
+    break;
+  }
+
+  return ERIS_HDR_OTHER;
+}
+
 /**
  * @brief Parse a string containing RTSP headers in a GHashTable
  * @param hdrs_string The string containing the series of headers
@@ -79,32 +161,49 @@
  * Whenever the returned size is zero, the parser encountered a
  * problem and couldn't complete the parsing, the @p table parameter
  * is undefined.
+ *
+ * Every header is copied; eris_parse_headers_slices() should be used
+ * on hot paths, this variant is kept for debug dumps.
  */
 size_t eris_parse_headers(const char *hdrs_string, size_t len, GHashTable **table)
 {
-  const char *p = hdrs_string, *pe = p + len, *eof = pe;
-
-  int cs, line;
-
-  const char *hdr = NULL, *hdr_val = NULL;
-  size_t hdr_size = 0, hdr_val_size = 0;
+  size_t ret;
 
   /* Create the new hash table */
   *table = g_hash_table_new_full(g_str_hash, g_str_equal,
                                  g_free, g_free);
 
-  {
-    %% write data noerror;
-    %% write init;
-    %% write exec;
+  ret = parse_headers(hdrs_string, len, table, NULL, 0, NULL);
 
-    if ( cs < headers_parser_first_final ) {
-      g_hash_table_destroy(*table);
-      return 0;
-    }
+  if ( ret == 0 )
+    g_hash_table_destroy(*table);
 
-    cs = headers_parser_en_main;
-  }
+  return ret;
+}
 
-  return p-hdrs_string;
+/**
+ * @brief Parse a string containing RTSP headers without copying them
+ * @param hdrs_string The string containing the series of headers
+ * @param len Length of the parameters string, included final newline.
+ * @param slices Array where the position of each header is written.
+ * @param max Number of items in @p slices.
+ * @param count Pointer where to write the number of headers found.
+ *
+ * @return The number of characters parsed from the input
+ *
+ * Same as eris_parse_headers() but nothing is allocated: every header
+ * is described by offsets into @p hdrs_string and well-known headers
+ * are identified by eris_header_lookup() while parsing.
+ *
+ * Whenever the returned size is zero, the parser encountered a
+ * problem (or more than @p max headers) and the content of @p slices
+ * is undefined.
+ */
+size_t eris_parse_headers_slices(const char *hdrs_string, size_t len,
+                                 eris_header_slice *slices, size_t max,
+                                 size_t *count)
+{
+  *count = 0;
+
+  return parse_headers(hdrs_string, len, NULL, slices, max, count);
 }
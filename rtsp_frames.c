@@ -0,0 +1,208 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Interleaved frames of the RTSP module (RFC 2326, section 10.12). Packets
+/// of the reflector are sent over the RTSP connection of clients which
+/// cannot receive UDP, each one as '$', the channel, the length (network
+/// order) and the packet itself.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#if HAVE_CONFIG_H
+    #include "config.h"
+#endif
+
+#include <string.h>
+
+#include "rtsp_frames.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Prepare an empty ring.
+///
+/// \param ring The ring.
+/// \param size Number of frames (rounded up to a power of two, at least 2).
+/// \param channel Channel of the frames.
+//////////////////////////////////////////////////////////////////////////////
+void frames_init(RTSP_Frame_Ring *ring, guint size, guint8 channel){
+    guint slots = 2;
+
+    while(slots < size) slots <<= 1;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->frames = g_new0(RTSP_Frame, slots);
+    ring->mask = slots - 1;
+    ring->channel = channel;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Release all the frames and free the ring.
+///
+/// \param ring The ring.
+//////////////////////////////////////////////////////////////////////////////
+void frames_clean(RTSP_Frame_Ring *ring){
+    if(ring->frames == NULL) return;
+
+    ring->offset = 0;
+    frames_drop(ring);
+    g_free(ring->frames);
+    ring->frames = NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Release the frames not being sent. A frame sent partially stays, the
+/// connection would be out of sync without the rest of it.
+///
+/// \param ring The ring.
+//////////////////////////////////////////////////////////////////////////////
+void frames_drop(RTSP_Frame_Ring *ring){
+    RTSP_Frame *frame;
+    guint keep = (ring->offset > 0) ? 1 : 0;
+
+    if(ring->frames == NULL) return;
+
+    while(ring->tail - ring->head > keep){
+        frame = &ring->frames[--ring->tail & ring->mask];
+        data_free(frame->data);
+        frame->data = NULL;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Append a packet to the ring (a reference is taken, nothing is copied).
+/// Packets longer than a frame can carry are dropped.
+///
+/// \param ring The ring.
+/// \param data The packet.
+/// \param policy What to do if the ring is full.
+/// \return FALSE if the ring is full and \a policy is FRAMES_CLOSE.
+//////////////////////////////////////////////////////////////////////////////
+gboolean frames_push(RTSP_Frame_Ring *ring, struct data *data,
+                     RTSP_Frame_Policy policy){
+    RTSP_Frame *frame;
+    guint victim;
+
+    if(data->size <= 0 || data->size > G_MAXUINT16){
+        ring->dropped++;
+        return TRUE;
+    }
+
+    // Full ring
+    if(ring->tail - ring->head > ring->mask){
+        switch(policy){
+            case FRAMES_CLOSE:
+                return FALSE;
+            case FRAMES_DROP_OLDEST:
+                // The frame being sent moves in place of the dropped one
+                victim = ring->head + ((ring->offset > 0) ? 1 : 0);
+                data_free(ring->frames[victim & ring->mask].data);
+                if(victim != ring->head)
+                    ring->frames[victim & ring->mask]
+                        = ring->frames[ring->head & ring->mask];
+                ring->frames[ring->head & ring->mask].data = NULL;
+                ring->head++;
+                break;
+            default:
+                ring->dropped++;
+                return TRUE;
+        }
+        ring->dropped++;
+    }
+
+    data_ref(data);
+
+    frame = &ring->frames[ring->tail++ & ring->mask];
+    frame->data = data;
+    frame->header[0] = '$';
+    frame->header[1] = ring->channel;
+    frame->header[2] = (unsigned char) (data->size >> 8);
+    frame->header[3] = (unsigned char) data->size;
+
+    return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Describe the frames waiting in the ring for writev() - two segments per
+/// frame (header and packet), the part already sent is skipped.
+///
+/// \param ring The ring.
+/// \param iov Target segments.
+/// \param max Size of \a iov (at least 2).
+/// \return Number of segments filled in.
+//////////////////////////////////////////////////////////////////////////////
+int frames_iov(const RTSP_Frame_Ring *ring, struct iovec *iov, int max){
+    const RTSP_Frame *frame;
+    size_t skip = ring->offset;     // sent part of the first frame
+    int count = 0;
+    guint i;
+
+    for(i = ring->head; i != ring->tail && count + 2 <= max; i++){
+        frame = &ring->frames[i & ring->mask];
+
+        if(skip < FRAME_HEADER){
+            iov[count].iov_base = (void *) (frame->header + skip);
+            iov[count++].iov_len = FRAME_HEADER - skip;
+            skip = 0;
+        }
+        else{
+            skip -= FRAME_HEADER;
+        }
+
+        iov[count].iov_base = (char *) frame->data->buffer + skip;
+        iov[count++].iov_len = frame->data->size - skip;
+        skip = 0;
+    }
+
+    return count;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Account for bytes written, the frames sent completely are released.
+///
+/// \param ring The ring.
+/// \param bytes Number of bytes written (from \a frames_iov segments).
+//////////////////////////////////////////////////////////////////////////////
+void frames_consume(RTSP_Frame_Ring *ring, size_t bytes){
+    RTSP_Frame *frame;
+    size_t length;
+
+    bytes += ring->offset;
+
+    while(ring->head != ring->tail){
+        frame = &ring->frames[ring->head & ring->mask];
+        length = FRAME_HEADER + frame->data->size;
+
+        if(bytes < length){
+            ring->offset = bytes;
+            return;
+        }
+
+        bytes -= length;
+        data_free(frame->data);
+        frame->data = NULL;
+        ring->head++;
+        ring->sent++;
+    }
+
+    ring->offset = 0;
+}
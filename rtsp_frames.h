@@ -0,0 +1,116 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Interleaved frames of the RTSP module - per-client ring of reflector
+/// packets waiting to be sent over the RTSP connection ($-framed).
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef MSGIFACE_RTSP_FRAMES_H
+#define MSGIFACE_RTSP_FRAMES_H
+
+#include <glib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <rum2/data.h>
+
+//////////////////////////////////////////////////////////////////////////////
+/// Length of the frame header ('$', channel, 16-bit length).
+//////////////////////////////////////////////////////////////////////////////
+#define FRAME_HEADER 4
+
+//////////////////////////////////////////////////////////////////////////////
+/// What to do with a packet for a full ring (a reader slower than the
+/// stream).
+//////////////////////////////////////////////////////////////////////////////
+typedef enum {
+    FRAMES_DROP_NEWEST,     ///< Drop the packet.
+    FRAMES_DROP_OLDEST,     ///< Drop the oldest packet not being sent.
+    FRAMES_CLOSE            ///< Give up on the client.
+} RTSP_Frame_Policy;
+
+//////////////////////////////////////////////////////////////////////////////
+/// One frame - a reference to the reflector's buffer and the header.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    struct data *data;                  ///< Packet (referenced).
+    unsigned char header[FRAME_HEADER]; ///< Frame header.
+}RTSP_Frame;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Ring of frames (power of two). \a head and \a tail run freely, the ring
+/// is full when they are \a mask + 1 apart. The payloads are never copied,
+/// the frames are written straight from the reflector's buffers.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    RTSP_Frame *frames;     ///< The ring (NULL if not used).
+    guint mask;             ///< Number of frames minus one.
+    guint head;             ///< First frame to be sent.
+    guint tail;             ///< Next free frame.
+    size_t offset;          ///< Bytes of the first frame already sent.
+    guint8 channel;         ///< Channel of the frames (interleaved=).
+    unsigned long sent;     ///< Frames sent completely.
+    unsigned long dropped;  ///< Frames dropped (full ring, too long).
+}RTSP_Frame_Ring;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Are there frames waiting in the ring?
+//////////////////////////////////////////////////////////////////////////////
+#define frames_pending(ring) ((ring)->head != (ring)->tail)
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_frames.c
+//////////////////////////////////////////////////////////////////////////////
+extern void frames_init(RTSP_Frame_Ring *ring, guint size, guint8 channel);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_frames.c
+//////////////////////////////////////////////////////////////////////////////
+extern void frames_clean(RTSP_Frame_Ring *ring);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_frames.c
+//////////////////////////////////////////////////////////////////////////////
+extern void frames_drop(RTSP_Frame_Ring *ring);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_frames.c
+//////////////////////////////////////////////////////////////////////////////
+extern gboolean frames_push(RTSP_Frame_Ring *ring, struct data *data,
+                            RTSP_Frame_Policy policy);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_frames.c
+//////////////////////////////////////////////////////////////////////////////
+extern int frames_iov(const RTSP_Frame_Ring *ring, struct iovec *iov,
+                      int max);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_frames.c
+//////////////////////////////////////////////////////////////////////////////
+extern void frames_consume(RTSP_Frame_Ring *ring, size_t bytes);
+
+#endif
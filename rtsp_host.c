@@ -0,0 +1,874 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// In-process host for the shipped modules (rtsp.so, filter.so) - loads a
+/// module with dlopen and runs it through its module interface the way the
+/// reflector does (initialize, name, init, main in its own thread, stop,
+/// clean), without the rest of RUM2. The host implements just the part of
+/// the reflector core the modules link against (parameters, logging, error
+/// contexts, data/meta reference counting, data queues, processor/master)
+/// and the burst functions filter.so looks for (see filter.h), the symbols
+/// are exported to the module by linking the host -rdynamic.
+///
+/// Synthetic packets are fed to the module:
+/// - a processor (filter.so) gets \a -n packets through its input queue,
+///   \a -m percent of them starting with \a -d (the Filter sample); the
+///   packets the processor passes on to processor/master are counted.
+///   With \a -p all of them are queued before the module starts, so the
+///   run measures draining a full queue (the processor is never starved
+///   by the feeder). With \a -q (\a -Q) the input queue is a ring of
+///   SLOTS slots with single (multi) producer push, see queue_ring.c;
+///   packets dropped by a full ring count as done.
+/// - a msg-interface (rtsp.so) gets packets from listener \a -l through
+///   push_data at \a -r packets per second for \a -t seconds; RTSP traffic
+///   comes from outside (rtsp_load_bench, its -s stub is the RAP socket).
+///
+/// The module runs in this process, so perf and the microbenchmarks see the
+/// exact shipped shared object:
+///
+///     rtsp_load_bench -s /tmp/reflector -c 0 &
+///     perf record -g rtsp_host -o Socket=/tmp/reflector -t 30 build/rtsp.so
+///     rtsp_host -n 10000000 -m 10 build/filter.so
+///     rtsp_host -n 200000 -m 10 -p -o Filter-Batch=1 build/filter.so
+///
+/// Usage: rtsp_host [-o NAME=VALUE]... [-t SECONDS] [-n PACKETS]
+///        [-r RATE] [-s SIZE] [-m MATCH%] [-d SAMPLE] [-l LISTENER]
+///        [-v LEVEL] [-p] [-q SLOTS | -Q SLOTS] MODULE.so
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <dlfcn.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <rum2/error.h>
+#include <rum2/module.h>
+#include <rum2/modparam.h>
+#include <rum2/log.h>
+#include <rum2/queue.h>
+#include <rum2/data.h>
+#include <rum2/processor.h>
+
+#include "queue_ring.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Defaults of the command line options.
+//////////////////////////////////////////////////////////////////////////////
+#define HOST_SECONDS 10
+#define HOST_PACKETS 1000000
+#define HOST_SIZE 1316
+#define HOST_SAMPLE "ping"
+#define HOST_LISTENER "listener/udp-0.0.0.0:1234"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Packets fed to a processor and not passed on yet (the feeder waits).
+//////////////////////////////////////////////////////////////////////////////
+#define HOST_BACKLOG 4096
+
+//////////////////////////////////////////////////////////////////////////////
+/// Names of the module classes (module_class()).
+//////////////////////////////////////////////////////////////////////////////
+static char *class_names[] = {
+    "reflector", "listener", "processor", "sender", "aaa", "management",
+    "msg-interface"
+};
+
+//////////////////////////////////////////////////////////////////////////////
+/// Host state shared by the core functions below.
+//////////////////////////////////////////////////////////////////////////////
+static struct {
+    int log_level;                  ///< Highest level printed.
+    volatile int stopping;          ///< Module threads leave their waits.
+    struct module master;           ///< processor/master pseudomodule.
+    pthread_mutex_t lock;           ///< Guards the counters below.
+    pthread_cond_t drained;         ///< Backlog fell below the limit.
+    unsigned long passed;           ///< Packets passed to processor/master.
+    unsigned long masked;           ///< Passed with no valid client.
+    unsigned long data_freed;       ///< Data released by the last reference.
+} host = {
+    LOG_NOTICE, 0, { .id = { MC_PROCESSOR, PROCESSOR_MASTER } },
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, 0
+};
+
+//////////////////////////////////////////////////////////////////////////////
+/// Monotonic time in seconds.
+//////////////////////////////////////////////////////////////////////////////
+static double now(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ---------------------------------------------------------------------- */
+/* Reflector core used by the modules                                      */
+/* ---------------------------------------------------------------------- */
+
+char *module_class(enum module_class cls){
+    if((unsigned) cls >= sizeof(class_names) / sizeof(class_names[0]))
+        return "unknown";
+    return class_names[cls];
+}
+
+struct rum_error_ctx *rum_error_init(void){
+    return calloc(1, sizeof(struct rum_error_ctx));
+}
+
+void rum_error_free(struct rum_error_ctx *errctx){
+    free(errctx);
+}
+
+void rum_error(struct rum_error_ctx *errctx, enum rum_error err){
+    errctx->errnos[0] = err;
+    errctx->count = 1;
+}
+
+void rum_error_push(struct rum_error_ctx *errctx, enum rum_error err){
+    if(errctx->count < RUM_ERRCTX_MAX)
+        errctx->errnos[errctx->count++] = err;
+}
+
+enum rum_error rum_error_pop(struct rum_error_ctx *errctx){
+    return errctx->count > 0 ? errctx->errnos[--errctx->count] : RUM_ENO_MEMORY;
+}
+
+void vlog(enum module_class mclass, char *name, enum log_level level,
+          char *msg, va_list ap){
+    if((int) level > host.log_level) return;
+
+    flockfile(stderr);
+    fprintf(stderr, "%.3f [%d] %s/%s: ", now(), level, module_class(mclass),
+            name);
+    vfprintf(stderr, msg, ap);
+    fputc('\n', stderr);
+    funlockfile(stderr);
+}
+
+void rlog(enum module_class mclass, char *name, enum log_level level,
+          char *msg, ...){
+    va_list ap;
+
+    va_start(ap, msg);
+    vlog(mclass, name, level, msg, ap);
+    va_end(ap);
+}
+
+void logm(const struct module_id *module, enum log_level level,
+          char *msg, ...){
+    va_list ap;
+
+    va_start(ap, msg);
+    vlog(module->mclass, module->name, level, msg, ap);
+    va_end(ap);
+}
+
+void logerror(enum module_class mclass, char *name, enum log_level level,
+              struct rum_error_ctx *errctx, char *fmt, ...){
+    va_list ap;
+
+    va_start(ap, fmt);
+    vlog(mclass, name, level, fmt, ap);
+    va_end(ap);
+    if(errctx != NULL && errctx->count > 0)
+        rlog(mclass, name, level, "error code %d",
+             errctx->errnos[errctx->count - 1]);
+}
+
+void logerrorm(struct module *module, enum log_level level){
+    int i;
+
+    for(i = module->errctx->count - 1; i >= 0; i--)
+        rlog(module->id.mclass, module->id.name, level, "error code %d",
+             module->errctx->errnos[i]);
+    module->errctx->count = 0;
+}
+
+int modparam_init(struct module *module, const struct module_param *params,
+                  int count){
+    struct module_param *param;
+    int i;
+
+    module->params = NULL;
+    for(i = count - 1; i >= 0; i--){
+        if((param = malloc(sizeof(*param))) == NULL){
+            rum_error(module->errctx, RUM_ENO_MEMORY);
+            return -1;
+        }
+        *param = params[i];
+        param->value = NULL;
+        param->next = module->params;
+        module->params = param;
+    }
+    return 0;
+}
+
+char *modparam_get(struct module *module, const char *name){
+    struct module_param *param;
+
+    for(param = module->params; param != NULL; param = param->next){
+        if(strcasecmp(param->name, name) == 0)
+            return param->value != NULL ? param->value : param->defval;
+    }
+    return NULL;
+}
+
+int modparam_set(struct module *module, const char *name, const char *value){
+    struct module_param *param;
+
+    for(param = module->params; param != NULL; param = param->next){
+        if(strcasecmp(param->name, name) == 0){
+            free(param->value);
+            param->value = strdup(value);
+            return 0;
+        }
+    }
+    rum_error(module->errctx, RUM_EMOD_PARAM);
+    return -1;
+}
+
+int modparam_unset(struct module *module, const char *name){
+    struct module_param *param;
+
+    for(param = module->params; param != NULL; param = param->next){
+        if(strcasecmp(param->name, name) == 0){
+            free(param->value);
+            param->value = NULL;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void modparam_clean(struct module *module){
+    struct module_param *param;
+
+    while((param = module->params) != NULL){
+        module->params = param->next;
+        free(param->value);
+        free(param);
+    }
+}
+
+struct module *mod_find(enum module_class cls, char *name, int re){
+    UNUSED(re);
+
+    if(cls == MC_PROCESSOR && strcmp(name, PROCESSOR_MASTER) == 0)
+        return &host.master;
+    return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Packet data and its buffer are one block (see host_data()).
+//////////////////////////////////////////////////////////////////////////////
+void data_init(struct data *data, int session){
+    memset(data, 0, sizeof(*data));
+    data->ref_count = 1;
+    data->session = session;
+    pthread_mutex_init(&data->rcmutex, NULL);
+}
+
+void data_ref(struct data *data){
+    pthread_mutex_lock(&data->rcmutex);
+    data->ref_count++;
+    pthread_mutex_unlock(&data->rcmutex);
+}
+
+void data_free(void *ptr){
+    struct data *data = (struct data *) ptr;
+    int last;
+
+    if(data == NULL) return;
+
+    pthread_mutex_lock(&data->rcmutex);
+    last = --data->ref_count == 0;
+    pthread_mutex_unlock(&data->rcmutex);
+
+    if(last){
+        pthread_mutex_destroy(&data->rcmutex);
+        free(data);
+        __sync_fetch_and_add(&host.data_freed, 1);
+    }
+}
+
+struct meta *meta_new(EC, struct data *data, struct client *clients,
+                      int count){
+    struct meta *meta;
+    size_t words = (count + MMASK_BITS - 1) / MMASK_BITS;
+
+    meta = calloc(1, sizeof(*meta) + words * sizeof(unsigned long));
+    if(meta == NULL){
+        rum_error(errctx, RUM_ENO_MEMORY);
+        return NULL;
+    }
+    meta->data = data;
+    meta->client = clients;
+    meta->count = count;
+    meta->mask = (unsigned long *) (meta + 1);
+    meta_mask_all(meta, 1);
+    return meta;
+}
+
+void meta_mask_all(struct meta *meta, int valid){
+    size_t words = (meta->count + MMASK_BITS - 1) / MMASK_BITS;
+
+    memset(meta->mask, valid ? 0xff : 0, words * sizeof(unsigned long));
+}
+
+void meta_free(void *ptr){
+    struct meta *meta = (struct meta *) ptr;
+
+    if(meta == NULL) return;
+    data_free(meta->data);
+    free(meta);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Wake the thread waiting on \a group (queue_group_signal() without the
+/// cancellation cleanup of lock()).
+//////////////////////////////////////////////////////////////////////////////
+static void group_signal(struct queue_group *group){
+    pthread_mutex_lock(&group->mutex);
+    group->signal = 1;
+    pthread_cond_signal(&group->cond);
+    pthread_mutex_unlock(&group->mutex);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Data queues are plain locked lists here (no length limit, the feeder
+/// keeps the backlog bounded) unless they are rings (QT_RING, queue_ring.c).
+//////////////////////////////////////////////////////////////////////////////
+int queue_push_data(EC, struct queue *queue, void *item){
+    struct queue_item *entry;
+    int i;
+
+    if(queue->type == QT_RING) return queue_push_ring(errctx, queue, item);
+
+    if((entry = malloc(sizeof(*entry))) == NULL){
+        rum_error(errctx, RUM_ENO_MEMORY);
+        return -1;
+    }
+    entry->next = NULL;
+    entry->data = item;
+
+    pthread_mutex_lock(&queue->push_mutex);
+    if(queue->tail != NULL) queue->tail->next = entry;
+    else queue->head = entry;
+    queue->tail = entry;
+    queue->total++;
+    pthread_mutex_unlock(&queue->push_mutex);
+
+    for(i = 0; i < queue->group_count; i++)
+        group_signal(queue->groups[i]);
+    return 0;
+}
+
+int queue_pop_data(struct queue *queue, void **item){
+    struct queue_item *entry;
+
+    if(queue->type == QT_RING) return queue_pop_ring(queue, item);
+
+    pthread_mutex_lock(&queue->push_mutex);
+    if((entry = queue->head) != NULL){
+        queue->head = entry->next;
+        if(queue->head == NULL) queue->tail = NULL;
+    }
+    pthread_mutex_unlock(&queue->push_mutex);
+
+    if(entry == NULL) return -1;
+    *item = entry->data;
+    free(entry);
+    return 0;
+}
+
+int queue_pop_data_batch(struct queue *queue, void **items, int max){
+    struct queue_item *entry;
+    struct queue_item *next;
+    int count = 0;
+
+    if(queue->type == QT_RING) return queue_pop_ring_batch(queue, items, max);
+
+    pthread_mutex_lock(&queue->push_mutex);
+    for(entry = queue->head; entry != NULL && count < max; entry = entry->next)
+        count++;
+    next = queue->head;
+    queue->head = entry;
+    if(queue->head == NULL) queue->tail = NULL;
+    pthread_mutex_unlock(&queue->push_mutex);
+
+    for(max = 0; max < count; max++, next = entry){
+        entry = next->next;
+        items[max] = next->data;
+        free(next);
+    }
+    return count;
+}
+
+struct queue_group *queue_group_reg(EC, int count, ...){
+    struct queue_group *group;
+    struct queue *queue;
+    va_list ap;
+    int i;
+
+    if((group = calloc(1, sizeof(*group))) == NULL
+       || (group->queues = calloc(count, sizeof(*group->queues))) == NULL){
+        free(group);
+        rum_error(errctx, RUM_ENO_MEMORY);
+        return NULL;
+    }
+    pthread_mutex_init(&group->mutex, NULL);
+    pthread_cond_init(&group->cond, NULL);
+
+    va_start(ap, count);
+    for(i = 0; i < count; i++){
+        queue = va_arg(ap, struct queue *);
+        group->queues[group->count++] = queue;
+        queue->groups = realloc(queue->groups, (queue->group_count + 1)
+                                * sizeof(*queue->groups));
+        queue->groups[queue->group_count++] = group;
+    }
+    va_end(ap);
+
+    return group;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Wait for a group of ring queues - park on all of them (unless one has
+/// items) and poll their eventfds.
+//////////////////////////////////////////////////////////////////////////////
+static void ring_group_wait(struct queue_group *group){
+    struct pollfd fds[group->count];
+    int parked;
+    int i;
+
+    for(parked = 0; parked < group->count; parked++){
+        if(queue_ring_park(group->queues[parked]) != 0) break;
+        fds[parked].fd = ((struct queue_ring *) group->queues[parked])->wake;
+        fds[parked].events = POLLIN;
+    }
+
+    if(parked == group->count && !host.stopping)
+        poll(fds, parked, -1);
+
+    for(i = 0; i < parked; i++) queue_ring_unpark(group->queues[i]);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Wait for the group to be signalled; once the host stops, the waiting
+/// module thread ends here (processors have no other way out of m_main).
+//////////////////////////////////////////////////////////////////////////////
+void queue_group_wait(struct queue_group *group){
+    int rings;
+
+    for(rings = 0; rings < group->count; rings++){
+        if(group->queues[rings]->type != QT_RING) break;
+    }
+
+    if(rings > 0 && rings == group->count)
+        ring_group_wait(group);
+    else{
+        pthread_mutex_lock(&group->mutex);
+        while(!group->signal && !host.stopping)
+            pthread_cond_wait(&group->cond, &group->mutex);
+        group->signal = 0;
+        pthread_mutex_unlock(&group->mutex);
+    }
+
+    if(host.stopping) pthread_exit(NULL);
+}
+
+void processor_path_pass(struct module *mod, struct meta *meta){
+    size_t words = (meta->count + MMASK_BITS - 1) / MMASK_BITS;
+    int valid = 0;
+    size_t i;
+
+    UNUSED(mod);
+
+    for(i = 0; i < words; i++) valid |= meta->mask[i] != 0;
+
+    pthread_mutex_lock(&host.lock);
+    host.passed++;
+    if(!valid) host.masked++;
+    pthread_cond_signal(&host.drained);
+    pthread_mutex_unlock(&host.lock);
+
+    meta_free(meta);
+}
+
+void processor_path_pass_batch(struct module *mod, struct meta **metas,
+                               int count){
+    unsigned long masked = 0;
+    size_t words;
+    int valid;
+    size_t i;
+    int k;
+
+    UNUSED(mod);
+
+    for(k = 0; k < count; k++){
+        words = (metas[k]->count + MMASK_BITS - 1) / MMASK_BITS;
+        for(i = 0, valid = 0; i < words; i++) valid |= metas[k]->mask[i] != 0;
+        if(!valid) masked++;
+    }
+
+    pthread_mutex_lock(&host.lock);
+    host.passed += count;
+    host.masked += masked;
+    pthread_cond_signal(&host.drained);
+    pthread_mutex_unlock(&host.lock);
+
+    for(k = 0; k < count; k++) meta_free(metas[k]);
+}
+
+/* ---------------------------------------------------------------------- */
+/* Host                                                                    */
+/* ---------------------------------------------------------------------- */
+
+//////////////////////////////////////////////////////////////////////////////
+/// A synthetic packet of \a size bytes from \a listener; it starts with
+/// \a sample if \a match is set, with zeros otherwise.
+//////////////////////////////////////////////////////////////////////////////
+static struct data *host_data(const char *listener, size_t size,
+                              const char *sample, int match){
+    struct data *data;
+
+    if((data = malloc(sizeof(*data) + size)) == NULL) return NULL;
+    data_init(data, 0);
+    strncpy(data->name, listener, sizeof(data->name) - 1);
+    data->buffer = data + 1;
+    data->size = size;
+    memset(data->buffer, 0, size);
+    if(match) memcpy(data->buffer, sample, strnlen(sample, size));
+    return data;
+}
+
+static void *module_thread(void *arg){
+    struct module *module = (struct module *) arg;
+
+    module->iface->main(module);
+    return NULL;
+}
+
+static void stop_signal(int sig){
+    UNUSED(sig);
+    host.stopping = 1;
+}
+
+static void usage(const char *name){
+    fprintf(stderr, "Usage: %s [-o NAME=VALUE]... [-t SECONDS] [-n PACKETS]\n"
+            "       [-r RATE] [-s SIZE] [-m MATCH%%] [-d SAMPLE] [-l LISTENER]\n"
+            "       [-v LEVEL] [-p] [-q SLOTS | -Q SLOTS] MODULE.so\n", name);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Packets of \a queue passed on by the processor or dropped by the queue
+/// (host.lock held).
+//////////////////////////////////////////////////////////////////////////////
+static unsigned long host_done(struct queue *queue){
+    return host.passed + __atomic_load_n(&queue->dropped, __ATOMIC_RELAXED);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Feed \a packets packets to a processor through its input queue, at most
+/// \a backlog of them waiting.
+///
+/// \return Number of packets fed.
+//////////////////////////////////////////////////////////////////////////////
+static unsigned long feed_processor(struct module *module,
+                                    unsigned long packets, size_t size,
+                                    const char *sample, unsigned match,
+                                    unsigned long backlog){
+    struct data *data;
+    struct meta *meta;
+    unsigned long i;
+
+    for(i = 0; i < packets && !host.stopping; i++){
+        pthread_mutex_lock(&host.lock);
+        while(i - host_done(module->input_data) >= backlog && !host.stopping)
+            pthread_cond_wait(&host.drained, &host.lock);
+        pthread_mutex_unlock(&host.lock);
+
+        data = host_data("", size, sample, i % 100 < match);
+        if(data == NULL
+           || (meta = meta_new(module->errctx, data, NULL, 1)) == NULL
+           || queue_push_data(module->errctx, module->input_data, meta) != 0){
+            data_free(data);
+            break;
+        }
+    }
+
+    return i;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Wait until \a fed packets were passed on by a processor.
+//////////////////////////////////////////////////////////////////////////////
+static void drain_processor(struct module *module, unsigned long fed){
+    pthread_mutex_lock(&host.lock);
+    while(host_done(module->input_data) < fed && !host.stopping)
+        pthread_cond_wait(&host.drained, &host.lock);
+    pthread_mutex_unlock(&host.lock);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Push packets to a msg-interface at \a rate per second (none if zero)
+/// for \a seconds.
+///
+/// \return Number of packets pushed, \a spent is the time spent in
+/// push_data.
+//////////////////////////////////////////////////////////////////////////////
+static unsigned long feed_iface(struct module *module, double seconds,
+                                unsigned long rate, size_t size,
+                                const char *listener, double *spent){
+    double start = now();
+    double due = start;
+    double before;
+    unsigned long pushed = 0;
+    struct data *data;
+    struct meta *meta;
+
+    *spent = 0;
+    while(!host.stopping && now() - start < seconds){
+        if(rate == 0 || module->iface->push_data == NULL){
+            usleep(100000);
+            continue;
+        }
+
+        // Packets due by now, sleep until the next one
+        for(; due <= now() && !host.stopping; due += 1.0 / rate){
+            if((data = host_data(listener, size, "", 0)) == NULL
+               || (meta = meta_new(module->errctx, data, NULL, 1)) == NULL){
+                data_free(data);
+                break;
+            }
+            before = now();
+            module->iface->push_data(module, meta);
+            *spent += now() - before;
+            pushed++;
+        }
+        if(due > now()) usleep((useconds_t) ((due - now()) * 1e6));
+    }
+
+    return pushed;
+}
+
+int main(int argc, char **argv){
+    struct module module;
+    struct sigaction action;
+    pthread_t thread;
+    clockid_t cpu_clock = CLOCK_THREAD_CPUTIME_ID;
+    struct timespec cpu_start;
+    struct timespec cpu_end;
+    module_initialize init;
+    void *plugin;
+    char *value;
+    const char *sample = HOST_SAMPLE;
+    const char *listener = HOST_LISTENER;
+    unsigned long seconds = HOST_SECONDS;
+    unsigned long packets = HOST_PACKETS;
+    unsigned long rate = 0;
+    unsigned long size = HOST_SIZE;
+    unsigned long pushed;
+    unsigned long fed = 0;
+    unsigned match = 0;
+    int preload = 0;
+    unsigned long ring = 0;
+    int multi = 0;
+    double start;
+    double elapsed;
+    double spent;
+    int opt;
+
+    memset(&module, 0, sizeof(module));
+    module.errctx = rum_error_init();
+    host.master.errctx = rum_error_init();
+    if(module.errctx == NULL || host.master.errctx == NULL){
+        perror("rtsp_host");
+        return 1;
+    }
+
+    // Options are parsed twice - parameters need the initialized module
+    while((opt = getopt(argc, argv, "o:t:n:r:s:m:d:l:v:pq:Q:")) != -1){
+        switch(opt){
+            case 'o': break;
+            case 't': seconds = strtoul(optarg, NULL, 10); break;
+            case 'n': packets = strtoul(optarg, NULL, 10); break;
+            case 'r': rate = strtoul(optarg, NULL, 10); break;
+            case 's': size = strtoul(optarg, NULL, 10); break;
+            case 'm': match = strtoul(optarg, NULL, 10); break;
+            case 'd': sample = optarg; break;
+            case 'l': listener = optarg; break;
+            case 'v': host.log_level = atoi(optarg); break;
+            case 'p': preload = 1; break;
+            case 'Q': multi = 1; // fall through
+            case 'q': ring = strtoul(optarg, NULL, 10); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if(optind != argc - 1 || size == 0 || match > 100){
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Load the module
+    if((plugin = dlopen(argv[optind], RTLD_NOW | RTLD_LOCAL)) == NULL){
+        fprintf(stderr, "%s\n", dlerror());
+        return 1;
+    }
+    if((init = (module_initialize) dlsym(plugin, "initialize")) == NULL){
+        fprintf(stderr, "%s\n", dlerror());
+        return 1;
+    }
+    if(init(&module) != 0 || module.iface == NULL
+       || module.iface->version != MODULE_VERSION){
+        fprintf(stderr, "%s: initialize failed\n", argv[optind]);
+        logerrorm(&module, LOG_ERROR);
+        return 1;
+    }
+
+    // Parameters
+    for(optind = 1; (opt = getopt(argc, argv, "o:t:n:r:s:m:d:l:v:pq:Q:")) != -1;){
+        if(opt != 'o') continue;
+        if((value = strchr(optarg, '=')) == NULL){
+            usage(argv[0]);
+            return 1;
+        }
+        *value++ = '\0';
+        if(modparam_set(&module, optarg, value) != 0){
+            fprintf(stderr, "Unknown parameter %s of %s/%s\n", optarg,
+                    module_class(module.id.mclass), module.id.name);
+            return 1;
+        }
+    }
+
+    // Processors read their input queue
+    if(module.id.mclass == MC_PROCESSOR && ring > 0){
+        if(queue_ring_new(module.errctx, &module.input_data, ring, multi,
+                          meta_free) != 0){
+            fprintf(stderr, "Ring of %lu slots (a power of two) failed\n",
+                    ring);
+            return 1;
+        }
+    }
+    else if(module.id.mclass == MC_PROCESSOR){
+        module.input_data = calloc(1, sizeof(struct queue_data));
+        if(module.input_data == NULL){
+            perror("rtsp_host");
+            return 1;
+        }
+        module.input_data->type = QT_DATA;
+        pthread_mutex_init(&module.input_data->push_mutex, NULL);
+        pthread_mutex_init(&module.input_data->pop_mutex, NULL);
+    }
+
+    if((module.iface->name != NULL && module.iface->name(&module, 0) != 0)
+       || module.iface->init(&module) != 0){
+        fprintf(stderr, "%s/%s: init failed\n",
+                module_class(module.id.mclass), module.id.name);
+        logerrorm(&module, LOG_ERROR);
+        return 1;
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Preloaded input queue - the run measures draining a full queue
+    if(module.id.mclass == MC_PROCESSOR && preload)
+        fed = feed_processor(&module, packets, size, sample, match, packets);
+
+    if(pthread_create(&thread, NULL, module_thread, &module) != 0){
+        perror("pthread_create");
+        return 1;
+    }
+    module.started = 1;
+    printf("%s/%s running\n", module_class(module.id.mclass), module.id.name);
+
+    start = now();
+    if(module.id.mclass == MC_PROCESSOR){
+        // CPU time of the module thread alone (the feeder shares the wall
+        // clock time)
+        if(pthread_getcpuclockid(thread, &cpu_clock) != 0
+           || clock_gettime(cpu_clock, &cpu_start) != 0)
+            memset(&cpu_start, 0, sizeof(cpu_start));
+        if(!preload)
+            fed = feed_processor(&module, packets, size, sample, match,
+                                 HOST_BACKLOG);
+        drain_processor(&module, fed);
+        elapsed = now() - start;
+        if(clock_gettime(cpu_clock, &cpu_end) != 0) cpu_end = cpu_start;
+        printf("%lu packets of %lu B in %.3f s: %.0f packets/s "
+               "(%.1f ns/packet), %lu masked\n", host.passed, size, elapsed,
+               host.passed / elapsed, elapsed * 1e9 / (host.passed ? host.passed : 1),
+               host.masked);
+        if(module.input_data->dropped > 0)
+            printf("%lu packets dropped by the input queue\n",
+                   module.input_data->dropped);
+        printf("module thread: %.3f s CPU (%.1f ns/packet)\n",
+               (cpu_end.tv_sec - cpu_start.tv_sec)
+               + (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e9,
+               ((cpu_end.tv_sec - cpu_start.tv_sec) * 1e9
+                + (cpu_end.tv_nsec - cpu_start.tv_nsec))
+               / (host.passed ? host.passed : 1));
+    }
+    else{
+        pushed = feed_iface(&module, seconds, rate, size, listener, &spent);
+        elapsed = now() - start;
+        printf("%.3f s, %lu packets pushed (%.1f ns/push_data)\n", elapsed,
+               pushed, pushed > 0 ? spent * 1e9 / pushed : 0.0);
+    }
+
+    // Stop the module - processors leave m_main in queue_group_wait
+    pthread_mutex_lock(&host.lock);
+    host.stopping = 1;
+    pthread_mutex_unlock(&host.lock);
+    if(module.input_data != NULL && module.input_data->group_count > 0)
+        group_signal(module.input_data->groups[0]);
+    if(module.input_data != NULL && module.input_data->type == QT_RING)
+        queue_ring_wake(module.input_data);
+    module.iface->stop(&module);
+    pthread_join(thread, NULL);
+    module.started = 0;
+
+    if(module.iface->clean != NULL) module.iface->clean(&module, 0);
+    printf("%lu packets released\n", host.data_freed);
+
+    dlclose(plugin);
+    rum_error_free(module.errctx);
+    rum_error_free(host.master.errctx);
+
+    return 0;
+}
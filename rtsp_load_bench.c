@@ -0,0 +1,860 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Load generator for a running RTSP module - N concurrent connections
+/// (epoll, one thread) replay a method mix against the server, the
+/// throughput (requests and completed mixes per second) and the request
+/// latency (log-linear, HDR-like histogram) are reported at the end.
+///
+/// The mix is a comma separated list of methods, a method may be repeated
+/// with "*N" (e.g. "OPTIONS,SETUP,PLAY,GET_PARAMETER*10,TEARDOWN"). Methods
+/// after SETUP carry its session. A connection keeps up to PIPELINE requests
+/// in flight (requests needing the session wait for the SETUP response),
+/// with FRAGMENT > 0 every request is written in FRAGMENT byte pieces.
+/// TEARDOWN ends the connection (the server closes it), a new one starts
+/// the mix again.
+///
+/// The module talks to the reflector over a UNIX socket; "-s SOCKET" runs
+/// a stub reflector answering "RAP/1.0 200 OK" to every RAP request, so
+/// the server and the load run on one machine. The module connects to the
+/// socket when it starts, start the stub (with "-c 0" it runs until
+/// killed) before the module:
+///
+///     rtsp_load_bench -s /tmp/reflector -c 0 &
+///     (start rum2 with the RTSP module, Socket: /tmp/reflector)
+///     rtsp_load_bench -c 20000 -t 30 -m OPTIONS,SETUP,PLAY,TEARDOWN
+///
+/// Usage: rtsp_load_bench [-h HOST] [-p PORT] [-u PATH] [-c CONNECTIONS]
+///        [-t SECONDS] [-m MIX] [-P PIPELINE] [-f FRAGMENT] [-s SOCKET]
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#define _GNU_SOURCE                         // memmem
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+//////////////////////////////////////////////////////////////////////////////
+/// Defaults of the command line options.
+//////////////////////////////////////////////////////////////////////////////
+#define BENCH_HOST "127.0.0.1"
+#define BENCH_PORT 6666
+#define BENCH_PATH "/"
+#define BENCH_CONNECTIONS 1000
+#define BENCH_SECONDS 10
+#define BENCH_MIX "OPTIONS,SETUP,PLAY,TEARDOWN"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Limits - methods in a mix, requests in flight per connection and the
+/// connection buffers (a DESCRIBE response must fit into \a BENCH_INPUT).
+//////////////////////////////////////////////////////////////////////////////
+#define MIX_MAX 256
+#define PIPELINE_MAX 16
+#define BENCH_INPUT 4096
+#define BENCH_OUTPUT (PIPELINE_MAX * 256)
+#define SESSION_MAX 64
+#define EVENTS_MAX 1024
+
+//////////////////////////////////////////////////////////////////////////////
+/// First client port announced in SETUP; every connection announces its own
+/// pair so the RAP messages of the connections (all from one address) are
+/// not coalesced.
+//////////////////////////////////////////////////////////////////////////////
+#define CLIENT_PORT_BASE 1024
+
+//////////////////////////////////////////////////////////////////////////////
+/// Histogram resolution - 2^HDR_BITS linear sub-buckets per power of two
+/// (relative error below 1/2^(HDR_BITS-1)), latencies in microseconds up to
+/// 2^(HDR_BITS + HDR_MAGNITUDES) us.
+//////////////////////////////////////////////////////////////////////////////
+#define HDR_BITS 7
+#define HDR_MAGNITUDES 26
+#define HDR_HALF (1 << (HDR_BITS - 1))
+#define HDR_BUCKETS ((1 << HDR_BITS) + HDR_MAGNITUDES * HDR_HALF)
+
+//////////////////////////////////////////////////////////////////////////////
+/// Methods of a mix.
+//////////////////////////////////////////////////////////////////////////////
+enum bench_method {
+    M_OPTIONS, M_DESCRIBE, M_SETUP, M_PLAY, M_PAUSE, M_GET_PARAMETER,
+    M_TEARDOWN, M_COUNT
+};
+
+static const char *const method_names[M_COUNT] = {
+    "OPTIONS", "DESCRIBE", "SETUP", "PLAY", "PAUSE", "GET_PARAMETER",
+    "TEARDOWN"
+};
+
+//////////////////////////////////////////////////////////////////////////////
+/// Latency histogram (log-linear buckets, microseconds).
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    uint64_t counts[HDR_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} Bench_Histogram;
+
+//////////////////////////////////////////////////////////////////////////////
+/// One load connection.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    int fd;                             ///< Socket, -1 while closed.
+    unsigned id;                        ///< Index (client port pair).
+    int connected;                      ///< Non-blocking connect finished.
+    int done;                           ///< TEARDOWN sent, wait for close.
+    unsigned step;                      ///< Next method of the mix.
+    unsigned cseq;                      ///< CSeq of the next request.
+    unsigned inflight;                  ///< Requests without response.
+    unsigned head;                      ///< Oldest request in flight.
+    uint64_t sent[PIPELINE_MAX];        ///< Send times (us) in flight.
+    unsigned char method[PIPELINE_MAX]; ///< Methods in flight.
+    char session[SESSION_MAX];          ///< Session from SETUP ("" none).
+    char in[BENCH_INPUT];               ///< Partial responses.
+    size_t in_len;
+    char out[BENCH_OUTPUT];             ///< Requests not yet written.
+    size_t out_len;
+    size_t out_sent;
+} Bench_Conn;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Load configuration and results.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    struct sockaddr_in server;
+    const char *host;
+    const char *path;
+    unsigned char mix[MIX_MAX];
+    unsigned mix_len;
+    unsigned pipeline;
+    size_t fragment;
+    int epfd;
+
+    uint64_t requests;                  ///< Requests sent.
+    uint64_t responses[6];              ///< Responses by class (0 invalid).
+    uint64_t by_method[M_COUNT];        ///< Responses by method.
+    uint64_t cycles;                    ///< Mixes completed.
+    uint64_t connects;                  ///< Connections opened.
+    uint64_t errors;                    ///< Connections lost mid-mix.
+    Bench_Histogram latency;
+} Bench_Load;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Terminator of RTSP and RAP messages.
+//////////////////////////////////////////////////////////////////////////////
+static const char msg_end[] = "\r\n\r\n";
+
+//////////////////////////////////////////////////////////////////////////////
+/// Reply of the stub reflector.
+//////////////////////////////////////////////////////////////////////////////
+static const char rap_ok[] = "RAP/1.0 200 OK\r\n\r\n";
+
+//////////////////////////////////////////////////////////////////////////////
+/// Set by SIGINT/SIGTERM, stops the load and the stub.
+//////////////////////////////////////////////////////////////////////////////
+static volatile sig_atomic_t stopping = 0;
+
+static void stop_signal(int sig){
+    (void) sig;
+    stopping = 1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Monotonic time in microseconds.
+//////////////////////////////////////////////////////////////////////////////
+static uint64_t now_us(void){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Switch \a fd to the non-blocking mode.
+//////////////////////////////////////////////////////////////////////////////
+static int set_nonblock(int fd){
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Histogram bucket of \a value - values below 2^HDR_BITS have their own
+/// bucket, above it every power of two is split into HDR_HALF buckets.
+//////////////////////////////////////////////////////////////////////////////
+static unsigned hdr_index(uint64_t value){
+    unsigned shift;
+
+    if(value < (1 << HDR_BITS)) return (unsigned) value;
+
+    shift = 63 - __builtin_clzll(value) - (HDR_BITS - 1);
+    if(shift > HDR_MAGNITUDES) return HDR_BUCKETS - 1;
+
+    return (1 << HDR_BITS) + (shift - 1) * HDR_HALF
+           + (unsigned) (value >> shift) - HDR_HALF;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Highest value counted in bucket \a index.
+//////////////////////////////////////////////////////////////////////////////
+static uint64_t hdr_value(unsigned index){
+    unsigned shift;
+
+    if(index < (1 << HDR_BITS)) return index;
+
+    shift = (index - (1 << HDR_BITS)) / HDR_HALF + 1;
+    return (((uint64_t) ((index - (1 << HDR_BITS)) % HDR_HALF + HDR_HALF + 1))
+            << shift) - 1;
+}
+
+static void hdr_record(Bench_Histogram *hdr, uint64_t value){
+    hdr->counts[hdr_index(value)]++;
+    hdr->total++;
+    if(value > hdr->max) hdr->max = value;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Value at \a percentile (0-100) of the recorded values.
+//////////////////////////////////////////////////////////////////////////////
+static uint64_t hdr_percentile(const Bench_Histogram *hdr, double percentile){
+    uint64_t wanted = (uint64_t) (hdr->total * percentile / 100.0 + 0.5);
+    uint64_t seen = 0;
+    unsigned i;
+
+    if(wanted == 0) wanted = 1;
+    for(i = 0; i < HDR_BUCKETS; i++){
+        seen += hdr->counts[i];
+        if(seen >= wanted)
+            return hdr_value(i) < hdr->max ? hdr_value(i) : hdr->max;
+    }
+    return hdr->max;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Print the percentile distribution (HdrHistogram-like: value, percentile,
+/// count, 1/(1-percentile)), the percentiles halve the distance to 100%.
+//////////////////////////////////////////////////////////////////////////////
+static void hdr_print(const Bench_Histogram *hdr){
+    double percentile = 0;
+    double step = 50;
+    uint64_t seen = 0;
+    uint64_t value;
+    unsigned i = 0;
+
+    printf("%12s %14s %12s %12s\n", "Value(us)", "Percentile", "TotalCount",
+           "1/(1-P)");
+    while(hdr->total > 0 && i < HDR_BUCKETS){
+        value = hdr_percentile(hdr, percentile);
+        for(; i < HDR_BUCKETS && i <= hdr_index(value); i++)
+            seen += hdr->counts[i];
+        printf("%12llu %14.9f %12llu %12.2f\n", (unsigned long long) value,
+               (double) seen / hdr->total, (unsigned long long) seen,
+               seen < hdr->total ? 1.0 / (1.0 - (double) seen / hdr->total)
+                                 : 0.0);
+        if(seen >= hdr->total) break;
+        percentile += step;
+        step /= 2;
+        if(step < 1e-7) break;
+    }
+    printf("#[Max = %llu us, Total count = %llu]\n",
+           (unsigned long long) hdr->max, (unsigned long long) hdr->total);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Parse the method mix ("OPTIONS,SETUP,PLAY*5,TEARDOWN").
+///
+/// \return 0 on success, -1 on an unknown method or too long a mix.
+//////////////////////////////////////////////////////////////////////////////
+static int parse_mix(Bench_Load *load, const char *text){
+    const char *item = text;
+    const char *end;
+    const char *star;
+    unsigned long repeat;
+    size_t length;
+    int method;
+
+    load->mix_len = 0;
+    while(*item != '\0'){
+        end = item + strcspn(item, ",");
+        star = memchr(item, '*', end - item);
+        length = (star != NULL ? star : end) - item;
+        repeat = star != NULL ? strtoul(star + 1, NULL, 10) : 1;
+
+        for(method = 0; method < M_COUNT; method++){
+            if(strlen(method_names[method]) == length
+               && strncasecmp(item, method_names[method], length) == 0)
+                break;
+        }
+        if(method == M_COUNT || repeat == 0
+           || load->mix_len + repeat > MIX_MAX)
+            return -1;
+
+        while(repeat-- > 0) load->mix[load->mix_len++] = (unsigned char) method;
+        item = *end == ',' ? end + 1 : end;
+    }
+    return load->mix_len > 0 ? 0 : -1;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Open (non-blocking connect) connection \a conn.
+///
+/// \return 0 on success, -1 if no socket could be created.
+//////////////////////////////////////////////////////////////////////////////
+static int conn_open(Bench_Load *load, Bench_Conn *conn){
+    struct epoll_event ev;
+    int one = 1;
+
+    conn->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(conn->fd < 0) return -1;
+
+    set_nonblock(conn->fd);
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    conn->connected = 0;
+    conn->done = 0;
+    conn->step = 0;
+    conn->inflight = 0;
+    conn->head = 0;
+    conn->session[0] = '\0';
+    conn->in_len = 0;
+    conn->out_len = 0;
+    conn->out_sent = 0;
+
+    if(connect(conn->fd, (struct sockaddr *) &load->server,
+               sizeof(load->server)) < 0 && errno != EINPROGRESS){
+        close(conn->fd);
+        conn->fd = -1;
+        return -1;
+    }
+
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.ptr = conn;
+    epoll_ctl(load->epfd, EPOLL_CTL_ADD, conn->fd, &ev);
+    load->connects++;
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Close \a conn and start it again (a new mix on a new connection).
+//////////////////////////////////////////////////////////////////////////////
+static void conn_restart(Bench_Load *load, Bench_Conn *conn){
+    if(!conn->done || conn->inflight > 0) load->errors++;
+
+    close(conn->fd);
+    conn->fd = -1;
+    if(!stopping) conn_open(load, conn);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Append the requests of the mix to the output buffer - up to the
+/// pipeline depth, a request needing the session waits for the SETUP
+/// response.
+//////////////////////////////////////////////////////////////////////////////
+static void conn_fill(Bench_Load *load, Bench_Conn *conn){
+    unsigned port = CLIENT_PORT_BASE + (conn->id * 2) % (65536 - CLIENT_PORT_BASE);
+    unsigned slot;
+    int method;
+    int written;
+
+    while(!conn->done && conn->inflight < load->pipeline){
+        method = load->mix[conn->step];
+
+        if(method != M_OPTIONS && method != M_DESCRIBE && method != M_SETUP
+           && conn->session[0] == '\0'){
+            if(conn->inflight > 0) break;
+            // SETUP failed (or the mix has none), the session stays empty
+        }
+
+        if(sizeof(conn->out) - conn->out_len < 256) break;
+
+        written = snprintf(conn->out + conn->out_len,
+                           sizeof(conn->out) - conn->out_len,
+                           "%s rtsp://%s:%u%s RTSP/1.0\r\nCSeq: %u\r\n",
+                           method_names[method], load->host,
+                           ntohs(load->server.sin_port), load->path,
+                           conn->cseq++);
+        if(method == M_SETUP)
+            written += snprintf(conn->out + conn->out_len + written,
+                                sizeof(conn->out) - conn->out_len - written,
+                                "Transport: RTP/AVP;unicast;client_port=%u-%u\r\n",
+                                port, port + 1);
+        else if(method != M_OPTIONS && method != M_DESCRIBE
+                && conn->session[0] != '\0')
+            written += snprintf(conn->out + conn->out_len + written,
+                                sizeof(conn->out) - conn->out_len - written,
+                                "Session: %s\r\n", conn->session);
+        written += snprintf(conn->out + conn->out_len + written,
+                            sizeof(conn->out) - conn->out_len - written,
+                            "\r\n");
+        conn->out_len += written;
+
+        slot = (conn->head + conn->inflight) % PIPELINE_MAX;
+        conn->sent[slot] = now_us();
+        conn->method[slot] = (unsigned char) method;
+        conn->inflight++;
+        load->requests++;
+
+        if(method == M_TEARDOWN) conn->done = 1;
+        if(++conn->step == load->mix_len){
+            conn->step = 0;
+            // A mix without TEARDOWN repeats on the same connection
+            if(!conn->done) load->cycles++;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Write the output buffer (in \a fragment sized writes if set).
+///
+/// \return 0 on success, -1 if the connection failed.
+//////////////////////////////////////////////////////////////////////////////
+static int conn_flush(Bench_Load *load, Bench_Conn *conn){
+    struct epoll_event ev;
+    size_t length;
+    ssize_t written;
+
+    while(conn->out_sent < conn->out_len){
+        length = conn->out_len - conn->out_sent;
+        if(load->fragment > 0 && length > load->fragment)
+            length = load->fragment;
+
+        written = send(conn->fd, conn->out + conn->out_sent, length,
+                       MSG_NOSIGNAL);
+        if(written < 0){
+            if(errno == EINTR) continue;
+            if(errno != EAGAIN && errno != EWOULDBLOCK) return -1;
+
+            // Wait for the socket to drain
+            ev.events = EPOLLIN | EPOLLOUT;
+            ev.data.ptr = conn;
+            epoll_ctl(load->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+            return 0;
+        }
+        conn->out_sent += written;
+    }
+
+    conn->out_len = conn->out_sent = 0;
+    ev.events = EPOLLIN;
+    ev.data.ptr = conn;
+    epoll_ctl(load->epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Take the complete responses out of the input buffer.
+///
+/// \return 0 on success, -1 on a response not matching any request.
+//////////////////////////////////////////////////////////////////////////////
+static int conn_responses(Bench_Load *load, Bench_Conn *conn, uint64_t now){
+    const char *end;
+    const char *line;
+    size_t length;
+    size_t body;
+    size_t span;
+    int code;
+
+    for(;;){
+        end = memmem(conn->in, conn->in_len, msg_end, sizeof(msg_end) - 1);
+        if(end == NULL) return conn->in_len == sizeof(conn->in) ? -1 : 0;
+        length = end - conn->in + sizeof(msg_end) - 1;
+
+        code = 0;
+        if(length > 12 && memcmp(conn->in, "RTSP/1.0 ", 9) == 0)
+            code = atoi(conn->in + 9);
+
+        body = 0;
+        for(line = conn->in; line < end; line++){
+            line = memchr(line, '\n', end - line);
+            if(line == NULL) break;
+            line++;
+            if(end - line > 15
+               && strncasecmp(line, "Content-Length:", 15) == 0)
+                body = strtoul(line + 15, NULL, 10);
+            else if(end - line > 8 && strncasecmp(line, "Session:", 8) == 0){
+                for(line += 8; *line == ' '; line++);
+                span = strcspn(line, ";\r\n");
+                if(span >= sizeof(conn->session)) span = sizeof(conn->session) - 1;
+                memcpy(conn->session, line, span);
+                conn->session[span] = '\0';
+            }
+        }
+        if(length + body > conn->in_len){
+            if(length + body > sizeof(conn->in)) return -1;
+            return 0;
+        }
+
+        if(conn->inflight == 0) return -1;
+        hdr_record(&load->latency, now - conn->sent[conn->head]);
+        load->by_method[conn->method[conn->head]]++;
+        load->responses[code >= 100 && code < 600 ? code / 100 : 0]++;
+        if(conn->method[conn->head] == M_TEARDOWN) load->cycles++;
+        if(conn->method[conn->head] == M_SETUP && (code < 200 || code >= 300))
+            conn->session[0] = '\0';
+        conn->head = (conn->head + 1) % PIPELINE_MAX;
+        conn->inflight--;
+
+        memmove(conn->in, conn->in + length + body,
+                conn->in_len - length - body);
+        conn->in_len -= length + body;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Handle events of \a conn.
+//////////////////////////////////////////////////////////////////////////////
+static void conn_event(Bench_Load *load, Bench_Conn *conn, uint32_t events){
+    ssize_t received;
+    socklen_t size = sizeof(int);
+    int error = 0;
+
+    if(!conn->connected){
+        if(!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) return;
+        getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &size);
+        if(error != 0){
+            conn_restart(load, conn);
+            return;
+        }
+        conn->connected = 1;
+        conn_fill(load, conn);
+        if(conn_flush(load, conn) < 0) conn_restart(load, conn);
+        return;
+    }
+
+    if(events & EPOLLIN){
+        for(;;){
+            received = recv(conn->fd, conn->in + conn->in_len,
+                            sizeof(conn->in) - conn->in_len, 0);
+            if(received < 0 && errno == EINTR) continue;
+            if(received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if(received <= 0){
+                conn_restart(load, conn);
+                return;
+            }
+            conn->in_len += received;
+            if(conn_responses(load, conn, now_us()) < 0){
+                conn_restart(load, conn);
+                return;
+            }
+        }
+        conn_fill(load, conn);
+    }
+    else if(events & (EPOLLERR | EPOLLHUP)){
+        conn_restart(load, conn);
+        return;
+    }
+
+    if(conn_flush(load, conn) < 0) conn_restart(load, conn);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Module connection of the stub reflector - the tail of the last read
+/// (a terminator may be split across reads).
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    int fd;
+    size_t tail_len;
+    char tail[3];
+} Rap_Stub_Conn;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Accept and answer RAP requests on \a path until stopped (stub
+/// reflector, thread body). Every request ("\r\n\r\n" terminated, no body)
+/// gets "RAP/1.0 200 OK".
+//////////////////////////////////////////////////////////////////////////////
+static void *rap_stub(void *arg){
+    const char *path = (const char *) arg;
+    struct epoll_event events[EVENTS_MAX];
+    struct epoll_event ev;
+    struct sockaddr_un addr;
+    Rap_Stub_Conn listener;
+    Rap_Stub_Conn *conn;
+    char buffer[3 + 65536];                 // tail of the last read + data
+    char *data;                             // start of the tail
+    char *end;                              // request terminator
+    unsigned long answered = 0;
+    ssize_t received;
+    size_t length;
+    int epfd;
+    int fd;
+    int n;
+    int i;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+
+    listener.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listener.fd < 0
+       || bind(listener.fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+       || listen(listener.fd, 128) < 0
+       || (epfd = epoll_create1(0)) < 0){
+        perror("RAP stub");
+        exit(1);
+    }
+    set_nonblock(listener.fd);
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listener;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, listener.fd, &ev);
+
+    fprintf(stderr, "RAP stub listening on %s\n", path);
+
+    while(!stopping){
+        n = epoll_wait(epfd, events, EVENTS_MAX, 200);
+        for(i = 0; i < n; i++){
+            conn = (Rap_Stub_Conn *) events[i].data.ptr;
+
+            if(conn == &listener){
+                while((fd = accept(listener.fd, NULL, NULL)) >= 0){
+                    if((conn = calloc(1, sizeof(*conn))) == NULL){
+                        close(fd);
+                        continue;
+                    }
+                    conn->fd = fd;
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = conn;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+                }
+                continue;
+            }
+
+            received = read(conn->fd, buffer + 3, sizeof(buffer) - 3);
+            if(received < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+            if(received <= 0){
+                close(conn->fd);
+                free(conn);
+                continue;
+            }
+
+            // One reply per terminator (the tail cannot hold a whole one)
+            data = buffer + 3 - conn->tail_len;
+            memcpy(data, conn->tail, conn->tail_len);
+            length = conn->tail_len + received;
+            for(end = data; (end = memmem(end, data + length - end, msg_end,
+                                          sizeof(msg_end) - 1)) != NULL;
+                end += sizeof(msg_end) - 1){
+                if(write(conn->fd, rap_ok, sizeof(rap_ok) - 1) < 0) break;
+                answered++;
+            }
+
+            conn->tail_len = length < 3 ? length : 3;
+            memcpy(conn->tail, data + length - conn->tail_len, conn->tail_len);
+        }
+    }
+
+    fprintf(stderr, "RAP stub answered %lu requests\n", answered);
+    close(listener.fd);
+    close(epfd);
+    unlink(path);
+    return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Raise the descriptor limit for \a connections sockets.
+//////////////////////////////////////////////////////////////////////////////
+static void raise_nofile(unsigned long connections){
+    struct rlimit limit;
+
+    if(getrlimit(RLIMIT_NOFILE, &limit) != 0) return;
+    if(limit.rlim_cur >= connections + 64) return;
+
+    limit.rlim_cur = connections + 64;
+    if(limit.rlim_max != RLIM_INFINITY && limit.rlim_cur > limit.rlim_max)
+        limit.rlim_cur = limit.rlim_max;
+    if(setrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur < connections + 64)
+        fprintf(stderr, "warning: descriptor limit %lu, some connections will "
+                "fail (raise ulimit -n)\n", (unsigned long) limit.rlim_cur);
+}
+
+static void usage(const char *name){
+    fprintf(stderr, "Usage: %s [-h HOST] [-p PORT] [-u PATH] [-c CONNECTIONS]\n"
+            "       [-t SECONDS] [-m MIX] [-P PIPELINE] [-f FRAGMENT]"
+            " [-s SOCKET]\n", name);
+}
+
+int main(int argc, char **argv){
+    static Bench_Load load;                 // configuration and results
+    struct epoll_event events[EVENTS_MAX];
+    struct sigaction action;
+    Bench_Conn *conns;
+    pthread_t stub;
+    const char *socket_path = NULL;
+    const char *mix = BENCH_MIX;
+    unsigned long connections = BENCH_CONNECTIONS;
+    unsigned long seconds = BENCH_SECONDS;
+    unsigned long port = BENCH_PORT;
+    unsigned long i;
+    uint64_t start;
+    uint64_t last;
+    uint64_t now;
+    uint64_t last_requests = 0;
+    double elapsed;
+    int opt;
+    int n;
+
+    load.host = BENCH_HOST;
+    load.path = BENCH_PATH;
+    load.pipeline = 1;
+
+    while((opt = getopt(argc, argv, "h:p:u:c:t:m:P:f:s:")) != -1){
+        switch(opt){
+            case 'h': load.host = optarg; break;
+            case 'p': port = strtoul(optarg, NULL, 10); break;
+            case 'u': load.path = optarg; break;
+            case 'c': connections = strtoul(optarg, NULL, 10); break;
+            case 't': seconds = strtoul(optarg, NULL, 10); break;
+            case 'm': mix = optarg; break;
+            case 'P': load.pipeline = strtoul(optarg, NULL, 10); break;
+            case 'f': load.fragment = strtoul(optarg, NULL, 10); break;
+            case 's': socket_path = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+
+    load.server.sin_family = AF_INET;
+    load.server.sin_port = htons((uint16_t) port);
+    if(optind != argc || port == 0 || port > 65535 || seconds == 0
+       || load.pipeline == 0 || load.pipeline > PIPELINE_MAX
+       || inet_pton(AF_INET, load.host, &load.server.sin_addr) != 1){
+        usage(argv[0]);
+        return 1;
+    }
+    if(parse_mix(&load, mix) != 0){
+        fprintf(stderr, "Invalid method mix \"%s\" (methods:", mix);
+        for(n = 0; n < M_COUNT; n++) fprintf(stderr, " %s", method_names[n]);
+        fprintf(stderr, ")\n");
+        return 1;
+    }
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    if(socket_path != NULL
+       && pthread_create(&stub, NULL, rap_stub, (void *) socket_path) != 0){
+        perror("pthread_create");
+        return 1;
+    }
+
+    // Stub only - serve the module until killed
+    if(connections == 0){
+        if(socket_path == NULL){
+            usage(argv[0]);
+            return 1;
+        }
+        pthread_join(stub, NULL);
+        return 0;
+    }
+
+    raise_nofile(connections);
+    load.epfd = epoll_create1(0);
+    conns = calloc(connections, sizeof(*conns));
+    if(load.epfd < 0 || conns == NULL){
+        perror("rtsp_load_bench");
+        return 1;
+    }
+
+    start = last = now_us();
+    for(i = 0; i < connections; i++){
+        conns[i].id = (unsigned) i;
+        conns[i].cseq = 1;
+        if(conn_open(&load, &conns[i]) != 0) conns[i].fd = -1;
+    }
+    printf("%lu connections to %s:%lu, mix %s, pipeline %u, fragment %zu\n",
+           load.connects, load.host, port, mix, load.pipeline, load.fragment);
+
+    while(!stopping && (now = now_us()) - start < seconds * 1000000ULL){
+        n = epoll_wait(load.epfd, events, EVENTS_MAX, 100);
+        for(opt = 0; opt < n; opt++)
+            conn_event(&load, (Bench_Conn *) events[opt].data.ptr,
+                       events[opt].events);
+
+        // Progress every second
+        if(now - last >= 1000000){
+            printf("%6.1f s: %10.0f req/s\n", (now - start) / 1e6,
+                   (load.requests - last_requests) * 1e6 / (now - last));
+            fflush(stdout);
+            last_requests = load.requests;
+            last = now;
+        }
+    }
+    elapsed = (now_us() - start) / 1e6;
+    stopping = 1;
+
+    printf("\n%.2f s, %llu connections opened, %llu lost mid-mix\n", elapsed,
+           (unsigned long long) load.connects, (unsigned long long) load.errors);
+    printf("requests: %llu sent, %llu answered (%.0f req/s)\n",
+           (unsigned long long) load.requests,
+           (unsigned long long) load.latency.total,
+           load.latency.total / elapsed);
+    printf("mixes completed: %llu (%.0f mix/s)\n",
+           (unsigned long long) load.cycles, load.cycles / elapsed);
+    printf("responses: 1xx %llu, 2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu, "
+           "invalid %llu\n", (unsigned long long) load.responses[1],
+           (unsigned long long) load.responses[2],
+           (unsigned long long) load.responses[3],
+           (unsigned long long) load.responses[4],
+           (unsigned long long) load.responses[5],
+           (unsigned long long) load.responses[0]);
+    for(n = 0; n < M_COUNT; n++){
+        if(load.by_method[n] > 0)
+            printf("    %-14s %llu\n", method_names[n],
+                   (unsigned long long) load.by_method[n]);
+    }
+    printf("latency: p50 %llu us, p90 %llu us, p99 %llu us, p99.9 %llu us, "
+           "max %llu us\n\n",
+           (unsigned long long) hdr_percentile(&load.latency, 50),
+           (unsigned long long) hdr_percentile(&load.latency, 90),
+           (unsigned long long) hdr_percentile(&load.latency, 99),
+           (unsigned long long) hdr_percentile(&load.latency, 99.9),
+           (unsigned long long) load.latency.max);
+    hdr_print(&load.latency);
+
+    for(i = 0; i < connections; i++){
+        if(conns[i].fd >= 0) close(conns[i].fd);
+    }
+    free(conns);
+    close(load.epfd);
+    if(socket_path != NULL) pthread_join(stub, NULL);
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Object pool of the RTSP module. Blocks are cache-line aligned and carved
+/// from slabs of \a RTSP_Pool::per_slab blocks, free blocks are linked
+/// through their first word.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#if HAVE_CONFIG_H
+    #include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtsp_pool.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Prepare an empty pool (nothing is allocated until the first request).
+///
+/// \param pool The pool.
+/// \param size Size of the objects.
+/// \param per_slab Number of blocks allocated at once.
+//////////////////////////////////////////////////////////////////////////////
+void pool_init(RTSP_Pool *pool, gsize size, guint per_slab){
+    memset(pool, 0, sizeof(*pool));
+    pool->size = (MAX(size, sizeof(gpointer)) + POOL_ALIGN - 1)
+                 & ~(gsize) (POOL_ALIGN - 1);
+    pool->per_slab = per_slab;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Get a block (not initialized). A new slab is allocated only when the
+/// free list is empty.
+///
+/// \param pool The pool.
+/// \return The block or NULL if out of memory.
+//////////////////////////////////////////////////////////////////////////////
+gpointer pool_alloc(RTSP_Pool *pool){
+    gpointer block;
+    char *slab;
+    guint i;
+
+    pool->allocs++;
+
+    if(pool->free != NULL){
+        pool->hits++;
+    }
+    else{
+        if(posix_memalign((void **) &slab, POOL_ALIGN,
+                          pool->size * pool->per_slab) != 0)
+            return NULL;
+
+        pool->slabs = g_slist_prepend(pool->slabs, slab);
+        pool->slab_count++;
+
+        for(i = pool->per_slab; i > 0; i--){
+            block = slab + (i - 1) * pool->size;
+            *(gpointer *) block = pool->free;
+            pool->free = block;
+        }
+    }
+
+    block = pool->free;
+    pool->free = *(gpointer *) block;
+    pool->in_use++;
+
+    return block;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Return a block to the pool.
+///
+/// \param pool The pool the block comes from.
+/// \param block The block.
+//////////////////////////////////////////////////////////////////////////////
+void pool_free(RTSP_Pool *pool, gpointer block){
+    *(gpointer *) block = pool->free;
+    pool->free = block;
+    pool->in_use--;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Free all the slabs (the blocks must not be used any more).
+///
+/// \param pool The pool.
+//////////////////////////////////////////////////////////////////////////////
+void pool_clean(RTSP_Pool *pool){
+    g_slist_free_full(pool->slabs, free);
+    pool_init(pool, pool->size, pool->per_slab);
+}
@@ -0,0 +1,82 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Object pool of the RTSP module - fixed-size blocks carved from slabs.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef MSGIFACE_RTSP_POOL_H
+#define MSGIFACE_RTSP_POOL_H
+
+#include <glib.h>
+
+//////////////////////////////////////////////////////////////////////////////
+/// Alignment of the blocks (size of a cache line).
+//////////////////////////////////////////////////////////////////////////////
+#define POOL_ALIGN 64
+
+//////////////////////////////////////////////////////////////////////////////
+/// Pool of equally sized blocks. Every worker owns its pools, so no locking
+/// is needed. Freed blocks are kept on a free list and never returned to
+/// the system before \a pool_clean, so a warm pool serves connection churn
+/// without calling malloc.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    gsize size;             ///< Block size (multiple of \a POOL_ALIGN).
+    guint per_slab;         ///< Blocks allocated at once.
+    gpointer free;          ///< Free list (next pointer in the block).
+    GSList *slabs;          ///< Allocated slabs.
+    guint slab_count;       ///< Number of \a slabs.
+    guint in_use;           ///< Blocks handed out.
+    unsigned long allocs;   ///< Blocks requested.
+    unsigned long hits;     ///< Requests served from the free list.
+}RTSP_Pool;
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_pool.c
+//////////////////////////////////////////////////////////////////////////////
+extern void pool_init(RTSP_Pool *pool, gsize size, guint per_slab);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_pool.c
+//////////////////////////////////////////////////////////////////////////////
+extern gpointer pool_alloc(RTSP_Pool *pool);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_pool.c
+//////////////////////////////////////////////////////////////////////////////
+extern void pool_free(RTSP_Pool *pool, gpointer block);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_pool.c
+//////////////////////////////////////////////////////////////////////////////
+extern void pool_clean(RTSP_Pool *pool);
+
+//////////////////////////////////////////////////////////////////////////////
+/// Memory held by the pool (bytes).
+//////////////////////////////////////////////////////////////////////////////
+#define pool_resident(pool) \
+    ((gsize) (pool)->slab_count * (pool)->per_slab * (pool)->size)
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// RTSP request structure shared by the module and the Ragel parsers.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef MSGIFACE_RTSP_REQUEST_H
+#define MSGIFACE_RTSP_REQUEST_H
+
+#include <glib.h>
+#include <stddef.h>
+
+#include "rtsp_eris_headers.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Types of RTSP methods (MUST be the same as in rtsp_ragel_request_line.rl).
+/// Method and RTSP version are identified in \a ragel_parse_request_line(...).
+//////////////////////////////////////////////////////////////////////////////
+enum RTSP_method_token {
+  RTSP_ID_ERROR,            ///< An ERROR message (not used).
+  RTSP_ID_DESCRIBE,         ///< A DESCRIBE message (used).
+  RTSP_ID_ANNOUNCE,         ///< An ANNOUNCE message (not used).
+  RTSP_ID_GET_PARAMETERS,   ///< A GET_PARAMETER message (keepalive only).
+  RTSP_ID_OPTIONS,          ///< An OPTIONS message (used).
+  RTSP_ID_PAUSE,            ///< A PAUSE message (used, MUST contain SessID).
+  RTSP_ID_PLAY,             ///< A PLAY message (used, MUST contain SessID).
+  RTSP_ID_RECORD,           ///< A RECORD message (not used).
+  RTSP_ID_REDIRECT,         ///< A REDIRECT message (not used).
+  RTSP_ID_SETUP,            ///< A SETUP message (used)
+  RTSP_ID_STOP,             ///< A STOP message (== RTSP_ID_TEARDOWN, for now)
+  RTSP_ID_TEARDOWN          ///< A TEARDOWN message (used, MUST contain SessID.)
+};
+
+//////////////////////////////////////////////////////////////////////////////
+/// RTSP request structure - method, object, version, headers.
+///
+/// All the strings point directly into the client's input buffer (they are
+/// NOT null-terminated), the view is valid only while the request is being
+/// processed.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    //////////////////////////////////////////////////////////////////
+    /// String representing the method used
+    ///
+    /// Mostly used for logging purposes.
+    //////////////////////////////////////////////////////////////////
+    const char *method;
+    size_t method_len;      ///< Length of \a method.
+
+    //////////////////////////////////////////////////////////////////
+    /// Machine-readable ID of the method
+    ///
+    /// Used by the state machine to choose the callback method.
+    //////////////////////////////////////////////////////////////////
+    enum RTSP_method_token method_id;
+
+    //////////////////////////////////////////////////////////////////
+    /// Object of the request
+    ///
+    /// Represents the object to work on, usually the URL for the
+    /// request (either a resource URL or a track URL). It can be "*"
+    /// for methods like OPTIONS.
+    //////////////////////////////////////////////////////////////////
+    const char *object;
+    size_t object_len;      ///< Length of \a object.
+
+    //////////////////////////////////////////////////////////////////
+    /// Protocol version used
+    ///
+    /// This can only be RTSP/1.0 right now.
+    //////////////////////////////////////////////////////////////////
+    const char *version;
+    size_t version_len;     ///< Length of \a version.
+
+    //////////////////////////////////////////////////////////////////
+    /// All the headers of the request, unparsed.
+    ///
+    /// Positions of the headers relative to \a hdrs; they can used for
+    /// debugging purposes or simply to access the original value of an
+    /// header for pass-through copy. Well-known headers are found
+    /// through \a known.
+    /////////////////////////////////////////////////////////////////
+    const char *hdrs;
+    eris_header_slice hdr[ERIS_MAX_HEADERS];
+    size_t hdr_count;       ///< Number of items in \a hdr.
+
+    //////////////////////////////////////////////////////////////////
+    /// Well-known headers (index into \a hdr plus one, zero if the
+    /// header is missing).
+    /////////////////////////////////////////////////////////////////
+    unsigned char known[ERIS_HDR_OTHER];
+
+    //////////////////////////////////////////////////////////////////
+    /// Length of the message body (Content-Length header).
+    /////////////////////////////////////////////////////////////////
+    size_t content_length;
+}RTSP_Request;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Preliminary request parser from Feng. This function will get protocol type,
+/// protocol version and requested method from received message.
+///
+/// \param msg Message to be parsed (need not be null-terminated).
+/// \param length Length of the message passed on in \a msg.
+/// \param req Target request structure (allocated).
+/// \return Length of headers read (and parsed) from message.
+//////////////////////////////////////////////////////////////////////////////
+extern size_t ragel_parse_request_line(const char *msg,
+                                       const size_t length,
+                                       RTSP_Request *req);
+
+#endif
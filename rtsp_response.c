@@ -0,0 +1,108 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Response templates of the RTSP module. Templates are built once (the
+/// fixed responses in m_init, DESCRIBE responses of the streams when the
+/// catalog is loaded) and shared read-only by all the workers.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#if HAVE_CONFIG_H
+    #include "config.h"
+#endif
+
+#include <string.h>
+
+#include "rtsp_response.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Build a response template. Adjacent static parts are merged into one
+/// segment, so a response is written as a few segments only: the static
+/// text and the dynamic fields (CSeq, Date, Session) in between.
+///
+/// \param tmpl The template to be built.
+/// \param parts Parts of the template (ended by TMPL_END).
+/// \param body Message body (TMPL_BODY and TMPL_LENGTH), may be NULL.
+//////////////////////////////////////////////////////////////////////////////
+void template_build(RTSP_Response_Template *tmpl,
+                    const RTSP_Template_Part *parts,
+                    const char *body){
+    const RTSP_Template_Part *part;         // current part of the template
+    GString *text;                          // merged static parts
+    gsize offset[RESPONSE_SEGMENTS];        // segment offsets in text
+    int i;
+
+    if(body == NULL) body = "";
+
+    text = g_string_new(NULL);
+    tmpl->count = 0;
+
+    for(part = parts; part->field != TMPL_END; part++){
+        // Static parts are appended to the last static segment
+        if(part->field == TMPL_TEXT || part->field == TMPL_LENGTH
+           || part->field == TMPL_BODY){
+            if(tmpl->count == 0
+               || tmpl->field[tmpl->count - 1] != TMPL_TEXT){
+                g_assert(tmpl->count < RESPONSE_SEGMENTS);
+                tmpl->field[tmpl->count] = TMPL_TEXT;
+                tmpl->iov[tmpl->count].iov_len = 0;
+                offset[tmpl->count++] = text->len;
+            }
+
+            i = text->len;
+            if(part->field == TMPL_TEXT)
+                g_string_append(text, part->text);
+            else if(part->field == TMPL_BODY)
+                g_string_append(text, body);
+            else
+                g_string_append_printf(text, "%zu", strlen(body));
+            tmpl->iov[tmpl->count - 1].iov_len += text->len - i;
+        }
+        // Dynamic parts get an empty segment of their own
+        else{
+            g_assert(tmpl->count < RESPONSE_SEGMENTS);
+            tmpl->field[tmpl->count] = part->field;
+            tmpl->iov[tmpl->count].iov_base = NULL;
+            tmpl->iov[tmpl->count++].iov_len = 0;
+        }
+    }
+
+    // The text does not move any more, point the segments into it
+    tmpl->text = g_string_free(text, FALSE);
+    for(i = 0; i < tmpl->count; i++){
+        if(tmpl->field[i] == TMPL_TEXT)
+            tmpl->iov[i].iov_base = tmpl->text + offset[i];
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Free the text of a template.
+///
+/// \param tmpl The template.
+//////////////////////////////////////////////////////////////////////////////
+void template_clean(RTSP_Response_Template *tmpl){
+    g_free(tmpl->text);
+    tmpl->text = NULL;
+    tmpl->count = 0;
+}
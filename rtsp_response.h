@@ -0,0 +1,87 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Response templates of the RTSP module - static parts preformatted into
+/// iovec segments, dynamic fields filled in for each response.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef MSGIFACE_RTSP_RESPONSE_H
+#define MSGIFACE_RTSP_RESPONSE_H
+
+#include <glib.h>
+#include <sys/uio.h>
+
+//////////////////////////////////////////////////////////////////////////////
+/// Max. number of iovec segments of one response (static parts + fields).
+//////////////////////////////////////////////////////////////////////////////
+#define RESPONSE_SEGMENTS 8
+
+//////////////////////////////////////////////////////////////////////////////
+/// Parts of the response templates. Text and lengths are resolved when the
+/// template is built, the rest is formatted for each response.
+//////////////////////////////////////////////////////////////////////////////
+typedef enum {
+    TMPL_END,           ///< End of the template.
+    TMPL_TEXT,          ///< Static text.
+    TMPL_LENGTH,        ///< Length of the body (Content-Length).
+    TMPL_BODY,          ///< Message body (given when the template is built).
+    TMPL_CSEQ,          ///< CSeq of the request.
+    TMPL_DATE,          ///< Current date.
+    TMPL_SESSION,       ///< Session ID.
+    TMPL_TRANSPORT      ///< Negotiated transport of the client.
+} RTSP_Template_Field;
+
+//////////////////////////////////////////////////////////////////////////////
+/// One part of a response template.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    RTSP_Template_Field field;  ///< Type of the part.
+    const char *text;           ///< Text of TMPL_TEXT.
+}RTSP_Template_Part;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Preformatted response - static parts merged into iovec segments, the
+/// dynamic fields are left as empty segments to be filled in.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    struct iovec iov[RESPONSE_SEGMENTS];        ///< Segments of the response.
+    RTSP_Template_Field field[RESPONSE_SEGMENTS]; ///< Type of each segment.
+    int count;                                  ///< Number of segments.
+    char *text;                                 ///< Static parts (one block).
+}RTSP_Response_Template;
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_response.c
+//////////////////////////////////////////////////////////////////////////////
+extern void template_build(RTSP_Response_Template *tmpl,
+                           const RTSP_Template_Part *parts,
+                           const char *body);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_response.c
+//////////////////////////////////////////////////////////////////////////////
+extern void template_clean(RTSP_Response_Template *tmpl);
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Session ID generator for the RTSP module (SipHash-2-4, reference
+/// constants from Aumasson and Bernstein).
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#include <errno.h>
+#include <sys/random.h>
+
+#include "rtsp_sessid.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// 64-bit rotation to the left.
+//////////////////////////////////////////////////////////////////////////////
+#define ROTL(x, b) (uint64_t) (((x) << (b)) | ((x) >> (64 - (b))))
+
+//////////////////////////////////////////////////////////////////////////////
+/// One SipHash round.
+//////////////////////////////////////////////////////////////////////////////
+#define SIPROUND                                                \
+    do {                                                        \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;                  \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;                  \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+    } while (0)
+
+//////////////////////////////////////////////////////////////////////////////
+/// SipHash-2-4 of a single 64-bit word (an 8 byte little-endian message).
+///
+/// \param k0 First half of the key.
+/// \param k1 Second half of the key.
+/// \param m The message.
+/// \return 64-bit hash.
+//////////////////////////////////////////////////////////////////////////////
+static uint64_t siphash24(uint64_t k0, uint64_t k1, uint64_t m){
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+    uint64_t b = ((uint64_t) 8) << 56;      // last block (message length)
+
+    // Compression (one message block, then the length block)
+    v3 ^= m; SIPROUND; SIPROUND; v0 ^= m;
+    v3 ^= b; SIPROUND; SIPROUND; v0 ^= b;
+
+    // Finalization
+    v2 ^= 0xff;
+    SIPROUND; SIPROUND; SIPROUND; SIPROUND;
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Seed the generator with a random key.
+///
+/// \param gen The generator.
+/// \return Zero on success, -1 if the kernel did not provide random bytes.
+//////////////////////////////////////////////////////////////////////////////
+int sessid_init(RTSP_Sessid_Gen *gen){
+    uint64_t seed[3];       // key and initial counter
+    size_t got = 0;         // bytes received
+    ssize_t length;
+
+    while(got < sizeof(seed)){
+        length = getrandom((char *) seed + got, sizeof(seed) - got, 0);
+        if(length < 0){
+            if(errno == EINTR) continue;
+            return -1;
+        }
+        got += length;
+    }
+
+    gen->k0 = seed[0];
+    gen->k1 = seed[1];
+    gen->counter = seed[2];
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Get the next session ID (never zero, zero is left for "no session").
+///
+/// \param gen The generator.
+/// \return New session ID.
+//////////////////////////////////////////////////////////////////////////////
+uint64_t sessid_next(RTSP_Sessid_Gen *gen){
+    uint64_t id;
+
+    do{
+        id = siphash24(gen->k0, gen->k1, gen->counter++);
+    }while(id == 0);
+
+    return id;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Format a session ID as \a SESSION_ID_LEN hex digits.
+///
+/// \param id The session ID.
+/// \param buffer Target buffer (at least \a SESSION_ID_LEN + 1 bytes).
+//////////////////////////////////////////////////////////////////////////////
+void sessid_format(uint64_t id, char *buffer){
+    static const char digits[] = "0123456789abcdef";
+    int i;
+
+    for(i = SESSION_ID_LEN - 1; i >= 0; i--){
+        buffer[i] = digits[id & 0xf];
+        id >>= 4;
+    }
+    buffer[SESSION_ID_LEN] = '\0';
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Parse a session ID formatted by \a sessid_format.
+///
+/// \param text The session ID (null-terminated).
+/// \param id Target of the session ID.
+/// \return Zero on success, -1 if \a text is not a session ID.
+//////////////////////////////////////////////////////////////////////////////
+int sessid_parse(const char *text, uint64_t *id){
+    uint64_t value = 0;
+    int digit;
+    int i;
+
+    for(i = 0; i < SESSION_ID_LEN; i++){
+        if(text[i] >= '0' && text[i] <= '9') digit = text[i] - '0';
+        else if(text[i] >= 'a' && text[i] <= 'f') digit = text[i] - 'a' + 10;
+        else if(text[i] >= 'A' && text[i] <= 'F') digit = text[i] - 'A' + 10;
+        else return -1;
+
+        value = (value << 4) | (uint64_t) digit;
+    }
+    if(text[SESSION_ID_LEN] != '\0') return -1;
+
+    *id = value;
+
+    return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Session ID generator - SipHash-2-4 of a counter under a random key.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef MSGIFACE_RTSP_SESSID_H
+#define MSGIFACE_RTSP_SESSID_H
+
+#include <stdint.h>
+
+//////////////////////////////////////////////////////////////////////////////
+/// Length of a session ID (hex digits, without the terminating null).
+//////////////////////////////////////////////////////////////////////////////
+#define SESSION_ID_LEN 16
+
+//////////////////////////////////////////////////////////////////////////////
+/// Session ID generator. Every worker owns one, so no locking is needed.
+/// The key comes from getrandom(), so without the key the IDs cannot be
+/// predicted from the previous ones (SipHash of the counter). SipHash is not
+/// a permutation and gen_sess_id() replaces the low bits with the worker
+/// index, so an ID may repeat; that is rare, and gen_sess_id() rejects an ID
+/// already in use through session_lookup().
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    uint64_t k0;            ///< First half of the key.
+    uint64_t k1;            ///< Second half of the key.
+    uint64_t counter;       ///< Number of IDs generated.
+}RTSP_Sessid_Gen;
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_sessid.c
+//////////////////////////////////////////////////////////////////////////////
+extern int sessid_init(RTSP_Sessid_Gen *gen);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_sessid.c
+//////////////////////////////////////////////////////////////////////////////
+extern uint64_t sessid_next(RTSP_Sessid_Gen *gen);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_sessid.c
+//////////////////////////////////////////////////////////////////////////////
+extern void sessid_format(uint64_t id, char *buffer);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_sessid.c
+//////////////////////////////////////////////////////////////////////////////
+extern int sessid_parse(const char *text, uint64_t *id);
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Microbenchmark of the session ID generator - IDs per second and the
+/// number of collisions among N generated sessions (1M by default).
+///
+/// Usage: rtsp_sessid_bench [SESSIONS]
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "rtsp_sessid.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Default number of generated sessions.
+//////////////////////////////////////////////////////////////////////////////
+#define BENCH_SESSIONS 1000000
+
+//////////////////////////////////////////////////////////////////////////////
+/// Compare two IDs (qsort).
+//////////////////////////////////////////////////////////////////////////////
+static int compare_id(const void *a, const void *b){
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Seconds elapsed since \a start.
+//////////////////////////////////////////////////////////////////////////////
+static double elapsed(const struct timespec *start){
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv){
+    RTSP_Sessid_Gen gen;                    // generator under test
+    char text[SESSION_ID_LEN + 1];          // formatted ID
+    struct timespec start;
+    unsigned long sessions = BENCH_SESSIONS;
+    unsigned long collisions = 0;
+    unsigned long i;
+    uint64_t *ids;
+    volatile char sink;                     // keeps the formatting alive
+    double seconds;
+
+    if(argc > 1 && (sessions = strtoul(argv[1], NULL, 10)) == 0){
+        fprintf(stderr, "Usage: %s [SESSIONS]\n", argv[0]);
+        return 1;
+    }
+
+    if(sessid_init(&gen) != 0){
+        perror("getrandom");
+        return 1;
+    }
+
+    if((ids = malloc(sessions * sizeof(*ids))) == NULL){
+        perror("malloc");
+        return 1;
+    }
+
+    // Generation and formatting (what gen_sess_id() does per SETUP)
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < sessions; i++){
+        ids[i] = sessid_next(&gen);
+        sessid_format(ids[i], text);
+        sink = text[i % SESSION_ID_LEN];
+    }
+    seconds = elapsed(&start);
+
+    printf("generated %lu IDs in %.3f s: %.0f IDs/s (%.1f ns/ID)\n",
+           sessions, seconds, sessions / seconds, seconds * 1e9 / sessions);
+
+    // Collisions among all the generated IDs
+    qsort(ids, sessions, sizeof(*ids), compare_id);
+    for(i = 1; i < sessions; i++){
+        if(ids[i] == ids[i - 1]) collisions++;
+    }
+
+    printf("collisions: %lu of %lu (rate %.3g, expected %.3g)\n",
+           collisions, sessions, (double) collisions / sessions,
+           (double) sessions / 2 / 18446744073709551616.0);
+
+    free(ids);
+
+    (void) sink;
+
+    return 0;
+}
@@ -0,0 +1,395 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Session table of the RTSP module. Every worker owns one shard and creates
+/// its sessions there; the writers of a shard take its lock (a session is
+/// written by another worker only when a reconnected client adopts it).
+/// Status tools and the other workers read it lock-free, so enumerating the
+/// sessions never stalls an event loop.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#if HAVE_CONFIG_H
+    #include "config.h"
+#endif
+
+#include <string.h>
+
+#include "rtsp_session.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Slot of a session ID in a table. The IDs contain the owner in their low
+/// bits, so they are mixed first (Fibonacci hashing).
+//////////////////////////////////////////////////////////////////////////////
+#define SESSION_HASH(table, id) \
+    ((guint) (((id) * 0x9e3779b97f4a7c15ULL) >> 32) & (table)->mask)
+
+//////////////////////////////////////////////////////////////////////////////
+/// Allocate an empty table.
+///
+/// \param size Number of slots (power of two).
+/// \return The new table.
+//////////////////////////////////////////////////////////////////////////////
+static RTSP_Session_Table *table_new(guint size){
+    RTSP_Session_Table *table;
+
+    table = g_malloc0(sizeof(RTSP_Session_Table)
+                      + size * sizeof(RTSP_Session_Slot));
+    table->mask = size - 1;
+
+    return table;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Free the replaced tables if there is no reader inside the shard. A reader
+/// entering later can only see the current table.
+///
+/// \param shard The shard (writers only).
+//////////////////////////////////////////////////////////////////////////////
+static void shard_reclaim(RTSP_Session_Shard *shard){
+    if(shard->retired != NULL && g_atomic_int_get(&shard->readers) == 0){
+        g_slist_free_full(shard->retired, g_free);
+        shard->retired = NULL;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Rebuild the shard into a new table, large enough for twice the sessions
+/// (tombstones are dropped). The old table stays readable until reclaimed.
+///
+/// \param shard The shard (writers only).
+//////////////////////////////////////////////////////////////////////////////
+static void shard_grow(RTSP_Session_Shard *shard){
+    RTSP_Session_Table *old = shard->table;
+    RTSP_Session_Table *table;
+    guint size = SESSION_TABLE_MIN;
+    guint i, j;
+
+    while(size < (shard->count + 1) * 4) size <<= 1;
+
+    table = table_new(size);
+    for(i = 0; i <= old->mask; i++){
+        if(old->slots[i].id == 0 || old->slots[i].id == SESSION_TOMBSTONE)
+            continue;
+
+        for(j = SESSION_HASH(table, old->slots[i].id); table->slots[j].id != 0;
+            j = (j + 1) & table->mask);
+        table->slots[j].id = old->slots[i].id;
+        table->slots[j].info = old->slots[i].info;
+    }
+
+    // Publish the new table, readers still inside may use the old one
+    g_atomic_pointer_set(&shard->table, table);
+    shard->retired = g_slist_prepend(shard->retired, old);
+    shard->used = shard->count;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Write a slot (readers see either the old or the new content).
+//////////////////////////////////////////////////////////////////////////////
+static void slot_write(RTSP_Session_Slot *slot, uint64_t id,
+                       const RTSP_Session_Info *info){
+    g_atomic_int_inc(&slot->seq);
+    slot->id = id;
+    if(info != NULL) slot->info = *info;
+    g_atomic_int_inc(&slot->seq);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Find the slot of a session (writers only, the slots cannot change).
+///
+/// \param table The current table of the shard.
+/// \param id Session ID.
+/// \return The slot or NULL if there is no such session.
+//////////////////////////////////////////////////////////////////////////////
+static RTSP_Session_Slot *slot_find(RTSP_Session_Table *table, uint64_t id){
+    guint i;
+
+    for(i = SESSION_HASH(table, id); table->slots[i].id != 0;
+        i = (i + 1) & table->mask){
+        if(table->slots[i].id == id) return &table->slots[i];
+    }
+
+    return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Prepare an empty shard.
+///
+/// \param shard The shard.
+//////////////////////////////////////////////////////////////////////////////
+void session_shard_init(RTSP_Session_Shard *shard){
+    memset(shard, 0, sizeof(*shard));
+    shard->table = table_new(SESSION_TABLE_MIN);
+    pthread_mutex_init(&shard->lock, NULL);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Free all the memory of a shard (no reader may be inside).
+///
+/// \param shard The shard.
+//////////////////////////////////////////////////////////////////////////////
+void session_shard_clean(RTSP_Session_Shard *shard){
+    g_slist_free_full(shard->retired, g_free);
+    g_free(shard->table);
+    pthread_mutex_destroy(&shard->lock);
+    memset(shard, 0, sizeof(*shard));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Insert a session or replace its data.
+///
+/// \param shard The shard.
+/// \param id Session ID (not 0 nor \a SESSION_TOMBSTONE).
+/// \param info Session data (copied).
+//////////////////////////////////////////////////////////////////////////////
+void session_set(RTSP_Session_Shard *shard, uint64_t id,
+                 const RTSP_Session_Info *info){
+    RTSP_Session_Table *table;
+    RTSP_Session_Slot *free_slot = NULL;    // first tombstone on the way
+    RTSP_Session_Slot *slot;
+    guint i;
+
+    pthread_mutex_lock(&shard->lock);
+    shard_reclaim(shard);
+
+    // Keep at least half of the slots empty
+    table = shard->table;
+    if((shard->used + 1) * 2 > table->mask + 1){
+        shard_grow(shard);
+        table = shard->table;
+    }
+
+    for(i = SESSION_HASH(table, id);; i = (i + 1) & table->mask){
+        slot = &table->slots[i];
+
+        if(slot->id == id){
+            slot_write(slot, id, info);
+            pthread_mutex_unlock(&shard->lock);
+            return;
+        }
+        if(slot->id == SESSION_TOMBSTONE && free_slot == NULL)
+            free_slot = slot;
+        if(slot->id == 0) break;
+    }
+
+    if(free_slot == NULL){
+        free_slot = slot;
+        shard->used++;
+    }
+    slot_write(free_slot, id, info);
+    shard->count++;
+    pthread_mutex_unlock(&shard->lock);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Remove a session.
+///
+/// \param shard The shard.
+/// \param id Session ID.
+/// \return TRUE if the session was found.
+//////////////////////////////////////////////////////////////////////////////
+gboolean session_remove(RTSP_Session_Shard *shard, uint64_t id){
+    RTSP_Session_Slot *slot;
+
+    pthread_mutex_lock(&shard->lock);
+    shard_reclaim(shard);
+
+    if((slot = slot_find(shard->table, id)) != NULL){
+        slot_write(slot, SESSION_TOMBSTONE, NULL);
+        shard->count--;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return slot != NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Detach a session from its connection (the connection is closed, the
+/// session stays until \a session_expire or \a session_adopt).
+///
+/// \param shard The shard.
+/// \param id Session ID.
+/// \param lease Lease of the detached session (unique, not 0); an older
+///              lease cannot expire the session any more.
+/// \return TRUE if the session was found.
+//////////////////////////////////////////////////////////////////////////////
+gboolean session_detach(RTSP_Session_Shard *shard, uint64_t id, guint lease){
+    RTSP_Session_Slot *slot;
+    RTSP_Session_Info info;
+
+    pthread_mutex_lock(&shard->lock);
+    if((slot = slot_find(shard->table, id)) != NULL){
+        info = slot->info;
+        info.detached = TRUE;
+        info.lease = lease;
+        slot_write(slot, id, &info);
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return slot != NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Take over a detached session for a new connection. Only one connection
+/// gets it, the lease is cancelled.
+///
+/// \param shard The shard.
+/// \param id Session ID.
+/// \param info Target of the session data.
+/// \return TRUE if the session was detached and is adopted now.
+//////////////////////////////////////////////////////////////////////////////
+gboolean session_adopt(RTSP_Session_Shard *shard, uint64_t id,
+                       RTSP_Session_Info *info){
+    RTSP_Session_Slot *slot;
+    gboolean adopted = FALSE;
+
+    pthread_mutex_lock(&shard->lock);
+    if((slot = slot_find(shard->table, id)) != NULL && slot->info.detached){
+        *info = slot->info;
+        info->detached = FALSE;
+        info->lease = 0;
+        slot_write(slot, id, info);
+        adopted = TRUE;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return adopted;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Remove a detached session whose lease has run out.
+///
+/// \param shard The shard.
+/// \param id Session ID.
+/// \param lease The lease that has run out.
+/// \param info Target of the data of the removed session.
+/// \return TRUE if the session was removed, FALSE if it has been adopted
+///         (or removed) meanwhile.
+//////////////////////////////////////////////////////////////////////////////
+gboolean session_expire(RTSP_Session_Shard *shard, uint64_t id, guint lease,
+                        RTSP_Session_Info *info){
+    RTSP_Session_Slot *slot;
+    gboolean expired = FALSE;
+
+    pthread_mutex_lock(&shard->lock);
+    shard_reclaim(shard);
+
+    if((slot = slot_find(shard->table, id)) != NULL && slot->info.detached
+       && slot->info.lease == lease){
+        *info = slot->info;
+        slot_write(slot, SESSION_TOMBSTONE, NULL);
+        shard->count--;
+        expired = TRUE;
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    return expired;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Copy a slot consistently.
+///
+/// \param slot The slot.
+/// \param info Target of the session data (NULL if not needed).
+/// \return ID in the slot.
+//////////////////////////////////////////////////////////////////////////////
+static uint64_t slot_read(RTSP_Session_Slot *slot, RTSP_Session_Info *info){
+    uint64_t id;
+    gint seq;
+
+    for(;;){
+        seq = g_atomic_int_get(&slot->seq);
+        if(seq & 1) continue;
+
+        id = slot->id;
+        if(info != NULL) *info = slot->info;
+
+        if(g_atomic_int_get(&slot->seq) == seq) return id;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Find a session (any thread, no lock).
+///
+/// \param shard The shard.
+/// \param id Session ID.
+/// \param info Target of the session data (NULL if not needed).
+/// \return TRUE if the session was found.
+//////////////////////////////////////////////////////////////////////////////
+gboolean session_lookup(RTSP_Session_Shard *shard, uint64_t id,
+                        RTSP_Session_Info *info){
+    RTSP_Session_Table *table;
+    RTSP_Session_Info copy;
+    uint64_t slot_id;
+    guint i;
+
+    g_atomic_int_inc(&shard->readers);
+    table = g_atomic_pointer_get(&shard->table);
+
+    for(i = SESSION_HASH(table, id);; i = (i + 1) & table->mask){
+        slot_id = slot_read(&table->slots[i], &copy);
+        if(slot_id == id || slot_id == 0) break;
+    }
+
+    g_atomic_int_add(&shard->readers, -1);
+
+    if(slot_id == 0) return FALSE;
+    if(info != NULL) *info = copy;
+
+    return TRUE;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Call \a func for every session of the shard (any thread, no lock).
+/// Sessions added or removed meanwhile may or may not be reported.
+///
+/// \param shard The shard.
+/// \param func Callback (NULL just counts the sessions).
+/// \param data User data for \a func.
+/// \return Number of sessions reported.
+//////////////////////////////////////////////////////////////////////////////
+guint session_foreach(RTSP_Session_Shard *shard, RTSP_Session_Func func,
+                      gpointer data){
+    RTSP_Session_Table *table;
+    RTSP_Session_Info info;
+    uint64_t id;
+    guint count = 0;
+    guint i;
+
+    g_atomic_int_inc(&shard->readers);
+    table = g_atomic_pointer_get(&shard->table);
+
+    for(i = 0; i <= table->mask; i++){
+        id = slot_read(&table->slots[i], &info);
+        if(id == 0 || id == SESSION_TOMBSTONE) continue;
+
+        if(func != NULL) func(id, &info, data);
+        count++;
+    }
+
+    g_atomic_int_add(&shard->readers, -1);
+
+    return count;
+}
@@ -0,0 +1,165 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Session table of the RTSP module - one open-addressing shard per worker.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef MSGIFACE_RTSP_SESSION_H
+#define MSGIFACE_RTSP_SESSION_H
+
+#include <glib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <rum2/utils.h>
+
+#include "rtsp_transport.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Initial (and minimal) number of slots of a shard.
+//////////////////////////////////////////////////////////////////////////////
+#define SESSION_TABLE_MIN 64
+
+//////////////////////////////////////////////////////////////////////////////
+/// Slot of a removed session (session IDs are never zero or all ones).
+//////////////////////////////////////////////////////////////////////////////
+#define SESSION_TOMBSTONE (~(uint64_t) 0)
+
+//////////////////////////////////////////////////////////////////////////////
+/// Session data stored inline in the table (copied out by readers). A
+/// session outlives its connection: a detached session keeps its place in
+/// the reflector until its lease expires or a new connection adopts it.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    ADDR_TYPE addr;         ///< Address of the client.
+    const char *listener_id; ///< Listener the client is routed to (interned).
+    RTSP_Transport transport; ///< Negotiated transport (client ports).
+    ADDR_TYPE dest;         ///< Destination of the stream (RAP address).
+    gboolean playing;       ///< Client has been added by a PLAY request.
+    gboolean paused;        ///< Client is masked by a PAUSE request.
+    gboolean detached;      ///< No connection holds the session.
+    guint lease;            ///< Lease of a detached session (\a session_detach).
+}RTSP_Session_Info;
+
+//////////////////////////////////////////////////////////////////////////////
+/// One slot of the table. The owner makes \a seq odd while writing the
+/// slot, readers retry when \a seq is odd or changed during their copy.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    volatile gint seq;      ///< Sequence number of the slot.
+    uint64_t id;            ///< Session ID (0 == empty, \a SESSION_TOMBSTONE).
+    RTSP_Session_Info info; ///< Session data.
+}RTSP_Session_Slot;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Table of slots (power of two, linear probing).
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    guint mask;                 ///< Number of slots minus one.
+    RTSP_Session_Slot slots[];  ///< The slots.
+}RTSP_Session_Table;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Shard of the session table. The sessions are created by the owning
+/// worker, but any worker may write them (a reconnected client adopts its
+/// session in another worker), so writers take \a lock; any thread may read
+/// the shard without a lock. A grown table replaces the old one atomically,
+/// the old one is freed once no reader is inside the shard.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    RTSP_Session_Table *volatile table; ///< Current table.
+    pthread_mutex_t lock;       ///< Lock of the writers.
+    guint count;                ///< Number of sessions (writers only).
+    guint used;                 ///< Sessions and tombstones (writers only).
+    volatile gint readers;      ///< Readers inside the shard.
+    GSList *retired;            ///< Replaced tables waiting to be freed.
+}RTSP_Session_Shard;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Callback of \a session_foreach (called with a consistent copy).
+//////////////////////////////////////////////////////////////////////////////
+typedef void (*RTSP_Session_Func)(uint64_t id,
+                                  const RTSP_Session_Info *info,
+                                  gpointer data);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_session.c
+//////////////////////////////////////////////////////////////////////////////
+extern void session_shard_init(RTSP_Session_Shard *shard);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_session.c
+//////////////////////////////////////////////////////////////////////////////
+extern void session_shard_clean(RTSP_Session_Shard *shard);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_session.c
+//////////////////////////////////////////////////////////////////////////////
+extern void session_set(RTSP_Session_Shard *shard,
+                        uint64_t id,
+                        const RTSP_Session_Info *info);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_session.c
+//////////////////////////////////////////////////////////////////////////////
+extern gboolean session_remove(RTSP_Session_Shard *shard, uint64_t id);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_session.c
+//////////////////////////////////////////////////////////////////////////////
+extern gboolean session_detach(RTSP_Session_Shard *shard,
+                               uint64_t id,
+                               guint lease);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_session.c
+//////////////////////////////////////////////////////////////////////////////
+extern gboolean session_adopt(RTSP_Session_Shard *shard,
+                              uint64_t id,
+                              RTSP_Session_Info *info);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_session.c
+//////////////////////////////////////////////////////////////////////////////
+extern gboolean session_expire(RTSP_Session_Shard *shard,
+                               uint64_t id,
+                               guint lease,
+                               RTSP_Session_Info *info);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_session.c
+//////////////////////////////////////////////////////////////////////////////
+extern gboolean session_lookup(RTSP_Session_Shard *shard,
+                               uint64_t id,
+                               RTSP_Session_Info *info);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_session.c
+//////////////////////////////////////////////////////////////////////////////
+extern guint session_foreach(RTSP_Session_Shard *shard,
+                             RTSP_Session_Func func,
+                             gpointer data);
+
+#endif
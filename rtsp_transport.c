@@ -0,0 +1,297 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Transport negotiation of the RTSP module. The Transport header (RFC 2326,
+/// section 12.39) is parsed in place - a list of transport specifications
+/// in the order of the client's preference, each one a protocol followed by
+/// parameters:
+///
+///     RTP/AVP;multicast, RTP/AVP;unicast;client_port=5000-5001
+///
+/// The first specification the server can serve is taken.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#if HAVE_CONFIG_H
+    #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <rum2/limits.h>
+
+#include "rtsp_transport.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Strip the white space around a part of the header.
+///
+/// \param str The part (not a c_str).
+/// \param len Length of the part (updated).
+/// \return Start of the stripped part.
+//////////////////////////////////////////////////////////////////////////////
+static const char *strip(const char *str, size_t *len){
+    while(*len > 0 && (str[0] == ' ' || str[0] == '\t')){
+        str++;
+        (*len)--;
+    }
+    while(*len > 0 && (str[*len - 1] == ' ' || str[*len - 1] == '\t'))
+        (*len)--;
+
+    return str;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Compare a part of the header with a token (case insensitive).
+///
+/// \param str The part (not a c_str).
+/// \param len Length of the part.
+/// \param token The token (c_str).
+/// \return TRUE if they are equal.
+//////////////////////////////////////////////////////////////////////////////
+static gboolean token_is(const char *str, size_t len, const char *token){
+    return len == strlen(token) && g_ascii_strncasecmp(str, token, len) == 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Parse a number (port, channel).
+///
+/// \param str The number (not a c_str).
+/// \param len Length of the number.
+/// \param min The smallest valid value.
+/// \param max The largest valid value.
+/// \param number Where to store the number.
+/// \return TRUE if it is a valid number within the limits.
+//////////////////////////////////////////////////////////////////////////////
+static gboolean parse_value(const char *str, size_t len, guint min, guint max,
+                            guint *number){
+    size_t i;
+
+    if(len == 0 || len > 5) return FALSE;
+
+    *number = 0;
+    for(i = 0; i < len; i++){
+        if(str[i] < '0' || str[i] > '9') return FALSE;
+        *number = *number * 10 + (str[i] - '0');
+    }
+
+    return *number >= min && *number <= max;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Parse a range ("5000-5001" or a single value).
+///
+/// \param str The range (not a c_str).
+/// \param len Length of the range.
+/// \param min The smallest valid value.
+/// \param max The largest valid value.
+/// \param first Where to store the first value.
+/// \param last Where to store the last value.
+/// \return TRUE if the range is valid.
+//////////////////////////////////////////////////////////////////////////////
+static gboolean parse_range(const char *str, size_t len, guint min, guint max,
+                            guint *first, guint *last){
+    const char *dash = memchr(str, '-', len);
+
+    if(dash == NULL){
+        if(!parse_value(str, len, min, max, first)) return FALSE;
+        *last = *first;
+        return TRUE;
+    }
+
+    return parse_value(str, dash - str, min, max, first)
+           && parse_value(dash + 1, len - (dash - str) - 1, min, max, last)
+           && *last >= *first;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Parse one transport specification. Parameters the server does not care
+/// about (ttl, ssrc, mode, ...) are skipped.
+///
+/// \param spec The specification (not a c_str).
+/// \param len Length of the specification.
+/// \param transport Where to store the transport.
+/// \return TRUE if the server can deliver the stream this way.
+//////////////////////////////////////////////////////////////////////////////
+static gboolean parse_spec(const char *spec, size_t len,
+                           RTSP_Transport *transport){
+    const char *end = spec + len;           // end of the specification
+    const char *next;                       // end of the current part
+    const char *part;                       // current part (protocol, param)
+    const char *value;                      // value of the parameter
+    size_t part_len;
+    size_t name_len;
+    guint first, last;                      // range of ports or channels
+    gboolean channels = FALSE;              // interleaved channels given
+
+    memset(transport, 0, sizeof(*transport));
+
+    // Protocol (profile and lower transport)
+    if((next = memchr(spec, ';', len)) == NULL) next = end;
+    part_len = next - spec;
+    part = strip(spec, &part_len);
+
+    if(token_is(part, part_len, "RTP/AVP")
+       || token_is(part, part_len, "RTP/AVP/UDP"))
+        transport->profile = TRANSPORT_RTP_AVP;
+    else if(token_is(part, part_len, "RTP/AVP/TCP"))
+        transport->profile = TRANSPORT_RTP_AVP_TCP;
+    else if(token_is(part, part_len, "RAW/RAW/UDP"))
+        transport->profile = TRANSPORT_RAW_UDP;
+    else if(token_is(part, part_len, "udp"))
+        transport->profile = TRANSPORT_UDP;
+    else
+        return FALSE;
+
+    // Parameters
+    while(next < end){
+        part = next + 1;
+        if((next = memchr(part, ';', end - part)) == NULL) next = end;
+        part_len = next - part;
+        part = strip(part, &part_len);
+
+        if((value = memchr(part, '=', part_len)) != NULL){
+            name_len = value - part;
+            value++;
+        }
+        else{
+            name_len = part_len;
+            value = part + part_len;
+        }
+
+        if(token_is(part, name_len, "unicast")){
+            transport->delivery = TRANSPORT_UNICAST;
+        }
+        else if(token_is(part, name_len, "multicast")){
+            transport->delivery = TRANSPORT_MULTICAST;
+        }
+        else if(token_is(part, name_len, "client_port")){
+            if(!parse_range(value, part + part_len - value, 1, G_MAXUINT16,
+                            &first, &last))
+                return FALSE;
+            transport->client_port = first;
+            transport->client_port_end = last;
+        }
+        else if(token_is(part, name_len, "interleaved")){
+            if(!parse_range(value, part + part_len - value, 0, G_MAXUINT8,
+                            &first, &last))
+                return FALSE;
+            transport->channel = first;
+            transport->channel_end = last;
+            channels = TRUE;
+        }
+    }
+
+    // Frames go over the RTSP connection, channels 0-1 unless chosen
+    if(transport->profile == TRANSPORT_RTP_AVP_TCP){
+        transport->delivery = TRANSPORT_INTERLEAVED;
+        if(!channels) transport->channel_end = 1;
+        return TRUE;
+    }
+
+    // Multicast is the default of RFC 2326, but clients giving a port and
+    // no delivery (older players) mean unicast
+    if(transport->delivery == 0)
+        transport->delivery = (transport->client_port != 0)
+                              ? TRANSPORT_UNICAST : TRANSPORT_MULTICAST;
+
+    // Unicast needs somewhere to send the stream to
+    return transport->delivery != TRANSPORT_UNICAST
+           || transport->client_port != 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Choose the transport of a client from its Transport header - the first
+/// specification with a supported protocol and delivery. The header is
+/// parsed in place, nothing is allocated.
+///
+/// \param hdr Value of the Transport header (not a c_str).
+/// \param len Length of the value.
+/// \param accept Deliveries the server offers (TRANSPORT_UNICAST, ...).
+/// \param transport Where to store the chosen transport.
+/// \return TRUE if a transport was chosen, FALSE if none is supported.
+//////////////////////////////////////////////////////////////////////////////
+gboolean transport_parse(const char *hdr, size_t len, int accept,
+                         RTSP_Transport *transport){
+    const char *end = hdr + len;            // end of the header
+    const char *next;                       // end of the specification
+    RTSP_Transport spec;                    // the current specification
+
+    while(hdr < end){
+        if((next = memchr(hdr, ',', end - hdr)) == NULL) next = end;
+
+        if(parse_spec(hdr, next - hdr, &spec) && (spec.delivery & accept)){
+            *transport = spec;
+            return TRUE;
+        }
+
+        hdr = next + 1;
+    }
+
+    return FALSE;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Format the negotiated transport for the Transport line of the SETUP
+/// response (protocol, delivery and ports, the rest is static). The protocol
+/// is named the way the client named it.
+///
+/// \param transport The transport.
+/// \param buffer Target buffer.
+/// \param size Size of the buffer.
+/// \return Length of the string (as snprintf).
+//////////////////////////////////////////////////////////////////////////////
+int transport_format(const RTSP_Transport *transport, char *buffer,
+                     size_t size){
+    char group[ADDRSTR_LEN];                // multicast group as c_str
+    const char *profile;
+
+    switch(transport->profile){
+        case TRANSPORT_RTP_AVP: profile = "RTP/AVP"; break;
+        case TRANSPORT_RAW_UDP: profile = "RAW/RAW/UDP"; break;
+        default: profile = "udp";
+    }
+
+    if(transport->delivery == TRANSPORT_INTERLEAVED)
+        return snprintf(buffer, size, "RTP/AVP/TCP;interleaved=%u-%u",
+                        (guint) transport->channel,
+                        (guint) transport->channel_end);
+
+    if(transport->delivery == TRANSPORT_MULTICAST){
+        inet_ntop(AF_INET46, &transport->destination, group, sizeof(group));
+        return snprintf(buffer, size, "%s;multicast;destination=%s;port=%u-%u;"
+                        "ttl=%u", profile, group, (guint) transport->client_port,
+                        (guint) transport->client_port_end,
+                        (guint) transport->ttl);
+    }
+
+    if(transport->client_port == transport->client_port_end)
+        return snprintf(buffer, size, "%s;unicast;client_port=%u", profile,
+                        (guint) transport->client_port);
+
+    return snprintf(buffer, size, "%s;unicast;client_port=%u-%u", profile,
+                    (guint) transport->client_port,
+                    (guint) transport->client_port_end);
+}
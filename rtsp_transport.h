@@ -0,0 +1,98 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Transport negotiation of the RTSP module - parser of the Transport header
+/// of SETUP requests and the Transport line of the response.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef MSGIFACE_RTSP_TRANSPORT_H
+#define MSGIFACE_RTSP_TRANSPORT_H
+
+#include <glib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <rum2/utils.h>
+
+//////////////////////////////////////////////////////////////////////////////
+/// Unicast delivery (the stream is sent to the client's address).
+//////////////////////////////////////////////////////////////////////////////
+#define TRANSPORT_UNICAST 0x01
+
+//////////////////////////////////////////////////////////////////////////////
+/// Multicast delivery (the client joins a group).
+//////////////////////////////////////////////////////////////////////////////
+#define TRANSPORT_MULTICAST 0x02
+
+//////////////////////////////////////////////////////////////////////////////
+/// Interleaved delivery (frames over the RTSP connection).
+//////////////////////////////////////////////////////////////////////////////
+#define TRANSPORT_INTERLEAVED 0x04
+
+//////////////////////////////////////////////////////////////////////////////
+/// Client port of clients which do not send a Transport header (the port
+/// all the clients were told before the header was parsed).
+//////////////////////////////////////////////////////////////////////////////
+#define TRANSPORT_DEFAULT_PORT 1234
+
+//////////////////////////////////////////////////////////////////////////////
+/// Transport protocols the stream can be delivered with.
+//////////////////////////////////////////////////////////////////////////////
+typedef enum {
+    TRANSPORT_UDP,          ///< Plain UDP ("udp", the module's own name).
+    TRANSPORT_RAW_UDP,      ///< Plain UDP as named by VLC ("RAW/RAW/UDP").
+    TRANSPORT_RTP_AVP,      ///< RTP audio/video profile ("RTP/AVP[/UDP]").
+    TRANSPORT_RTP_AVP_TCP   ///< RTP interleaved with RTSP ("RTP/AVP/TCP").
+} RTSP_Transport_Profile;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Negotiated transport of a client (copied from the request, nothing points
+/// into the input buffer). Multicast transports come from the catalog, a
+/// client only asks for one.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    RTSP_Transport_Profile profile; ///< Transport protocol.
+    int delivery;                   ///< TRANSPORT_UNICAST, _MULTICAST, ...
+    guint16 client_port;            ///< First client port (0 if none).
+    guint16 client_port_end;        ///< Last client port of the range.
+    guint8 channel;                 ///< First interleaved channel.
+    guint8 channel_end;             ///< Last interleaved channel.
+    IN_ADDR destination;            ///< Multicast group (ports in client_port).
+    guint8 ttl;                     ///< Time to live of the multicast packets.
+}RTSP_Transport;
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_transport.c
+//////////////////////////////////////////////////////////////////////////////
+extern gboolean transport_parse(const char *hdr, size_t len, int accept,
+                                RTSP_Transport *transport);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_transport.c
+//////////////////////////////////////////////////////////////////////////////
+extern int transport_format(const RTSP_Transport *transport, char *buffer,
+                            size_t size);
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Timing wheel of the RTSP module. Every worker owns one wheel, advanced
+/// by a periodic watcher once per tick, so arming, rearming and cancelling
+/// a timeout is O(1) no matter how many clients are idle.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#if HAVE_CONFIG_H
+    #include "config.h"
+#endif
+
+#include <math.h>
+
+#include "rtsp_wheel.h"
+
+//////////////////////////////////////////////////////////////////////////////
+/// Slot of a tick (entries expiring beyond the ring go to the last slot).
+//////////////////////////////////////////////////////////////////////////////
+#define wheel_slot(wheel, tick) \
+    (&(wheel)->slots[MIN((tick), (wheel)->now + (wheel)->mask) \
+                     & (wheel)->mask])
+
+//////////////////////////////////////////////////////////////////////////////
+/// Append an entry to a list.
+///
+/// \param head The list head.
+/// \param entry The entry (not in any list).
+//////////////////////////////////////////////////////////////////////////////
+static inline void wheel_link(RTSP_Wheel_Entry *head, RTSP_Wheel_Entry *entry){
+    entry->next = head;
+    entry->prev = head->prev;
+    head->prev->next = entry;
+    head->prev = entry;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Remove an entry from its list.
+///
+/// \param entry The entry.
+//////////////////////////////////////////////////////////////////////////////
+static inline void wheel_unlink(RTSP_Wheel_Entry *entry){
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->next = entry->prev = NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Prepare an empty wheel.
+///
+/// \param wheel The wheel.
+/// \param tick Length of a tick (seconds).
+/// \param span Longest usual timeout (seconds), the ring covers it.
+/// \param now Current time (seconds).
+//////////////////////////////////////////////////////////////////////////////
+void wheel_init(RTSP_Wheel *wheel, double tick, double span, double now){
+    guint64 slots = 2;
+    guint64 i;
+
+    while(slots * tick <= span) slots <<= 1;
+
+    wheel->slots = g_new(RTSP_Wheel_Entry, slots);
+    for(i = 0; i < slots; i++)
+        wheel->slots[i].next = wheel->slots[i].prev = &wheel->slots[i];
+
+    wheel->mask = slots - 1;
+    wheel->now = (guint64) floor(now / tick);
+    wheel->tick = tick;
+    wheel->count = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Free the slots (the entries are just forgotten).
+///
+/// \param wheel The wheel.
+//////////////////////////////////////////////////////////////////////////////
+void wheel_clean(RTSP_Wheel *wheel){
+    g_free(wheel->slots);
+    wheel->slots = NULL;
+    wheel->count = 0;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Arm an entry or rearm an armed one. The entry expires in the first tick
+/// starting \a timeout seconds or later from \a now.
+///
+/// \param wheel The wheel.
+/// \param entry The entry.
+/// \param now Current time (seconds).
+/// \param timeout Timeout (seconds).
+//////////////////////////////////////////////////////////////////////////////
+void wheel_arm(RTSP_Wheel *wheel, RTSP_Wheel_Entry *entry,
+               double now, double timeout){
+    guint64 expire = (guint64) ceil((now + timeout) / wheel->tick);
+
+    if(expire <= wheel->now) expire = wheel->now + 1;
+
+    if(entry->next != NULL){
+        // Later - the entry is moved when its current slot is visited
+        if(expire >= entry->expire){
+            entry->expire = expire;
+            return;
+        }
+        wheel_unlink(entry);
+        wheel->count--;
+    }
+
+    entry->expire = expire;
+    wheel_link(wheel_slot(wheel, expire), entry);
+    wheel->count++;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Disarm an entry (nothing happens if it is not armed).
+///
+/// \param wheel The wheel.
+/// \param entry The entry.
+//////////////////////////////////////////////////////////////////////////////
+void wheel_cancel(RTSP_Wheel *wheel, RTSP_Wheel_Entry *entry){
+    if(entry->next == NULL) return;
+
+    wheel_unlink(entry);
+    wheel->count--;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// Process all the ticks up to \a now. Expired entries are disarmed and
+/// passed to \a func (which may arm or cancel any entry), the others found
+/// in the visited slots are moved to the slots of their \a expire.
+///
+/// \param wheel The wheel.
+/// \param now Current time (seconds).
+/// \param func Callback of the expired entries.
+/// \param data User data passed to \a func.
+//////////////////////////////////////////////////////////////////////////////
+void wheel_advance(RTSP_Wheel *wheel, double now,
+                   RTSP_Wheel_Func func, gpointer data){
+    guint64 target = (guint64) floor(now / wheel->tick);
+    RTSP_Wheel_Entry visit;                 // entries of the visited slot
+    RTSP_Wheel_Entry *head;
+    RTSP_Wheel_Entry *entry;
+
+    // After a long stall one round visits every slot
+    if(target > wheel->now + wheel->mask + 1)
+        wheel->now = target - wheel->mask - 1;
+
+    while(wheel->now < target){
+        wheel->now++;
+        head = &wheel->slots[wheel->now & wheel->mask];
+        if(head->next == head) continue;
+
+        // Detach the slot, callbacks may touch any entry
+        visit.next = head->next;
+        visit.prev = head->prev;
+        visit.next->prev = visit.prev->next = &visit;
+        head->next = head->prev = head;
+
+        while(visit.next != &visit){
+            entry = visit.next;
+            wheel_unlink(entry);
+
+            if(entry->expire > wheel->now){
+                wheel_link(wheel_slot(wheel, entry->expire), entry);
+                continue;
+            }
+
+            wheel->count--;
+            func(entry, data);
+        }
+    }
+}
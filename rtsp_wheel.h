@@ -0,0 +1,93 @@
+/*
+ Module msg-interface/rtsp.
+
+ This file is part of RUM2.
+
+ RUM2 is free software; you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation; either version 2 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program; if not, write to the Free Software
+ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+//////////////////////////////////////////////////////////////////////////////
+/// \file
+/// Timing wheel of the RTSP module - idle timeouts of the clients.
+/// \author arax
+/// \date 2010
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef MSGIFACE_RTSP_WHEEL_H
+#define MSGIFACE_RTSP_WHEEL_H
+
+#include <glib.h>
+
+//////////////////////////////////////////////////////////////////////////////
+/// Entry of the wheel (embedded in the object that may time out).
+//////////////////////////////////////////////////////////////////////////////
+typedef struct RTSP_Wheel_Entry {
+    struct RTSP_Wheel_Entry *next;  ///< Next entry in the slot (NULL if idle).
+    struct RTSP_Wheel_Entry *prev;  ///< Previous entry in the slot.
+    guint64 expire;                 ///< Tick the entry expires in.
+    gpointer data;                  ///< Owner of the entry.
+}RTSP_Wheel_Entry;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Callback of an expired entry (the entry is already disarmed).
+//////////////////////////////////////////////////////////////////////////////
+typedef void (*RTSP_Wheel_Func)(RTSP_Wheel_Entry *entry, gpointer data);
+
+//////////////////////////////////////////////////////////////////////////////
+/// Timing wheel - a ring of slots, one per tick, each with a list of the
+/// entries expiring in it. Entries expiring further than the ring reaches
+/// are kept in the farthest slot and moved on when it is visited.
+///
+/// Rearming an entry for a later tick only updates \a expire, the entry is
+/// moved when its old slot comes up; a client reading every few seconds
+/// thus costs nothing but a store.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    RTSP_Wheel_Entry *slots;        ///< List heads (circular lists).
+    guint64 mask;                   ///< Number of slots minus one.
+    guint64 now;                    ///< Last tick processed.
+    double tick;                    ///< Length of a tick (seconds).
+    guint count;                    ///< Armed entries.
+}RTSP_Wheel;
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_wheel.c
+//////////////////////////////////////////////////////////////////////////////
+extern void wheel_init(RTSP_Wheel *wheel, double tick, double span, double now);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_wheel.c
+//////////////////////////////////////////////////////////////////////////////
+extern void wheel_clean(RTSP_Wheel *wheel);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_wheel.c
+//////////////////////////////////////////////////////////////////////////////
+extern void wheel_arm(RTSP_Wheel *wheel, RTSP_Wheel_Entry *entry,
+                      double now, double timeout);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_wheel.c
+//////////////////////////////////////////////////////////////////////////////
+extern void wheel_cancel(RTSP_Wheel *wheel, RTSP_Wheel_Entry *entry);
+
+//////////////////////////////////////////////////////////////////////////////
+/// \see rtsp_wheel.c
+//////////////////////////////////////////////////////////////////////////////
+extern void wheel_advance(RTSP_Wheel *wheel, double now,
+                          RTSP_Wheel_Func func, gpointer data);
+
+#endif